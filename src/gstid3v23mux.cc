@@ -63,8 +63,9 @@
  * </para>
  *
  * <para>
- * The tagging is performed through the C++ library id3lib and relies on a copy
- * of the good/ext/taglib sub-framework available in GStreamer.
+ * The tags are serialized by a built-in ID3v2.3 writer, the C++ library id3lib
+ * can still be used instead when the plugin is built with ID3LIB=1. The plugin
+ * relies on a copy of the good/ext/taglib sub-framework available in GStreamer.
  *
  * This plugin is a simple tagger. Here's a sample example on how to retag
  * an existing MP3:
@@ -72,7 +73,115 @@
  * gst-launch filesrc location=old.mp3 ! id3demux ! id3v23mux ! filesink location=new.mp3
  * </programlisting>
  * </para>
- * </refsect2>
+ *
+ * <para>
+ * The tags written and their frames: title (TIT2), artist (TPE1), album
+ * artist (TPE2), album (TALB), album volume number and count (TPOS), track
+ * number and count (TRCK), genre (TCON), date (TYER and TDAT), composer
+ * (TCOM), copyright (TCOP), organization (TPUB), encoder (TSSE), beats per
+ * minute (TBPM), ISRC (TSRC), duration (TLEN), comment (COMM), the
+ * MusicBrainz track ID (UFID) and the other MusicBrainz IDs (TXXX), image and
+ * preview image (APIC). The artists and the composers with several values are
+ * joined with '/', only the first value of the other tags is written. The
+ * other tags are dropped.
+ * </para>
+ *
+ * <para>
+ * The frames can be compressed with zlib as allowed by ID3v2.3, the property
+ * compress-frames sets the size from which a frame is compressed and
+ * compress-level the zlib level. A frame is stored compressed only when this
+ * saves bytes, which is seldom the case of the pictures (JPEG and PNG are
+ * already compressed). Not all the players support compressed frames.
+ * <programlisting>
+ * gst-launch filesrc location=old.mp3 ! id3demux ! id3v23mux compress-frames=256 ! filesink location=new.mp3
+ * </programlisting>
+ * </para>
+ *
+ * <para>
+ * The frames of a big tag (several pictures, frames to compress) can be
+ * encoded by several threads, the property max-threads sets how many. The
+ * threads are shared by all the elements and the small tags are always
+ * encoded by the streaming thread. The tag written is the same no matter the
+ * number of threads.
+ * </para>
+ *
+ * <para>
+ * Some old hardware players take the bytes 0xFF 0xEx of a tag (usually in a
+ * cover) for the start of an MPEG frame. The property unsynchronise escapes
+ * these bytes as defined by ID3v2.3: always, only when the tag has such bytes
+ * (auto) or never (off, the default). The bytes inserted take the place of
+ * the padding, so with some padding the size of the tag doesn't change. The
+ * tag is then pushed as a single buffer even with zero-copy.
+ * <programlisting>
+ * gst-launch filesrc location=old.mp3 ! id3demux ! id3v23mux unsynchronise=auto padding=1024 ! filesink location=new.mp3
+ * </programlisting>
+ * </para>
+ *
+ * <para>
+ * The tag can be padded in order to leave room for future edits. The property
+ * padding reserves a minimal number of bytes while the property align-to pads
+ * the tag so that the audio starts on a block boundary:
+ * <programlisting>
+ * gst-launch filesrc location=old.mp3 ! id3demux ! id3v23mux padding=4096 align-to=4096 ! filesink location=new.mp3
+ * </programlisting>
+ * </para>
+ *
+ * <para>
+ * A preview image identical to the image is dropped. With zero-copy the
+ * pictures are never copied, only the frame headers are written.
+ * </para>
+ *
+ * <para>
+ * When the same element tags several tracks of an album, the property
+ * template keeps the frames of the previous tag serialized. Only the frames
+ * that changed (usually the title and the track number) are encoded again,
+ * the others are copied as they are.
+ * </para>
+ *
+ * <para>
+ * The frames are encoded as soon as the tags are known, when the element
+ * goes to PAUSED and each time a tag event arrives. When the first buffer
+ * arrives only the frames whose tags changed since are encoded again and
+ * the tag is assembled from frames that are ready.
+ * </para>
+ *
+ * <para>
+ * The text frames are written in ISO-8859-1 when all their characters can be
+ * represented in it and in UTF-16 otherwise. The property encoding forces one
+ * of the two encodings instead.
+ * </para>
+ *
+ * <para>
+ * With the property late-tags the element doesn't wait for the first audio
+ * buffer: a placeholder tag of reserved-size bytes is pushed as soon as the
+ * stream starts and it's rewritten at EOS with all the tags received, the
+ * sink seeking back to the start of the file. This only happens when the
+ * sink is seekable, and the tags have to fit in the reserved size:
+ * <programlisting>
+ * gst-launch filesrc location=old.mp3 ! id3demux ! id3v23mux late-tags=true reserved-size=65536 ! filesink location=new.mp3
+ * </programlisting>
+ * </para>
+ *
+ * <para>
+ * With the property strip-existing the element drops the ID3v2 and ID3v1
+ * tags of the stream by itself, their tags are merged with the tags received
+ * and id3demux isn't needed:
+ * <programlisting>
+ * gst-launch filesrc location=old.mp3 ! id3v23mux strip-existing=true ! filesink location=new.mp3
+ * </programlisting>
+ * </para>
+ *
+ * <para>
+ * The queries and the seeks in bytes are translated across the tag once it's
+ * out. A seek in the tag pushes the tag again from the sought byte.
+ * </para>
+ *
+ * <para>
+ * With the property scan-mpeg the headers of the MPEG audio frames passed
+ * through are followed and the duration of the stream is written in a TLEN
+ * frame at EOS. The tag is reserved and rewritten as in the late-tags mode.
+ * </para>
+* </refsect2>
  */
 
 #ifdef HAVE_CONFIG_H
@@ -80,19 +189,52 @@
 #endif
 
 #include "gstid3v23mux.h"
+#include "id3v23arena.h"
+#include "id3v23probes.h"
+#include "id3v23render.h"
+#include "id3v23text.h"
 
 #include <string.h>
+#include <unistd.h>
+#include <zlib.h>
 
+#ifdef HAVE_ID3LIB
 #include <id3/tag.h>
+#endif
 #include <gst/tag/tag.h>
 
 
-#define TAG_ADD_FRAME(tag, frame) if (frame != NULL) {tag.AddFrame(frame);}
+#define TAG_ADD_FRAME(frames, frame) if (frame != NULL) {g_ptr_array_add(frames, frame);}
+
+// Largest alignment accepted for the end of the tag (1 MiB)
+#define ID3V23_MAX_ALIGN_TO       0x00100000
+
+// The picture types written in the APIC frames
+#define ID3V23_PICTURE_OTHER      0x00
+#define ID3V23_PICTURE_PNG32ICON  0x01
+
+// The flag of the frames compressed with zlib (second byte of the flags)
+#define ID3V23_FRAME_COMPRESSED   0x80
+
+// Default zlib level of the compressed frames
+#define ID3V23_DEFAULT_COMPRESS_LEVEL  6
+
+// Room for a number written in decimal: the 20 digits of a guint64, the sign
+// and the terminator
+#define ID3V23_NUMBER_SIZE  24
+
+// The frames are encoded by several threads only when at least two frames
+// have this many bytes to encode and the whole tag this many bytes, the
+// compression counts as many times the size of the frame
+#define ID3V23_PARALLEL_MIN_FRAME      (64 * 1024)
+#define ID3V23_PARALLEL_MIN_WORK       (512 * 1024)
+#define ID3V23_PARALLEL_COMPRESS_COST  8
 
 
 GST_DEBUG_CATEGORY_STATIC (gst_id3v23_mux_debug);
 #define GST_CAT_DEFAULT gst_id3v23_mux_debug
 
+
 static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE(
 	"src",
 	GST_PAD_SRC,
@@ -101,6 +243,21 @@ static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE(
 );
 
 
+enum {
+	PROP_0,
+	PROP_ID3LIB,
+	PROP_ZERO_COPY,
+	PROP_PADDING,
+	PROP_ALIGN_TO,
+	PROP_TEMPLATE,
+	PROP_ENCODING,
+	PROP_COMPRESS_FRAMES,
+	PROP_COMPRESS_LEVEL,
+	PROP_MAX_THREADS,
+	PROP_UNSYNCHRONISE
+};
+
+
 GST_BOILERPLATE(GstId3v23Mux, gst_id3v23_mux, GstTagLibMuxPriv, GST_TYPE_TAG_LIB_MUX);
 
 
@@ -109,6 +266,91 @@ static GstBuffer* gst_id3v23_mux_render_tag (
 	GstTagList   *taglist
 );
 
+static GstBufferList* gst_id3v23_mux_render_tag_list (
+	GstTagLibMuxPriv *mux,
+	GstTagList   *taglist
+);
+
+static void gst_id3v23_mux_set_property(
+	GObject      *object,
+	guint        prop_id,
+	const GValue *value,
+	GParamSpec   *pspec
+);
+
+static void gst_id3v23_mux_get_property (
+	GObject    *object,
+	guint      prop_id,
+	GValue     *value,
+	GParamSpec *pspec
+);
+
+static void gst_id3v23_mux_finalize (
+	GObject *object
+);
+
+static void gst_id3v23_mux_keep_frames (
+	GstId3v23Mux *mux,
+	GPtrArray    *frames,
+	Id3v23Arena  *arena
+);
+
+static Id3v23Arena* gst_id3v23_mux_arena (
+	GstId3v23Mux *mux
+);
+
+static GstStateChangeReturn gst_id3v23_mux_change_state (
+	GstElement     *element,
+	GstStateChange transition
+);
+
+static void gst_id3v23_mux_count_frames (
+	GstTagLibMuxPriv *mux,
+	const GPtrArray  *frames
+);
+
+static void gst_id3v23_mux_padding (
+	GstId3v23Mux *mux,
+	guint        *padding,
+	guint        *align_to
+);
+
+static void gst_id3v23_mux_prepare_tags (
+	GstTagLibMuxPriv *mux,
+	const GstTagList *tags
+);
+
+static const GPtrArray* gst_id3v23_mux_template (
+	GstId3v23Mux *mux
+);
+
+static void gst_id3v23_mux_debug_init (void);
+
+static GstBuffer* gst_id3v23_mux_unsynchronise (
+	GstId3v23Mux *mux,
+	GstBuffer    *buffer,
+	guint        align_to
+);
+
+//
+// Sets up the debug category of the element. The category is used by the
+// renders of gst_id3v23_mux_render_tags() as well, which can be called by a
+// program that never registers the element.
+//
+static void gst_id3v23_mux_debug_init (void) {
+	static volatile gsize initialized = 0;
+
+	if (g_once_init_enter(&initialized)) {
+		GST_DEBUG_CATEGORY_INIT(
+			gst_id3v23_mux_debug,
+			PLUGIN, 
+			0, 
+			"ID3v2.3 tag muxer"
+		);
+		g_once_init_leave(&initialized, 1);
+	}
+}
+
 static void gst_id3v23_mux_base_init (gpointer g_class) {
 	GstElementClass *element_class = GST_ELEMENT_CLASS(g_class);
 	gst_element_class_add_pad_template(
@@ -119,9 +361,9 @@ static void gst_id3v23_mux_base_init (gpointer g_class) {
 	// Old versions of GStreamer are missing gst_element_class_set_details_simple()
 	GstElementDetails details = GST_ELEMENT_DETAILS(
 		// The API wants gchar* but these are static strings (const gchar*).
-		g_strdup("id3lib ID3v2.3 Muxer"),
+		g_strdup("ID3v2.3 Muxer"),
 		g_strdup("Formatter/Metadata"),
-		g_strdup("Adds an ID3v2.3 header to the beginning of MP3 files using id3lib"),
+		g_strdup("Adds an ID3v2.3 header to the beginning of MP3 files"),
 		g_strdup("Emmanuel Rodriguez <emmanuel.rodriguez@gmail.com>")
 	);
 	gst_element_class_set_details(element_class, &details);
@@ -130,26 +372,448 @@ static void gst_id3v23_mux_base_init (gpointer g_class) {
 	g_free(details.description);
 	g_free(details.author);
 
-
-	GST_DEBUG_CATEGORY_INIT(
-		gst_id3v23_mux_debug,
-		PLUGIN, 
-		0, 
-		"id3lib-based ID3v2.3 tag muxer"
-	);
+	gst_id3v23_mux_debug_init();
 }
 
 static void gst_id3v23_mux_class_init (GstId3v23MuxClass *klass) {
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	gobject_class->set_property = gst_id3v23_mux_set_property;
+	gobject_class->get_property = gst_id3v23_mux_get_property;
+	gobject_class->finalize = gst_id3v23_mux_finalize;
+
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	element_class->change_state = GST_DEBUG_FUNCPTR(gst_id3v23_mux_change_state);
+
+#ifdef HAVE_ID3LIB
+	g_object_class_install_property(
+		gobject_class,
+		PROP_ID3LIB,
+		g_param_spec_boolean(
+			"id3lib",
+			"Use id3lib",
+			"Render the tags with id3lib instead of the built-in writer",
+			FALSE,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+#endif
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_ZERO_COPY,
+		g_param_spec_boolean(
+			"zero-copy",
+			"Zero copy",
+			"Push the tag as several buffers that reference the pictures instead of copying them",
+			FALSE,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_PADDING,
+		g_param_spec_uint(
+			"padding",
+			"Padding",
+			"Minimal number of bytes reserved after the frames for future retagging",
+			0,
+			ID3V23_MAX_TAG_SIZE,
+			0,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_ALIGN_TO,
+		g_param_spec_uint(
+			"align-to",
+			"Align to",
+			"Pad the tag to a multiple of this size so that the audio starts on a block boundary (0 to disable)",
+			0,
+			ID3V23_MAX_ALIGN_TO,
+			0,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_TEMPLATE,
+		g_param_spec_boolean(
+			"template",
+			"Album template",
+			"Keep the frames of the previous tag serialized and encode only the frames that changed",
+			FALSE,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_ENCODING,
+		g_param_spec_enum(
+			"encoding",
+			"Encoding",
+			"Encoding of the text frames",
+			GST_TYPE_ID3V23_MUX_ENCODING,
+			GST_ID3V23_MUX_ENCODING_AUTO,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_COMPRESS_FRAMES,
+		g_param_spec_uint(
+			"compress-frames",
+			"Compress frames",
+			"Compress with zlib the frames of at least this size when it saves bytes (0 to disable)",
+			0,
+			ID3V23_MAX_TAG_SIZE,
+			0,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_COMPRESS_LEVEL,
+		g_param_spec_int(
+			"compress-level",
+			"Compression level",
+			"zlib level of the compressed frames (1 is the fastest, 9 the smallest)",
+			1,
+			9,
+			ID3V23_DEFAULT_COMPRESS_LEVEL,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_MAX_THREADS,
+		g_param_spec_uint(
+			"max-threads",
+			"Maximum threads",
+			"Maximum number of threads encoding the frames of a big tag (0: one per CPU, 1: the streaming thread only)",
+			0,
+			G_MAXUINT,
+			1,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
+	g_object_class_install_property(
+		gobject_class,
+		PROP_UNSYNCHRONISE,
+		g_param_spec_enum(
+			"unsynchronise",
+			"Unsynchronise",
+			"Escape the bytes of the tag that look like an MPEG sync, for the old players",
+			GST_TYPE_ID3V23_MUX_UNSYNC,
+			GST_ID3V23_MUX_UNSYNC_OFF,
+			(GParamFlags) G_PARAM_READWRITE
+		)
+	);
+
 	GST_TAG_LIB_MUX_CLASS(klass)->render_tag = GST_DEBUG_FUNCPTR(gst_id3v23_mux_render_tag);
+	GST_TAG_LIB_MUX_CLASS(klass)->render_tag_list = GST_DEBUG_FUNCPTR(gst_id3v23_mux_render_tag_list);
+	GST_TAG_LIB_MUX_CLASS(klass)->prepare_tags = GST_DEBUG_FUNCPTR(gst_id3v23_mux_prepare_tags);
 }
 
 static void gst_id3v23_mux_init (GstId3v23Mux *id3v23mux, GstId3v23MuxClass *id3v23mux_class) {
-	// nothing to do
+	id3v23mux->use_id3lib = FALSE;
+	id3v23mux->zero_copy = FALSE;
+	id3v23mux->padding = 0;
+	id3v23mux->align_to = 0;
+	id3v23mux->use_template = FALSE;
+	id3v23mux->template_frames = g_ptr_array_new();
+	id3v23mux->prepared_frames = g_ptr_array_new();
+	id3v23_arena_init(&id3v23mux->arena);
+	id3v23mux->compress_frames = 0;
+	id3v23mux->compress_level = ID3V23_DEFAULT_COMPRESS_LEVEL;
+	id3v23mux->max_threads = 1;
+	id3v23mux->encoding = GST_ID3V23_MUX_ENCODING_AUTO;
+	id3v23mux->unsynchronise = GST_ID3V23_MUX_UNSYNC_OFF;
+}
+
+GType gst_id3v23_mux_encoding_get_type (void) {
+	static volatile gsize type = 0;
+	static const GEnumValue values [] = {
+		{GST_ID3V23_MUX_ENCODING_AUTO, "ISO-8859-1 when possible, UTF-16 otherwise", "auto"},
+		{GST_ID3V23_MUX_ENCODING_ISO_8859_1, "ISO-8859-1, other characters are replaced by '?'", "iso-8859-1"},
+		{GST_ID3V23_MUX_ENCODING_UTF16, "UTF-16", "utf-16"},
+		{0, NULL, NULL}
+	};
+
+	if (g_once_init_enter(&type)) {
+		g_once_init_leave(&type, g_enum_register_static("GstId3v23MuxEncoding", values));
+	}
+	return type;
+}
+
+GType gst_id3v23_mux_unsync_get_type (void) {
+	static volatile gsize type = 0;
+	static const GEnumValue values [] = {
+		{GST_ID3V23_MUX_UNSYNC_OFF, "Never", "off"},
+		{GST_ID3V23_MUX_UNSYNC_AUTO, "Only when the tag has a false sync", "auto"},
+		{GST_ID3V23_MUX_UNSYNC_ALWAYS, "Always", "always"},
+		{0, NULL, NULL}
+	};
+
+	if (g_once_init_enter(&type)) {
+		g_once_init_leave(&type, g_enum_register_static("GstId3v23MuxUnsync", values));
+	}
+	return type;
+}
+
+static void gst_id3v23_mux_set_property (
+	GObject      *object,
+	guint        prop_id,
+	const GValue *value,
+	GParamSpec   *pspec
+) {
+	GstId3v23Mux *mux = GST_ID3V23_MUX(object);
+
+	switch (prop_id) {
+		case PROP_ID3LIB:
+			mux->use_id3lib = g_value_get_boolean(value);
+		break;
+
+		case PROP_ZERO_COPY:
+			mux->zero_copy = g_value_get_boolean(value);
+		break;
+
+		case PROP_PADDING:
+			mux->padding = g_value_get_uint(value);
+		break;
+
+		case PROP_ALIGN_TO:
+			mux->align_to = g_value_get_uint(value);
+		break;
+
+		case PROP_TEMPLATE:
+			mux->use_template = g_value_get_boolean(value);
+		break;
+
+		case PROP_ENCODING:
+			mux->encoding = (GstId3v23MuxEncoding) g_value_get_enum(value);
+		break;
+
+		case PROP_COMPRESS_FRAMES:
+			mux->compress_frames = g_value_get_uint(value);
+		break;
+
+		case PROP_COMPRESS_LEVEL:
+			mux->compress_level = g_value_get_int(value);
+		break;
+
+		case PROP_MAX_THREADS:
+			mux->max_threads = g_value_get_uint(value);
+		break;
+
+		case PROP_UNSYNCHRONISE:
+			mux->unsynchronise = (GstId3v23MuxUnsync) g_value_get_enum(value);
+		break;
+
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void gst_id3v23_mux_get_property (
+	GObject    *object,
+	guint      prop_id,
+	GValue     *value,
+	GParamSpec *pspec
+) {
+	GstId3v23Mux *mux = GST_ID3V23_MUX(object);
+
+	switch (prop_id) {
+		case PROP_ID3LIB:
+			g_value_set_boolean(value, mux->use_id3lib);
+		break;
+
+		case PROP_ZERO_COPY:
+			g_value_set_boolean(value, mux->zero_copy);
+		break;
+
+		case PROP_PADDING:
+			g_value_set_uint(value, mux->padding);
+		break;
+
+		case PROP_ALIGN_TO:
+			g_value_set_uint(value, mux->align_to);
+		break;
+
+		case PROP_TEMPLATE:
+			g_value_set_boolean(value, mux->use_template);
+		break;
+
+		case PROP_ENCODING:
+			g_value_set_enum(value, mux->encoding);
+		break;
+
+		case PROP_COMPRESS_FRAMES:
+			g_value_set_uint(value, mux->compress_frames);
+		break;
+
+		case PROP_COMPRESS_LEVEL:
+			g_value_set_int(value, mux->compress_level);
+		break;
+
+		case PROP_MAX_THREADS:
+			g_value_set_uint(value, mux->max_threads);
+		break;
+
+		case PROP_UNSYNCHRONISE:
+			g_value_set_enum(value, mux->unsynchronise);
+		break;
+
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
 }
 
 
 
 
+// 
+// The kinds of frames, they tell how a frame is built from its tags and how
+// its body is laid out.
+// 
+typedef enum {
+	ID3V23_FRAME_TEXT,       // T*** frames: a text
+	ID3V23_FRAME_NUMBER,     // TRCK, TPOS: a number ("01/12") made of a number
+	ID3V23_FRAME_COUNT,      // and of a count, the count follows its number
+	ID3V23_FRAME_DATE,       // TYER and TDAT
+	ID3V23_FRAME_LENGTH,     // TLEN: a duration in milliseconds
+	ID3V23_FRAME_COMMENT,    // COMM: a language, a description and a text
+	ID3V23_FRAME_USER_TEXT,  // TXXX: a description and a text
+	ID3V23_FRAME_UFID,       // UFID: an owner and an identifier (no encoding)
+	ID3V23_FRAME_PICTURE     // APIC: a picture and its description
+} Id3v23FrameKind;
+
+
+// 
+// What's written when a tag has more than one value.
+// 
+typedef enum {
+	ID3V23_VALUES_FIRST,  // The first value only
+	ID3V23_VALUES_JOIN    // All the values separated by '/' (ID3v2.3 convention)
+} Id3v23Values;
+
+
+// 
+// The mapping of a GstTag to an ID3v2.3 frame.
+// 
+typedef struct _Id3v23Mapping Id3v23Mapping;
+struct _Id3v23Mapping {
+	const gchar     *tag;           // The GstTag
+	const gchar     *id;            // The frame ID
+	Id3v23FrameKind  kind;          // How the frame is built
+	Id3v23Values     values;        // What's written when there are many values
+	const gchar     *description;   // TXXX: the description, UFID: the owner
+	guint8           picture_type;  // APIC: the type of picture
+};
+
+
+// 
+// The tags written by the element, in the order in which their frames are
+// written. The tags that aren't in the table are dropped.
+// 
+static const Id3v23Mapping tags_mapping [] = {
+	{GST_TAG_TITLE,                     "TIT2", ID3V23_FRAME_TEXT,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_ARTIST,                    "TPE1", ID3V23_FRAME_TEXT,      ID3V23_VALUES_JOIN,  NULL, 0},
+	{GST_TAG_ALBUM_ARTIST,              "TPE2", ID3V23_FRAME_TEXT,      ID3V23_VALUES_JOIN,  NULL, 0},
+	{GST_TAG_ALBUM,                     "TALB", ID3V23_FRAME_TEXT,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_ALBUM_VOLUME_NUMBER,       "TPOS", ID3V23_FRAME_NUMBER,    ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_ALBUM_VOLUME_COUNT,        "TPOS", ID3V23_FRAME_COUNT,     ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_TRACK_NUMBER,              "TRCK", ID3V23_FRAME_NUMBER,    ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_TRACK_COUNT,               "TRCK", ID3V23_FRAME_COUNT,     ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_GENRE,                     "TCON", ID3V23_FRAME_TEXT,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_DATE,                      "TYER", ID3V23_FRAME_DATE,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_COMPOSER,                  "TCOM", ID3V23_FRAME_TEXT,      ID3V23_VALUES_JOIN,  NULL, 0},
+	{GST_TAG_COPYRIGHT,                 "TCOP", ID3V23_FRAME_TEXT,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_ORGANIZATION,              "TPUB", ID3V23_FRAME_TEXT,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_ENCODER,                   "TSSE", ID3V23_FRAME_TEXT,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_BEATS_PER_MINUTE,          "TBPM", ID3V23_FRAME_TEXT,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_ISRC,                      "TSRC", ID3V23_FRAME_TEXT,      ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_DURATION,                  "TLEN", ID3V23_FRAME_LENGTH,    ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_COMMENT,                   "COMM", ID3V23_FRAME_COMMENT,   ID3V23_VALUES_FIRST, NULL, 0},
+	{GST_TAG_MUSICBRAINZ_TRACKID,       "UFID", ID3V23_FRAME_UFID,      ID3V23_VALUES_FIRST, "http://musicbrainz.org", 0},
+	{GST_TAG_MUSICBRAINZ_ARTISTID,      "TXXX", ID3V23_FRAME_USER_TEXT, ID3V23_VALUES_FIRST, "MusicBrainz Artist Id", 0},
+	{GST_TAG_MUSICBRAINZ_ALBUMID,       "TXXX", ID3V23_FRAME_USER_TEXT, ID3V23_VALUES_FIRST, "MusicBrainz Album Id", 0},
+	{GST_TAG_MUSICBRAINZ_ALBUMARTISTID, "TXXX", ID3V23_FRAME_USER_TEXT, ID3V23_VALUES_FIRST, "MusicBrainz Album Artist Id", 0},
+	{GST_TAG_MUSICBRAINZ_TRMID,         "TXXX", ID3V23_FRAME_USER_TEXT, ID3V23_VALUES_FIRST, "MusicBrainz TRM Id", 0},
+	{GST_TAG_IMAGE,                     "APIC", ID3V23_FRAME_PICTURE,   ID3V23_VALUES_FIRST, NULL, ID3V23_PICTURE_OTHER},
+	{GST_TAG_PREVIEW_IMAGE,             "APIC", ID3V23_FRAME_PICTURE,   ID3V23_VALUES_FIRST, NULL, ID3V23_PICTURE_PNG32ICON},
+};
+
+
+// 
+// The values of the mapped tags found in a tag list, indexed as the mapping.
+// 
+typedef struct _Id3v23TagValues Id3v23TagValues;
+struct _Id3v23TagValues {
+	const GValue *values[G_N_ELEMENTS(tags_mapping)];
+};
+
+
+// 
+// A frame ready to be serialized. The frame keeps the values in their
+// original form (UTF-8 strings and image buffers) and knows the exact size
+// that its body will take once encoded, this way the size of the whole tag
+// can be computed before a single byte is written.
+// 
+typedef struct _Id3v23Frame Id3v23Frame;
+struct _Id3v23Frame {
+	gchar            id[5];          // The frame ID (ex: "TIT2")
+	Id3v23FrameKind  kind;           // How the body is laid out
+	guint8           encoding;       // The text encoding used by the frame
+	gchar           *text;           // The text (UTF-8) or the picture's description
+	gchar           *description;    // COMM, TXXX: the description, UFID: the owner
+	const gchar     *language;       // COMM: the language
+	const gchar     *mime_type;      // APIC: the MIME type of the picture
+	guint8           picture_type;   // APIC: the type of picture
+	GstBuffer       *image;          // APIC: the picture's data
+	GstBuffer       *rendered;       // The whole frame, shared with the template
+	GstBuffer       *compressed;     // The whole frame compressed, written instead of the frame
+	gsize            size;           // The size of the frame's body once encoded
+};
+
+
+// 
+// How the frames are encoded once built from the tags.
+// 
+typedef struct _Id3v23EncodeOptions Id3v23EncodeOptions;
+struct _Id3v23EncodeOptions {
+	gboolean  render;           // Serialize all the frames (they are kept for the next tag)
+	guint     compress_frames;  // Compress the frames of at least this size (0 disables)
+	gint      compress_level;   // The zlib level of the compressed frames
+	guint     max_threads;      // The threads encoding the frames (0: one per CPU)
+	gboolean  zero_copy;        // Leave the pictures in their buffers (not serialized)
+};
+
+
+// 
+// The frames of a tag encoded by several threads. Each thread takes the
+// next frame that isn't encoded until all the frames are taken.
+// 
+typedef struct _Id3v23EncodeBatch Id3v23EncodeBatch;
+struct _Id3v23EncodeBatch {
+	GPtrArray                 *frames;
+	const Id3v23EncodeOptions *options;
+	volatile gint             next;     // The next frame to encode
+	guint                     helpers;  // The threads of the pool that are not done
+	GMutex                    *lock;
+	GCond                     *cond;    // Signaled when a thread of the pool is done
+};
+
 
 // Custom methods and functions
 static void tags_print_loop (
@@ -158,177 +822,1820 @@ static void tags_print_loop (
 	const gpointer   user_data
 );
 
-static ID3_Frame* tags_tag_to_frame (
-	const GstTagList  *tags,
-	const gchar       *tag,
-	const ID3_FrameID id
+static guint tags_mapping_lookup (
+	GQuark tag
+);
+
+static gboolean tags_values_loop (
+	GQuark       tag,
+	const GValue *value,
+	gpointer     user_data
+);
+
+static Id3v23Frame* tags_value_to_frame (
+	const Id3v23Mapping *mapping,
+	const GValue        *value,
+	Id3v23Arena         *arena
 );
 
-static ID3_Frame* tags_text_to_frame (
+static Id3v23Frame* tags_text_to_frame (
 	const gchar       *value,
-	const ID3_FrameID id
+	const gchar       *id,
+	Id3v23Arena       *arena
 );
 
-static ID3_Frame* tags_composed_tags_to_frame (
-	const GstTagList  *tags,
-	const gchar       *left,
-	const gchar       *right,
-	const ID3_FrameID id
+static Id3v23Frame* tags_composed_tags_to_frame (
+	const GValue      *left,
+	const GValue      *right,
+	const gchar       *id,
+	Id3v23Arena       *arena
 );
 
-static ID3_Frame* tags_image_tag_to_frame (
-	const GstTagList  *tags,
-	const gchar       *tag,
-	const ID3_FrameID id
+static void tags_date_to_frames (
+	const GValue *value,
+	GPtrArray    *frames,
+	Id3v23Arena  *arena
 );
 
-static gchar* tags_tag_to_string (
-	const GstTagList *tags, 
-	const gchar      *tag
+static Id3v23Frame* tags_length_to_frame (
+	const GValue *value,
+	Id3v23Arena  *arena
+);
+
+static Id3v23Frame* tags_image_to_frame (
+	const Id3v23Mapping *mapping,
+	const GValue        *value,
+	Id3v23Arena         *arena
+);
+
+static Id3v23Frame* tags_frame_new (
+	const gchar     *id,
+	Id3v23FrameKind kind,
+	Id3v23Arena     *arena
 );
 
-static GDate* tags_tag_to_date(
+static const GValue* tags_value_first (
+	const Id3v23Mapping *mapping,
+	const GValue        *value
+);
+
+static gchar* tags_values_join (
+	const GValue *value,
+	Id3v23Arena  *arena
+);
+
+static const gchar* tags_tag_to_string (
 	const GstTagList *tags, 
-	const gchar      *tag
+	const gchar      *tag,
+	gchar            *number
 );
 
-static void tags_set_frame_field_to_unicode (
-	const ID3_Frame   *frame,
-	const ID3_FieldID field_id,
-	const gchar       *value
+static const gchar* tags_utils_value_to_string (
+	const GValue *value,
+	gchar        *number
 );
 
-static size_t tags_utils_number_length (
-	const guint i
+static void tags_frame_free (
+	gpointer frame,
+	gpointer user_data
 );
 
-static unicode_t* tags_utils_utf8_to_utf16 (
-	const gchar *text
+static GPtrArray* tags_frames_new (
+	const GstTagList     *tags,
+	const GPtrArray      *template_frames,
+	GstId3v23MuxEncoding encoding,
+	Id3v23Arena          *arena
 );
 
-static gboolean tags_buffer_has_data (
-	const GstBuffer *buffer
+static void tags_frame_set_encoding (
+	Id3v23Frame          *frame,
+	GstId3v23MuxEncoding encoding
 );
 
+static GstBuffer* tags_frames_render (
+	const GPtrArray *frames,
+	const guint     padding,
+	const guint     align_to
+);
+
+static GstBufferList* tags_frames_render_list (
+	const GPtrArray *frames,
+	const guint     padding,
+	const guint     align_to,
+	GstCaps         *caps
+);
+
+static gsize tags_frames_size (
+	const GPtrArray *frames
+);
+
+static void tags_buffer_list_add (
+	GstBufferListIterator *it,
+	GstBuffer             *buffer,
+	GstCaps               *caps
+);
+
+static guint8* tags_frame_write (
+	const Id3v23Frame *frame,
+	guint8            *data
+);
+
+static guint8* tags_frame_write_head (
+	const Id3v23Frame *frame,
+	guint8            *data
+);
+
+static void tags_frame_field (
+	const Id3v23Frame *frame,
+	Id3v23Field       *field
+);
+
+static GstBuffer* tags_frame_render (
+	const Id3v23Frame *frame
+);
+
+static GstBuffer* tags_frame_stored (
+	const Id3v23Frame *frame
+);
+
+static void tags_frames_encode (
+	GPtrArray                 *frames,
+	const Id3v23EncodeOptions *options
+);
+
+static guint tags_frames_threads (
+	const GPtrArray           *frames,
+	const Id3v23EncodeOptions *options
+);
+
+static void tags_frame_encode (
+	Id3v23Frame               *frame,
+	const Id3v23EncodeOptions *options
+);
+
+static gboolean tags_frame_compressible (
+	const Id3v23Frame         *frame,
+	const Id3v23EncodeOptions *options
+);
+
+static void tags_encode_batch_run (
+	Id3v23EncodeBatch *batch
+);
+
+static void tags_encode_worker (
+	gpointer data,
+	gpointer user_data
+);
+
+static GThreadPool* tags_encode_pool (void);
+
+static void gst_id3v23_mux_encode_options (
+	GstId3v23Mux        *mux,
+	Id3v23EncodeOptions *options,
+	gboolean            render
+);
 
+static void tags_frame_compress (
+	Id3v23Frame *frame,
+	const gint  level
+);
+
+static void tags_template_frame (
+	Id3v23Frame     *frame,
+	const GPtrArray *template_frames
+);
+
+#ifdef HAVE_ID3LIB
+static GstBuffer* tags_frames_render_id3lib (
+	const GPtrArray *frames,
+	const guint     padding,
+	const guint     align_to,
+	Id3v23Arena     *arena
+);
+
+static ID3_Frame* tags_frame_to_id3lib (
+	const Id3v23Frame *frame,
+	Id3v23Arena       *arena
+);
+
+static void tags_id3lib_set_text (
+	ID3_Frame    *id3_frame,
+	ID3_FieldID  id,
+	const gchar  *text,
+	const guint8 encoding,
+	Id3v23Arena  *arena
+);
+
+static unicode_t* tags_utils_utf8_to_utf16 (
+	const gchar *text,
+	Id3v23Arena *arena
+);
+
+static gchar* tags_utils_utf8_to_latin1 (
+	const gchar *text,
+	Id3v23Arena *arena
+);
+#endif
+
+static guint tags_utils_number_length (
+	const guint i
+);
+
+static gchar* tags_utils_strdup (
+	const gchar *text,
+	Id3v23Arena *arena
+);
+
+static guint tags_utils_cpus (void);
+
+static gboolean tags_utils_same_data (
+	const GstBuffer *a,
+	const GstBuffer *b
+);
+
+static gboolean tags_buffer_has_data (
+	const GstBuffer *buffer
+);
+
+
+
+
+
+
+
+
+
+
+// ------------------
+//  Instance methods
+// ------------------
+
+
+//
+// Prints a tag from the given tag list.
+//
+// This function is meant to be used by gst_tag_list_foreach().
+//
+static void tags_print_loop (
+	const GstTagList *tags, 
+	const gchar      *tag, 
+	gpointer         user_data
+) {
+	
+	gchar number[ID3V23_NUMBER_SIZE];
+	const gchar *value = tags_tag_to_string(tags, tag, number);
+	GST_LOG("Tag %s = %s", tag, value != NULL ? value : "(not a string)");
+	
+	return;
+}
+
+
+//
+// This function writes the gstreamer tags that have been collected so far.
+//
+static GstBuffer* gst_id3v23_mux_render_tag (
+	GstTagLibMuxPriv * mux, 
+	GstTagList *tags
+) {
+	
+	GstId3v23Mux *id3v23mux = GST_ID3V23_MUX(mux);
+	guint padding, align_to;
+	gst_id3v23_mux_padding(id3v23mux, &padding, &align_to);
+
+	// Write the tag's binary data into a gstreamer buffer
+	GstBuffer *buffer;
+#ifdef HAVE_ID3LIB
+	if (id3v23mux->use_id3lib) {
+		Id3v23Arena *arena = &id3v23mux->arena;
+		GPtrArray *frames = tags_frames_new(tags, NULL, id3v23mux->encoding, arena);
+		gst_id3v23_mux_count_frames(mux, frames);
+		buffer = tags_frames_render_id3lib(frames, padding, align_to, arena);
+		g_ptr_array_foreach(frames, tags_frame_free, arena);
+		g_ptr_array_free(frames, TRUE);
+		id3v23_arena_reset(arena);
+	}
+	else
+#endif
+	{
+		Id3v23Arena *arena = gst_id3v23_mux_arena(id3v23mux);
+		GPtrArray *frames = tags_frames_new(
+			tags,
+			gst_id3v23_mux_template(id3v23mux),
+			id3v23mux->encoding,
+			arena
+		);
+		Id3v23EncodeOptions options;
+		gst_id3v23_mux_encode_options(id3v23mux, &options, id3v23mux->use_template);
+		tags_frames_encode(frames, &options);
+		gst_id3v23_mux_count_frames(mux, frames);
+		buffer = tags_frames_render(frames, padding, align_to);
+		gst_id3v23_mux_keep_frames(id3v23mux, frames, arena);
+	}
+
+	if (buffer != NULL) {
+		buffer = gst_id3v23_mux_unsynchronise(id3v23mux, buffer, align_to);
+		gst_buffer_set_caps(buffer, GST_PAD_CAPS(mux->srcpad));
+	}
+
+	return buffer;
+}
+
+
+//
+// Writes the gstreamer tags that have been collected so far as a sequence of
+// buffers. When the property "zero-copy" is set the pictures are not copied
+// into the tag, instead each APIC frame is made of a small buffer holding its
+// header followed by a sub-buffer of the original image.
+//
+// Otherwise the list holds a single buffer as rendered by
+// gst_id3v23_mux_render_tag(). An unsynchronised tag is always a single
+// buffer since the pictures are escaped with the rest of the tag.
+//
+static GstBufferList* gst_id3v23_mux_render_tag_list (
+	GstTagLibMuxPriv * mux,
+	GstTagList *tags
+) {
+
+	GstId3v23Mux *id3v23mux = GST_ID3V23_MUX(mux);
+	if (
+		! id3v23mux->zero_copy ||
+		id3v23mux->use_id3lib ||
+		id3v23mux->unsynchronise != GST_ID3V23_MUX_UNSYNC_OFF
+	) {
+		GstBuffer *buffer = gst_id3v23_mux_render_tag(mux, tags);
+		if (buffer == NULL) {return NULL;}
+
+		GstBufferList *list = gst_buffer_list_new();
+		GstBufferListIterator *it = gst_buffer_list_iterate(list);
+		gst_buffer_list_iterator_add_group(it);
+		gst_buffer_list_iterator_add(it, buffer);
+		gst_buffer_list_iterator_free(it);
+		return list;
+	}
+
+	Id3v23Arena *arena = gst_id3v23_mux_arena(id3v23mux);
+	GPtrArray *frames = tags_frames_new(
+		tags,
+		gst_id3v23_mux_template(id3v23mux),
+		id3v23mux->encoding,
+		arena
+	);
+	Id3v23EncodeOptions options;
+	gst_id3v23_mux_encode_options(id3v23mux, &options, id3v23mux->use_template);
+	tags_frames_encode(frames, &options);
+	gst_id3v23_mux_count_frames(mux, frames);
+	guint padding, align_to;
+	gst_id3v23_mux_padding(id3v23mux, &padding, &align_to);
+	GstBufferList *list = tags_frames_render_list(
+		frames,
+		padding,
+		align_to,
+		GST_PAD_CAPS(mux->srcpad)
+	);
+	gst_id3v23_mux_keep_frames(id3v23mux, frames, arena);
+
+	return list;
+}
+
+
+//
+// Returns the padding to apply to the tag. When the base class reserved the
+// space of the tag (late-tags mode) the tag is aligned on the reserved size,
+// this pads it to exactly that size as long as the frames fit in it.
+//
+// Parameters:
+//   mux:      the element.
+//   padding:  set to the minimal number of padding bytes.
+//   align_to: set to the size that the tag has to be a multiple of.
+//
+static void gst_id3v23_mux_padding (
+	GstId3v23Mux *mux,
+	guint        *padding,
+	guint        *align_to
+) {
+
+	gsize reserve = GST_TAG_LIB_MUX(mux)->tag_reserve;
+	if (reserve != 0) {
+		*padding = 0;
+		*align_to = (guint) reserve;
+	}
+	else {
+		*padding = mux->padding;
+		*align_to = mux->align_to;
+	}
+}
+
+
+//
+// Encodes the tags known so far while the stream hasn't started. Each time the
+// tags change the frames are built again against the frames prepared before:
+// the frames whose tags didn't change are matched and keep their bytes, only
+// the dirty frames are serialized again. When the tag is finally rendered the
+// prepared frames serve as its template and the tag is assembled from bytes
+// that are ready.
+//
+static void gst_id3v23_mux_prepare_tags (
+	GstTagLibMuxPriv *mux,
+	const GstTagList *tags
+) {
+
+	GstId3v23Mux *id3v23mux = GST_ID3V23_MUX(mux);
+	if (id3v23mux->use_id3lib) {return;}
+
+	const GPtrArray *template_frames = id3v23mux->prepared_frames->len > 0
+		? id3v23mux->prepared_frames
+		: id3v23mux->template_frames
+	;
+	GPtrArray *frames = tags_frames_new(tags, template_frames, id3v23mux->encoding, NULL);
+	Id3v23EncodeOptions options;
+	gst_id3v23_mux_encode_options(id3v23mux, &options, TRUE);
+	tags_frames_encode(frames, &options);
+
+	g_ptr_array_foreach(id3v23mux->prepared_frames, tags_frame_free, NULL);
+	g_ptr_array_set_size(id3v23mux->prepared_frames, 0);
+	for (guint i = 0; i < frames->len; ++i) {
+		g_ptr_array_add(id3v23mux->prepared_frames, g_ptr_array_index(frames, i));
+	}
+	g_ptr_array_free(frames, TRUE);
+
+	GST_DEBUG_OBJECT(mux, "prepared %u frames", id3v23mux->prepared_frames->len);
+}
+
+
+//
+// Returns the frames whose bytes can be reused by the tag about to be
+// rendered: the frames prepared ahead of time, otherwise the frames of the
+// previous tag when the property "template" is set. NULL when there are none.
+//
+static const GPtrArray* gst_id3v23_mux_template (
+	GstId3v23Mux *mux
+) {
+
+	if (mux->prepared_frames->len > 0) {
+		return mux->prepared_frames;
+	}
+	return mux->use_template ? mux->template_frames : NULL;
+}
+
+
+//
+// Unsynchronises a rendered tag as requested by the property
+// "unsynchronise". The 0x00 inserted take the place of the padding, when
+// the padding is too small the tag grows and is aligned again.
+//
+// Parameters:
+//   mux:      the element.
+//   buffer:   the tag, the function takes ownership of the buffer.
+//   align_to: the size that the tag has to be a multiple of.
+//
+// Returns:
+//   The tag, either the buffer given or a bigger one.
+//
+static GstBuffer* gst_id3v23_mux_unsynchronise (
+	GstId3v23Mux *mux,
+	GstBuffer    *buffer,
+	guint        align_to
+) {
+
+	if (mux->unsynchronise == GST_ID3V23_MUX_UNSYNC_OFF) {return buffer;}
+
+	// The modes are in the same order as the library's
+	Id3v23RenderUnsync mode = (Id3v23RenderUnsync) mux->unsynchronise;
+	guint size = GST_BUFFER_SIZE(buffer);
+	gsize written;
+	Id3v23RenderStatus status = id3v23_render_unsynchronise(GST_BUFFER_DATA(buffer), size, size, mode, &written);
+
+	if (status == ID3V23_RENDER_SHORT_BUFFER) {
+		gsize aligned = written + id3v23_render_padding_size(written, 0, align_to);
+		GST_DEBUG("The padding can't absorb the unsynchronisation, the tag grows to %" G_GSIZE_FORMAT " bytes", aligned);
+
+		GstBuffer *grown = gst_buffer_new_and_alloc(aligned);
+		guint8 *data = GST_BUFFER_DATA(grown);
+		memcpy(data, GST_BUFFER_DATA(buffer), size);
+		gst_buffer_unref(buffer);
+		buffer = grown;
+
+		status = id3v23_render_unsynchronise(data, size, aligned, mode, &written);
+		if (status == ID3V23_RENDER_OK && written < aligned) {
+			memset(data + written, 0, aligned - written);
+			id3v23_render_write_syncsafe(aligned - ID3V23_HEADER_SIZE, data + 6);
+		}
+	}
+
+	if (status != ID3V23_RENDER_OK) {
+		GST_WARNING("The tag can't be unsynchronised: %s", id3v23_render_status_message(status));
+	}
+	else if (GST_BUFFER_DATA(buffer)[5] & ID3V23_FLAG_UNSYNCHRONISATION) {
+		GST_LOG("Unsynchronised the tag of %u bytes", GST_BUFFER_SIZE(buffer));
+	}
+
+	return buffer;
+}
+
+
+//
+// Releases the frames and the scratch memory kept by the element.
+//
+static void gst_id3v23_mux_finalize (
+	GObject *object
+) {
+
+	GstId3v23Mux *mux = GST_ID3V23_MUX(object);
+
+	g_ptr_array_foreach(mux->template_frames, tags_frame_free, NULL);
+	g_ptr_array_free(mux->template_frames, TRUE);
+	g_ptr_array_foreach(mux->prepared_frames, tags_frame_free, NULL);
+	g_ptr_array_free(mux->prepared_frames, TRUE);
+	id3v23_arena_clear(&mux->arena);
+
+	G_OBJECT_CLASS(parent_class)->finalize(object);
+}
+
+
+//
+// Updates the statistics of the element with the frames of the tag.
+//
+static void gst_id3v23_mux_count_frames (
+	GstTagLibMuxPriv *mux,
+	const GPtrArray  *frames
+) {
+
+	mux->stats.frames = frames->len;
+	mux->stats.image_bytes = 0;
+	for (guint i = 0; i < frames->len; ++i) {
+		const Id3v23Frame *frame = (const Id3v23Frame *) g_ptr_array_index(frames, i);
+		if (frame->image != NULL) {
+			mux->stats.image_bytes += GST_BUFFER_SIZE(frame->image);
+		}
+	}
+}
+
+
+//
+// Releases the frames of a tag once rendered along with the frames prepared
+// for it. When the property "template" is set the frames become the template
+// of the next tag, replacing the previous template. Otherwise the frames are
+// released along with the scratch memory of the render.
+//
+static void gst_id3v23_mux_keep_frames (
+	GstId3v23Mux *mux,
+	GPtrArray    *frames,
+	Id3v23Arena  *arena
+) {
+
+	g_ptr_array_foreach(mux->prepared_frames, tags_frame_free, NULL);
+	g_ptr_array_set_size(mux->prepared_frames, 0);
+	g_ptr_array_foreach(mux->template_frames, tags_frame_free, NULL);
+	g_ptr_array_set_size(mux->template_frames, 0);
+
+	if (mux->use_template) {
+		for (guint i = 0; i < frames->len; ++i) {
+			g_ptr_array_add(mux->template_frames, g_ptr_array_index(frames, i));
+		}
+	}
+	else {
+		g_ptr_array_foreach(frames, tags_frame_free, arena);
+	}
+	g_ptr_array_free(frames, TRUE);
+
+	if (arena != NULL) {
+		id3v23_arena_reset(arena);
+	}
+}
+
+
+//
+// Fills the options used to encode the frames from the properties.
+//
+// Parameters:
+//   mux:     the element.
+//   options: the options to fill.
+//   render:  TRUE if the frames are kept serialized for the next tag.
+//
+static void gst_id3v23_mux_encode_options (
+	GstId3v23Mux        *mux,
+	Id3v23EncodeOptions *options,
+	gboolean            render
+) {
+
+	options->render = render;
+	options->compress_frames = mux->compress_frames;
+	options->compress_level = mux->compress_level;
+	options->max_threads = mux->max_threads;
+
+	// The same conditions as gst_id3v23_mux_render_tag_list() for the list of
+	// buffers that references the pictures
+	options->zero_copy = mux->zero_copy
+		&& ! mux->use_id3lib
+		&& mux->unsynchronise == GST_ID3V23_MUX_UNSYNC_OFF
+	;
+}
+
+
+//
+// Returns the scratch memory of the renders or NULL when the frames outlive
+// the render (property "template").
+//
+static Id3v23Arena* gst_id3v23_mux_arena (
+	GstId3v23Mux *mux
+) {
+
+	return mux->use_template ? NULL : &mux->arena;
+}
+
+
+//
+// Releases the scratch memory of the renders once the element stops.
+//
+static GstStateChangeReturn gst_id3v23_mux_change_state (
+	GstElement     *element,
+	GstStateChange transition
+) {
+
+	GstStateChangeReturn result = GST_ELEMENT_CLASS(parent_class)->change_state(element, transition);
+
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+		id3v23_arena_clear(&GST_ID3V23_MUX(element)->arena);
+	}
+
+	return result;
+}
+
+
+//
+// Renders the given tags as an ID3v2.3 tag with the built-in writer. This is
+// the entry point used by the tools that write tags without a pipeline.
+//
+// Parameters:
+//   tags:     the tags to write.
+//   padding:  the minimal number of padding bytes to add after the frames.
+//   align_to: if greater than 1, the tag is padded to a multiple of this size.
+//
+// Returns:
+//   A new buffer holding the tag or NULL if the tag is too big.
+//
+GstBuffer* gst_id3v23_mux_render_tags (
+	const GstTagList *tags,
+	guint            padding,
+	guint            align_to
+) {
+
+	gst_id3v23_mux_debug_init();
+
+	GPtrArray *frames = tags_frames_new(tags, NULL, GST_ID3V23_MUX_ENCODING_AUTO, NULL);
+	Id3v23EncodeOptions options = {FALSE, 0, ID3V23_DEFAULT_COMPRESS_LEVEL, 1, FALSE};
+	tags_frames_encode(frames, &options);
+	GstBuffer *buffer = tags_frames_render(frames, padding, align_to);
+
+	g_ptr_array_foreach(frames, tags_frame_free, NULL);
+	g_ptr_array_free(frames, TRUE);
+
+	return buffer;
+}
+
+
+//
+// Tells if the element writes frames of the given ID. The tools that render
+// a tag parsed from a file use it to find the frames that would be lost.
+//
+// Parameters:
+//   id:          the frame ID (ex: "TIT2").
+//   description: TXXX: the description, UFID: the owner, NULL for any.
+//
+// Returns:
+//   TRUE if the element writes such frames from the tags.
+//
+gboolean gst_id3v23_mux_writes_frame (
+	const gchar *id,
+	const gchar *description
+) {
+
+	// TDAT comes with TYER, it isn't in the mapping
+	if (strcmp(id, "TDAT") == 0) {return TRUE;}
+
+	for (guint i = 0; i < G_N_ELEMENTS(tags_mapping); ++i) {
+		const Id3v23Mapping *mapping = &tags_mapping[i];
+		if (strcmp(mapping->id, id) != 0) {continue;}
+
+		if (
+			description == NULL ||
+			mapping->description == NULL ||
+			strcmp(mapping->description, description) == 0
+		) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+
+//
+// Converts the gstreamer tags into ID3v2.3 frames.
+//
+// Parameters:
+//   tags:            the tags collected so far.
+//   template_frames: the frames of the previous tag, the frames that didn't
+//                    change are reused as they are.
+//   encoding:        the encoding of the texts.
+//   arena:           where to allocate the frames, NULL for the heap.
+//
+// Returns:
+//   The frames in the order in which they have to be written, they still
+//   have to be encoded with tags_frames_encode(). The frames must be
+//   released with tags_frame_free() and the array with g_ptr_array_free().
+//
+static GPtrArray* tags_frames_new (
+	const GstTagList     *tags,
+	const GPtrArray      *template_frames,
+	GstId3v23MuxEncoding encoding,
+	Id3v23Arena          *arena
+) {
+
+	// Print the tags (DEBUG), the values are formatted only when they are logged
+	if (gst_debug_category_get_threshold(GST_CAT_DEFAULT) >= GST_LEVEL_LOG) {
+		gst_tag_list_foreach(tags, tags_print_loop, NULL);
+	}
+	
+	// Collect the values of the mapped tags in a single pass. A tag list is a
+	// structure whose fields are the tags, walking the fields avoids looking
+	// up each tag of the mapping by its name.
+	Id3v23TagValues found;
+	memset(&found, 0, sizeof(found));
+	gst_structure_foreach((const GstStructure *) tags, tags_values_loop, &found);
+
+	// Build the frames in the order of the mapping
+	GPtrArray *frames = g_ptr_array_sized_new(G_N_ELEMENTS(tags_mapping));
+	const Id3v23Frame *image = NULL;
+	for (guint i = 0; i < G_N_ELEMENTS(tags_mapping); ++i) {
+		const Id3v23Mapping *mapping = &tags_mapping[i];
+		const GValue *value = found.values[i];
+		Id3v23Frame *frame = NULL;
+
+		switch (mapping->kind) {
+
+			case ID3V23_FRAME_NUMBER:
+			{
+				// The count follows its number, both make a single frame
+				const Id3v23Mapping *count = &tags_mapping[++i];
+				if (value != NULL || found.values[i] != NULL) {
+					frame = tags_composed_tags_to_frame(
+						tags_value_first(mapping, value),
+						tags_value_first(count, found.values[i]),
+						mapping->id,
+						arena
+					);
+				}
+			}
+			break;
+
+			case ID3V23_FRAME_DATE:
+			{
+				if (value != NULL) {
+					tags_date_to_frames(tags_value_first(mapping, value), frames, arena);
+				}
+			}
+			break;
+
+			case ID3V23_FRAME_LENGTH:
+			{
+				if (value != NULL) {
+					frame = tags_length_to_frame(tags_value_first(mapping, value), arena);
+				}
+			}
+			break;
+
+			case ID3V23_FRAME_PICTURE:
+			{
+				if (value == NULL) {break;}
+				frame = tags_image_to_frame(mapping, tags_value_first(mapping, value), arena);
+
+				// A preview identical to the image would store the same picture twice
+				if (frame != NULL && image != NULL && tags_utils_same_data(image->image, frame->image)) {
+					GST_DEBUG("The preview image is identical to the image, skipping it");
+					tags_frame_free(frame, arena);
+					frame = NULL;
+				}
+				if (image == NULL) {
+					image = frame;
+				}
+			}
+			break;
+
+			default:
+			{
+				if (value != NULL) {
+					frame = tags_value_to_frame(mapping, value, arena);
+				}
+			}
+			break;
+		}
+
+		TAG_ADD_FRAME(frames, frame);
+	}
+
+	for (guint i = 0; i < frames->len; ++i) {
+		Id3v23Frame *frame = (Id3v23Frame *) g_ptr_array_index(frames, i);
+		tags_frame_set_encoding(frame, encoding);
+
+		if (template_frames != NULL) {
+			tags_template_frame(frame, template_frames);
+		}
+	}
+
+	return frames;
+}
+
+
+//
+// Serializes the given frames into an ID3v2.3 tag.
+//
+// The size of the tag is computed first in order to allocate a buffer that
+// has the exact size of the tag. Then the header and the frames are written
+// straight into the buffer that will be pushed downstream.
+//
+// Parameters:
+//   frames:   the frames to write.
+//   padding:  the minimal number of padding bytes to add after the frames.
+//   align_to: if greater than 1, the tag is padded to a multiple of this size.
+//
+// Returns:
+//   A new buffer holding the tag or NULL if the tag is too big.
+//
+static GstBuffer* tags_frames_render (
+	const GPtrArray *frames,
+	const guint     padding,
+	const guint     align_to
+) {
+
+	// Compute the size of the tag (without its header)
+	gsize size = tags_frames_size(frames);
+	gsize padding_size = id3v23_render_padding_size(ID3V23_HEADER_SIZE + size, padding, align_to);
+	size += padding_size;
+
+	if (size > ID3V23_MAX_TAG_SIZE) {
+		GST_WARNING("Tag of %" G_GSIZE_FORMAT " bytes is too big for ID3v2.3", size);
+		return NULL;
+	}
+
+	GstBuffer *buffer = gst_buffer_new_and_alloc(ID3V23_HEADER_SIZE + size);
+	guint8 *data = id3v23_render_write_header(size, GST_BUFFER_DATA(buffer));
+
+	for (guint i = 0; i < frames->len; ++i) {
+		const Id3v23Frame *frame = (const Id3v23Frame *) g_ptr_array_index(frames, i);
+		data = tags_frame_write(frame, data);
+	}
+
+	memset(data, 0, padding_size);
+	data += padding_size;
+
+	g_assert(data == GST_BUFFER_DATA(buffer) + GST_BUFFER_SIZE(buffer));
+	GST_LOG("Rendered a tag of %u bytes with %u frames", GST_BUFFER_SIZE(buffer), frames->len);
+	ID3V23_PROBE2(tag__render, GST_BUFFER_SIZE(buffer), frames->len);
+
+	return buffer;
+}
+
+
+//
+// Serializes the given frames into an ID3v2.3 tag made of several buffers,
+// each buffer is in its own group.
+//
+// The tag header and the frames are written in a single buffer, except for
+// the pictures' data. The list alternates sub-buffers of that buffer with
+// sub-buffers of the pictures, this way the pictures are never copied.
+//
+// Parameters:
+//   frames:   the frames to write.
+//   padding:  the minimal number of padding bytes to add after the frames.
+//   align_to: if greater than 1, the tag is padded to a multiple of this size.
+//   caps:     the caps to set on the buffers.
+//
+// Returns:
+//   A new buffer list holding the tag or NULL if the tag is too big.
+//
+static GstBufferList* tags_frames_render_list (
+	const GPtrArray *frames,
+	const guint     padding,
+	const guint     align_to,
+	GstCaps         *caps
+) {
+
+	// Compute the size of the tag (without its header) and of the pictures
+	gsize size = tags_frames_size(frames);
+	gsize padding_size = id3v23_render_padding_size(ID3V23_HEADER_SIZE + size, padding, align_to);
+	size += padding_size;
+
+	gsize images_size = 0;
+	for (guint i = 0; i < frames->len; ++i) {
+		const Id3v23Frame *frame = (const Id3v23Frame *) g_ptr_array_index(frames, i);
+		if (frame->image != NULL && tags_frame_stored(frame) != NULL) {
+			images_size += GST_BUFFER_SIZE(tags_frame_stored(frame));
+		}
+		else if (frame->image != NULL) {
+			images_size += GST_BUFFER_SIZE(frame->image);
+		}
+	}
+
+	if (size > ID3V23_MAX_TAG_SIZE) {
+		GST_WARNING("Tag of %" G_GSIZE_FORMAT " bytes is too big for ID3v2.3", size);
+		return NULL;
+	}
+
+	// Everything but the pictures' data
+	GstBuffer *head = gst_buffer_new_and_alloc(ID3V23_HEADER_SIZE + size - images_size);
+	guint8 *data = id3v23_render_write_header(size, GST_BUFFER_DATA(head));
+
+	GstBufferList *list = gst_buffer_list_new();
+	GstBufferListIterator *it = gst_buffer_list_iterate(list);
+
+	// Start of the data that has not been added to the list yet
+	guint offset = 0;
+	for (guint i = 0; i < frames->len; ++i) {
+		const Id3v23Frame *frame = (const Id3v23Frame *) g_ptr_array_index(frames, i);
+
+		GstBuffer *stored = tags_frame_stored(frame);
+		if (frame->image != NULL && stored != NULL) {
+			// The whole picture frame is taken from the template
+			guint end = data - GST_BUFFER_DATA(head);
+			if (end > offset) {
+				tags_buffer_list_add(it, gst_buffer_create_sub(head, offset, end - offset), caps);
+			}
+			tags_buffer_list_add(it, gst_buffer_create_sub(stored, 0, GST_BUFFER_SIZE(stored)), caps);
+			offset = end;
+			continue;
+		}
+
+		if (frame->image == NULL) {
+			data = tags_frame_write(frame, data);
+			continue;
+		}
+
+		data = tags_frame_write_head(frame, data);
+
+		if (frame->image != NULL) {
+			guint end = data - GST_BUFFER_DATA(head);
+			tags_buffer_list_add(it, gst_buffer_create_sub(head, offset, end - offset), caps);
+			tags_buffer_list_add(it, gst_buffer_create_sub(frame->image, 0, GST_BUFFER_SIZE(frame->image)), caps);
+			offset = end;
+		}
+	}
+
+	// The padding goes with the last frames
+	memset(data, 0, padding_size);
+	data += padding_size;
+
+	g_assert(data == GST_BUFFER_DATA(head) + GST_BUFFER_SIZE(head));
+
+	if (offset == 0) {
+		// No pictures, the tag fits in a single buffer
+		tags_buffer_list_add(it, gst_buffer_ref(head), caps);
+	}
+	else if (offset < GST_BUFFER_SIZE(head)) {
+		tags_buffer_list_add(it, gst_buffer_create_sub(head, offset, GST_BUFFER_SIZE(head) - offset), caps);
+	}
+
+	gst_buffer_list_iterator_free(it);
+	gst_buffer_unref(head);
+
+	GST_LOG(
+		"Rendered a tag of %" G_GSIZE_FORMAT " bytes with %u frames, %" G_GSIZE_FORMAT " bytes of pictures not copied",
+		(gsize) ID3V23_HEADER_SIZE + size, frames->len, images_size
+	);
+	ID3V23_PROBE2(tag__render, ID3V23_HEADER_SIZE + size, frames->len);
+
+	return list;
+}
+
+
+//
+// Returns the size of the frames once serialized (headers included).
+//
+static gsize tags_frames_size (
+	const GPtrArray *frames
+) {
+
+	gsize size = 0;
+	for (guint i = 0; i < frames->len; ++i) {
+		const Id3v23Frame *frame = (const Id3v23Frame *) g_ptr_array_index(frames, i);
+		size += frame->compressed != NULL
+			? GST_BUFFER_SIZE(frame->compressed)
+			: ID3V23_FRAME_HEADER_SIZE + frame->size
+		;
+	}
+
+	return size;
+}
+
+
+//
+// Appends a buffer to a buffer list in a new group.
+//
+// Parameters:
+//   it:     the iterator of the list.
+//   buffer: the buffer to add, the list takes ownership of the buffer.
+//   caps:   the caps to set on the buffer.
+//
+static void tags_buffer_list_add (
+	GstBufferListIterator *it,
+	GstBuffer             *buffer,
+	GstCaps               *caps
+) {
+	gst_buffer_set_caps(buffer, caps);
+	gst_buffer_list_iterator_add_group(it);
+	gst_buffer_list_iterator_add(it, buffer);
+}
+
+
+//
+// Writes a frame (header and body) at the given position.
+//
+// Parameters:
+//   frame: the frame to write.
+//   data:  where to write the frame, there must be enough room for the
+//          frame's header and body.
+//
+// Returns:
+//   The position right after the frame.
+//
+static guint8* tags_frame_write (
+	const Id3v23Frame *frame,
+	guint8            *data
+) {
+
+	GstBuffer *stored = tags_frame_stored(frame);
+	if (stored != NULL) {
+		memcpy(data, GST_BUFFER_DATA(stored), GST_BUFFER_SIZE(stored));
+		return data + GST_BUFFER_SIZE(stored);
+	}
+
+	data = tags_frame_write_head(frame, data);
+	if (frame->image != NULL) {
+		memcpy(data, GST_BUFFER_DATA(frame->image), GST_BUFFER_SIZE(frame->image));
+		data += GST_BUFFER_SIZE(frame->image);
+	}
+
+	return data;
+}
+
+
+//
+// Writes a frame (header and body) at the given position with the exception
+// of the picture's data, which is always the last field of a frame.
+//
+// Parameters:
+//   frame: the frame to write.
+//   data:  where to write the frame.
+//
+// Returns:
+//   The position right after what has been written.
+//
+static guint8* tags_frame_write_head (
+	const Id3v23Frame *frame,
+	guint8            *data
+) {
+
+	Id3v23Field field;
+	tags_frame_field(frame, &field);
+	Id3v23FieldLayout layout = {frame->encoding, frame->size, FALSE};
+
+	return id3v23_render_write_field_head(&field, &layout, data);
+}
+
+
+// 
+// Describes a frame as a field of the render library, the field points to
+// the frame's members.
+// 
+static void tags_frame_field (
+	const Id3v23Frame *frame,
+	Id3v23Field       *field
+) {
+
+	memset(field, 0, sizeof(Id3v23Field));
+	field->id = frame->id;
+
+	switch (frame->kind) {
+
+		case ID3V23_FRAME_UFID:
+			// The owner then the identifier
+			field->description = frame->description;
+			field->data = frame->text;
+			field->size = strlen(frame->text);
+		break;
+
+		case ID3V23_FRAME_PICTURE:
+			field->description = frame->text;
+			field->mime_type = frame->mime_type;
+			field->picture_type = frame->picture_type;
+			field->data = GST_BUFFER_DATA(frame->image);
+			field->size = GST_BUFFER_SIZE(frame->image);
+		break;
+
+		default:
+			field->value = frame->text;
+			field->description = frame->description;
+			field->language = frame->language;
+		break;
+	}
+}
+
+
+// 
+// Releases a frame and the resources that it holds. The user data is the
+// arena where the frame was allocated (NULL for the heap), the memory of the
+// frame is then released by the arena.
+// 
+// This function is meant to be used by g_ptr_array_foreach().
+// 
+static void tags_frame_free (
+	gpointer data,
+	gpointer user_data
+) {
+
+	Id3v23Frame *frame = (Id3v23Frame *) data;
+	if (frame == NULL) {return;}
+
+	if (frame->image != NULL) {
+		gst_buffer_unref(frame->image);
+	}
+	if (frame->rendered != NULL) {
+		gst_buffer_unref(frame->rendered);
+	}
+	if (frame->compressed != NULL) {
+		gst_buffer_unref(frame->compressed);
+	}
+
+	if (user_data == NULL) {
+		g_free(frame->text);
+		g_free(frame->description);
+		g_free(frame);
+	}
+}
+
+
+// 
+// Chooses the encoding of the texts of a frame and accounts the texts in the
+// size of the frame. The text and the description share the encoding.
+// 
+// Parameters:
+//   frame:    the frame, its texts must be valid UTF-8.
+//   encoding: the encoding requested, with GST_ID3V23_MUX_ENCODING_AUTO the
+//             texts are written in ISO-8859-1 when possible.
+// 
+static void tags_frame_set_encoding (
+	Id3v23Frame          *frame,
+	GstId3v23MuxEncoding encoding
+) {
+
+	Id3v23Field field;
+	tags_frame_field(frame, &field);
+
+	// The encodings of the property are in the same order as the library's
+	Id3v23FieldLayout layout;
+	Id3v23RenderStatus status = id3v23_render_measure_field(&field, (Id3v23RenderEncoding) encoding, &layout);
+	g_assert(status == ID3V23_RENDER_OK);
+
+	if (layout.lossy) {
+		GST_WARNING("Frame %s has characters that don't exist in ISO-8859-1", frame->id);
+	}
+	frame->encoding = layout.encoding;
+	frame->size = layout.size;
+}
+
+
+// 
+// Serializes a frame (header and body) into its own buffer.
+// 
+static GstBuffer* tags_frame_render (
+	const Id3v23Frame *frame
+) {
+
+	GstBuffer *buffer = gst_buffer_new_and_alloc(ID3V23_FRAME_HEADER_SIZE + frame->size);
+	tags_frame_write(frame, GST_BUFFER_DATA(buffer));
+
+	return buffer;
+}
+
+
+// 
+// Returns the buffer holding the frame as it's written in the tag: the
+// compressed frame, the frame serialized beforehand or NULL when the frame
+// has to be serialized.
+// 
+static GstBuffer* tags_frame_stored (
+	const Id3v23Frame *frame
+) {
+
+	return frame->compressed != NULL ? frame->compressed : frame->rendered;
+}
+
+
+// 
+// Encodes the frames built from the tags: serializes the frames that will be
+// reused and compresses the frames that are big enough. The tags with heavy frames (pictures, frames
+// to compress) are encoded by several threads, each frame is encoded on its
+// own and the tag is then assembled in the order of the frames, so the tag
+// is the same no matter the number of threads.
+// 
+// Parameters:
+//   frames:  the frames of the tag.
+//   options: how to encode the frames.
+// 
+static void tags_frames_encode (
+	GPtrArray                 *frames,
+	const Id3v23EncodeOptions *options
+) {
+
+	guint threads = tags_frames_threads(frames, options);
+	if (threads <= 1) {
+		for (guint i = 0; i < frames->len; ++i) {
+			tags_frame_encode((Id3v23Frame *) g_ptr_array_index(frames, i), options);
+		}
+		return;
+	}
+
+	GThreadPool *pool = tags_encode_pool();
+	Id3v23EncodeBatch batch;
+	batch.frames = frames;
+	batch.options = options;
+	batch.next = 0;
+	batch.helpers = threads - 1;
+	batch.lock = g_mutex_new();
+	batch.cond = g_cond_new();
+
+	GST_DEBUG("Encoding %u frames with %u threads", frames->len, threads);
+	for (guint i = 1; i < threads; ++i) {
+		g_thread_pool_push(pool, &batch, NULL);
+	}
+
+	// The calling thread takes its share of the frames
+	tags_encode_batch_run(&batch);
+
+	g_mutex_lock(batch.lock);
+	while (batch.helpers > 0) {
+		g_cond_wait(batch.cond, batch.lock);
+	}
+	g_mutex_unlock(batch.lock);
+
+	g_cond_free(batch.cond);
+	g_mutex_free(batch.lock);
+}
+
+
+// 
+// Returns the number of threads worth encoding the frames. The small tags
+// stay on the calling thread: starting the threads would cost more than the
+// encoding itself.
+// 
+// Parameters:
+//   frames:  the frames of the tag.
+//   options: how to encode the frames.
+// 
+static guint tags_frames_threads (
+	const GPtrArray           *frames,
+	const Id3v23EncodeOptions *options
+) {
+
+	if (options->max_threads == 1) {return 1;}
+
+	// The bytes that each frame has to go through
+	guint heavy = 0;
+	gsize work = 0;
+	for (guint i = 0; i < frames->len; ++i) {
+		const Id3v23Frame *frame = (const Id3v23Frame *) g_ptr_array_index(frames, i);
+		gsize size = ID3V23_FRAME_HEADER_SIZE + frame->size;
+		gsize frame_work = 0;
+
+		gboolean picture = frame->image != NULL;
+		if (tags_frame_stored(frame) == NULL && options->render && ! (picture && options->zero_copy)) {
+			frame_work += size;
+		}
+		if (tags_frame_compressible(frame, options) && frame->compressed == NULL) {
+			// Deflating is far slower than copying
+			frame_work += size * ID3V23_PARALLEL_COMPRESS_COST;
+		}
+
+		work += frame_work;
+		if (frame_work >= ID3V23_PARALLEL_MIN_FRAME) {
+			++heavy;
+		}
+	}
+
+	if (heavy < 2 || work < ID3V23_PARALLEL_MIN_WORK) {return 1;}
+
+	guint threads = options->max_threads != 0 ? options->max_threads : tags_utils_cpus();
+	return MIN(threads, heavy);
+}
+
+
+// 
+// Encodes a frame: serializes the frame when it will be reused and
+// compresses it when it's big enough. A frame is
+// encoded on its own, this can be done by any thread.
+// 
+// Parameters:
+//   frame:   the frame.
+//   options: how to encode the frame.
+// 
+static void tags_frame_encode (
+	Id3v23Frame               *frame,
+	const Id3v23EncodeOptions *options
+) {
+
+	// With zero-copy a picture is pushed as a sub-buffer of the image, the
+	// serialized frame would copy it
+	gboolean picture = frame->image != NULL;
+	if (frame->rendered == NULL && options->render && ! (picture && options->zero_copy)) {
+		frame->rendered = tags_frame_render(frame);
+	}
+
+	if (! tags_frame_compressible(frame, options)) {
+		// The template was compressed with other settings
+		if (frame->compressed != NULL) {
+			gst_buffer_unref(frame->compressed);
+			frame->compressed = NULL;
+		}
+	}
+	else if (frame->compressed == NULL) {
+		tags_frame_compress(frame, options->compress_level);
+	}
+
+	ID3V23_PROBE3(frame, frame->id, frame->size, frame->rendered != NULL);
+}
+
+
+// 
+// Tells if a frame is big enough to be compressed. With zero-copy the
+// pictures are never compressed, compressing would copy them.
+// 
+static gboolean tags_frame_compressible (
+	const Id3v23Frame         *frame,
+	const Id3v23EncodeOptions *options
+) {
+
+	if (frame->image != NULL && options->zero_copy) {return FALSE;}
+	return options->compress_frames != 0 && ID3V23_FRAME_HEADER_SIZE + frame->size >= options->compress_frames;
+}
+
+
+// 
+// Encodes the frames of a batch that are not taken by another thread.
+// 
+static void tags_encode_batch_run (
+	Id3v23EncodeBatch *batch
+) {
+
+	for (;;) {
+		guint i = (guint) g_atomic_int_exchange_and_add(&batch->next, 1);
+		if (i >= batch->frames->len) {break;}
+
+		tags_frame_encode((Id3v23Frame *) g_ptr_array_index(batch->frames, i), batch->options);
+	}
+}
+
+
+// 
+// Helps the thread rendering a tag to encode its frames. This is the
+// function run by the threads of the pool.
+// 
+// Parameters:
+//   data:      the batch of frames.
+//   user_data: not used.
+// 
+static void tags_encode_worker (
+	gpointer data,
+	gpointer user_data
+) {
+
+	Id3v23EncodeBatch *batch = (Id3v23EncodeBatch *) data;
+	tags_encode_batch_run(batch);
+
+	g_mutex_lock(batch->lock);
+	--batch->helpers;
+	g_cond_signal(batch->cond);
+	g_mutex_unlock(batch->lock);
+}
+
+
+// 
+// Returns the threads encoding the frames, they are shared by all the
+// elements and started the first time that a tag needs them. There's a
+// thread per CPU.
+// 
+static GThreadPool* tags_encode_pool (void) {
+
+	static volatile gsize initialized = 0;
+	static GThreadPool *pool = NULL;
+
+	if (g_once_init_enter(&initialized)) {
+		GError *error = NULL;
+		pool = g_thread_pool_new(tags_encode_worker, NULL, tags_utils_cpus(), FALSE, &error);
+		if (pool == NULL) {
+			g_error("Can't start the threads encoding the frames: %s", error->message);
+		}
+		g_once_init_leave(&initialized, 1);
+	}
+
+	return pool;
+}
+
+
+// 
+// Compresses a frame with zlib. The compressed frame has the compression
+// flag set and its body starts with the size of the uncompressed body. The
+// frame is left as it is when the compression doesn't save any byte.
+// 
+// Parameters:
+//   frame: the frame, once serialized it keeps its serialized form.
+//   level: the zlib compression level.
+// 
+static void tags_frame_compress (
+	Id3v23Frame *frame,
+	const gint  level
+) {
+
+	if (frame->rendered == NULL) {
+		frame->rendered = tags_frame_render(frame);
+	}
+	const Bytef *body = GST_BUFFER_DATA(frame->rendered) + ID3V23_FRAME_HEADER_SIZE;
+
+	// The compressed data follows the header and the uncompressed size
+	uLongf length = compressBound(frame->size);
+	GstBuffer *compressed = gst_buffer_new_and_alloc(ID3V23_FRAME_HEADER_SIZE + 4 + length);
+	guint8 *data = GST_BUFFER_DATA(compressed);
+
+	int status = compress2(data + ID3V23_FRAME_HEADER_SIZE + 4, &length, body, frame->size, level);
+	if (status != Z_OK || 4 + length >= frame->size) {
+		if (status != Z_OK) {
+			GST_WARNING("Frame %s can't be compressed (zlib error %d)", frame->id, status);
+		}
+		gst_buffer_unref(compressed);
+		return;
+	}
+
+	memcpy(data, frame->id, 4);
+	data = id3v23_render_write_uint32(4 + length, data + 4);
+	*data++ = 0x00;
+	*data++ = ID3V23_FRAME_COMPRESSED;
+	id3v23_render_write_uint32(frame->size, data);
+	GST_BUFFER_SIZE(compressed) = ID3V23_FRAME_HEADER_SIZE + 4 + length;
+
+	GST_LOG("Frame %s compressed from %" G_GSIZE_FORMAT " to %lu bytes", frame->id, frame->size, 4 + length);
+	frame->compressed = compressed;
+}
+
+
+// 
+// Looks up a frame in the frames of the previous tag. When the same frame is
+// found its serialized form is attached to the frame. The pictures are
+// compared by address only.
+// 
+// Parameters:
+//   frame:           the frame to look up.
+//   template_frames: the frames of the previous tag.
+// 
+static void tags_template_frame (
+	Id3v23Frame     *frame,
+	const GPtrArray *template_frames
+) {
+
+	for (guint i = 0; i < template_frames->len; ++i) {
+		const Id3v23Frame *other = (const Id3v23Frame *) g_ptr_array_index(template_frames, i);
+		if (
+			other->rendered != NULL &&
+			other->size == frame->size &&
+			other->kind == frame->kind &&
+			other->encoding == frame->encoding &&
+			other->picture_type == frame->picture_type &&
+			memcmp(other->id, frame->id, 4) == 0 &&
+			g_strcmp0(other->text, frame->text) == 0 &&
+			g_strcmp0(other->description, frame->description) == 0 &&
+			g_strcmp0(other->language, frame->language) == 0 &&
+			g_strcmp0(other->mime_type, frame->mime_type) == 0 &&
+			(frame->image == NULL || GST_BUFFER_DATA(other->image) == GST_BUFFER_DATA(frame->image))
+		) {
+			frame->rendered = gst_buffer_ref(other->rendered);
+			if (other->compressed != NULL) {
+				frame->compressed = gst_buffer_ref(other->compressed);
+			}
+			return;
+		}
+	}
+}
+
+
+#ifdef HAVE_ID3LIB
+// 
+// Serializes the given frames into an ID3v2.3 tag through id3lib.
+// 
+// This is the original implementation of the plugin and it's kept as a
+// fallback, the built-in writer (tags_frames_render) should be preferred.
+// 
+// Parameters:
+//   frames:   the frames to write.
+//   padding:  the minimal number of padding bytes to add after the frames.
+//   align_to: if greater than 1, the tag is padded to a multiple of this size.
+//
+// Returns:
+//   A new buffer holding the tag.
+//
+static GstBuffer* tags_frames_render_id3lib (
+	const GPtrArray *frames,
+	const guint     padding,
+	const guint     align_to,
+	Id3v23Arena     *arena
+) {
+
+	ID3_Tag tag;
+	for (guint i = 0; i < frames->len; ++i) {
+		const Id3v23Frame *frame = (const Id3v23Frame *) g_ptr_array_index(frames, i);
+		ID3_Frame *id3_frame = tags_frame_to_id3lib(frame, arena);
+		if (id3_frame != NULL) {
+			// The tag takes ownership of the frame
+			tag.AttachFrame(id3_frame);
+		}
+	}
+
+	// id3lib pads the tag on its own unless the padding is configured
+	gboolean padded = padding > 0 || align_to > 1;
+	if (padded) {
+		tag.SetPadding(false);
+	}
+
+	// id3lib can underestimate the size of UNICODE tags
+	size_t length = tag.Size() * (sizeof(unicode_t)/sizeof(uchar));
+	GstBuffer *buffer = gst_buffer_new_and_alloc(length + padding + align_to);
+	guint8 *data = GST_BUFFER_DATA(buffer);
+	size_t written = tag.Render(data, ID3TT_ID3V2);
+
+	if (padded) {
+		// Append the padding and fix the size in the tag header
+		gsize padding_size = id3v23_render_padding_size(written, padding, align_to);
+		memset(data + written, 0, padding_size);
+		written += padding_size;
+		id3v23_render_write_syncsafe(written - ID3V23_HEADER_SIZE, data + 6);
+	}
+	GST_BUFFER_SIZE(buffer) = written;
+
+	return buffer;
+}
+
+
+// 
+// Converts a frame into its id3lib counterpart.
+// 
+// Parameters:
+//   frame: the frame to convert.
+// 
+// Returns:
+//   A new ID3_Frame or NULL if the frame isn't known by id3lib.
+// 
+static ID3_Frame* tags_frame_to_id3lib (
+	const Id3v23Frame *frame,
+	Id3v23Arena       *arena
+) {
+
+	static const struct {
+		const gchar *id;
+		ID3_FrameID id3lib;
+	} mapping [] = {
+		{"TIT2", ID3FID_TITLE},
+		{"TALB", ID3FID_ALBUM},
+		{"TPE1", ID3FID_LEADARTIST},
+		{"TPE2", ID3FID_BAND},
+		{"TCON", ID3FID_CONTENTTYPE},
+		{"TRCK", ID3FID_TRACKNUM},
+		{"TPOS", ID3FID_PARTINSET},
+		{"TYER", ID3FID_YEAR},
+		{"TDAT", ID3FID_DATE},
+		{"TCOM", ID3FID_COMPOSER},
+		{"TCOP", ID3FID_COPYRIGHT},
+		{"TPUB", ID3FID_PUBLISHER},
+		{"TSSE", ID3FID_ENCODERSETTINGS},
+		{"TBPM", ID3FID_BPM},
+		{"TSRC", ID3FID_ISRC},
+		{"TLEN", ID3FID_SONGLEN},
+		{"COMM", ID3FID_COMMENT},
+		{"TXXX", ID3FID_USERTEXT},
+		{"UFID", ID3FID_UNIQUEFILEID},
+		{"APIC", ID3FID_PICTURE},
+	};
+
+	ID3_FrameID id = ID3FID_NOFRAME;
+	for (guint i = 0; i < G_N_ELEMENTS(mapping); ++i) {
+		if (strcmp(mapping[i].id, frame->id) == 0) {
+			id = mapping[i].id3lib;
+			break;
+		}
+	}
+	if (id == ID3FID_NOFRAME) {
+		GST_WARNING("Frame %s isn't supported by id3lib", frame->id);
+		return NULL;
+	}
+
+	ID3_Frame *id3_frame = new ID3_Frame(id);
+	ID3_Field *field;
+
+	if (frame->kind == ID3V23_FRAME_UFID) {
+		field = id3_frame->GetField(ID3FN_OWNER);
+		field->Set(frame->description);
+
+		field = id3_frame->GetField(ID3FN_DATA);
+		field->Set((const uchar *) frame->text, strlen(frame->text));
+		return id3_frame;
+	}
+
+	if (frame->language != NULL) {
+		field = id3_frame->GetField(ID3FN_LANGUAGE);
+		field->Set(frame->language);
+	}
+
+	if (frame->image != NULL) {
+		field = id3_frame->GetField(ID3FN_MIMETYPE);
+		field->Set(frame->mime_type);
+
+		field = id3_frame->GetField(ID3FN_PICTURETYPE);
+		field->Set(frame->picture_type);
+
+		field = id3_frame->GetField(ID3FN_DATA);
+		field->Set(
+			GST_BUFFER_DATA(frame->image),
+			GST_BUFFER_SIZE(frame->image)
+		);
+	}
+
+	field = id3_frame->GetField(ID3FN_TEXTENC);
+	field->Set(frame->encoding == ID3V23_ENCODING_UTF16 ? ID3TE_UTF16 : ID3TE_ISO8859_1);
+
+	if (frame->description != NULL) {
+		tags_id3lib_set_text(id3_frame, ID3FN_DESCRIPTION, frame->description, frame->encoding, arena);
+	}
+	if (frame->text != NULL) {
+		tags_id3lib_set_text(id3_frame, frame->image == NULL ? ID3FN_TEXT : ID3FN_DESCRIPTION, frame->text, frame->encoding, arena);
+	}
+
+	return id3_frame;
+}
+
+
+// 
+// Sets a text field of an id3lib frame.
+// 
+// Parameters:
+//   id3_frame: the frame.
+//   id:        the field to set.
+//   text:      a valid UTF-8 string.
+//   encoding:  the encoding of the frame.
+//   arena:     where to convert the text, id3lib keeps its own copy.
+// 
+static void tags_id3lib_set_text (
+	ID3_Frame    *id3_frame,
+	ID3_FieldID  id,
+	const gchar  *text,
+	const guint8 encoding,
+	Id3v23Arena  *arena
+) {
+
+	ID3_Field *field = id3_frame->GetField(id);
+
+	if (encoding == ID3V23_ENCODING_UTF16) {
+		// id3lib is not handling properly UTF-8, the text is given as UTF-16
+		field->SetEncoding(ID3TE_UTF16);
+		field->Set(tags_utils_utf8_to_utf16(text, arena));
+	}
+	else {
+		field->SetEncoding(ID3TE_ISO8859_1);
+		field->Set(tags_utils_utf8_to_latin1(text, arena));
+	}
+}
+#endif
+
+
+//
+// Returns the index (plus one) of a tag in the mapping.
+//
+// The lookup table is built once and shared by all the elements.
+//
+// Parameters:
+//   tag: the tag to lookup.
+//
+// Returns:
+//   The index of the tag in the mapping plus one or 0 if the tag isn't
+//   mapped to a frame.
+//
+static guint tags_mapping_lookup (
+	GQuark tag
+) {
 
+	static volatile gsize initialized = 0;
+	static GHashTable *lookup = NULL;
 
+	if (g_once_init_enter(&initialized)) {
+		lookup = g_hash_table_new(g_direct_hash, g_direct_equal);
+		for (guint i = 0; i < G_N_ELEMENTS(tags_mapping); ++i) {
+			GQuark quark = g_quark_from_static_string(tags_mapping[i].tag);
+			g_hash_table_insert(lookup, GUINT_TO_POINTER(quark), GUINT_TO_POINTER(i + 1));
+		}
+		g_once_init_leave(&initialized, 1);
+	}
 
+	return GPOINTER_TO_UINT(g_hash_table_lookup(lookup, GUINT_TO_POINTER(tag)));
+}
 
 
+//
+// Stores the value of a tag in the slot of its mapping.
+//
+// This function is meant to be used by gst_structure_foreach().
+//
+static gboolean tags_values_loop (
+	GQuark       tag,
+	const GValue *value,
+	gpointer     user_data
+) {
 
+	Id3v23TagValues *found = (Id3v23TagValues *) user_data;
 
+	guint index = tags_mapping_lookup(tag);
+	if (index != 0) {
+		found->values[index - 1] = value;
+	}
+	else {
+		GST_LOG("Tag %s isn't written", g_quark_to_string(tag));
+	}
 
-// ------------------
-//  Instance methods
-// ------------------
+	return TRUE;
+}
 
 
 //
-// Prints a tag from the given tag list.
+// Converts the value of a tag into a text frame (T***, COMM, TXXX or UFID).
+// The value is written as a string, no matter its type.
 //
-// This function is meant to be used by gst_tag_list_foreach().
+// Parameters:
+//   mapping: the mapping of the tag.
+//   value:   the value of the tag, can be a list of values.
+//   arena:   where to allocate the frame, NULL for the heap.
 //
-static void tags_print_loop (
-	const GstTagList *tags, 
-	const gchar      *tag, 
-	gpointer         user_data
+// Returns:
+//   The corresponding frame or NULL if the value can't be written.
+//
+static Id3v23Frame* tags_value_to_frame (
+	const Id3v23Mapping *mapping,
+	const GValue        *value,
+	Id3v23Arena         *arena
 ) {
-	
-	gchar *value = tags_tag_to_string(tags, tag);
-	g_free(value);
-	
-	return;
-}
 
+	// A single string is used as it is and a number is written on the stack,
+	// the values joined are written in the arena (on the heap without arena)
+	const gchar *text;
+	gchar number[ID3V23_NUMBER_SIZE];
+	gchar *joined = NULL;
+	if (mapping->values == ID3V23_VALUES_JOIN && GST_VALUE_HOLDS_LIST(value)) {
+		joined = tags_values_join(value, arena);
+		text = joined;
+	}
+	else {
+		const GValue *single = tags_value_first(mapping, value);
+		text = single != NULL ? tags_utils_value_to_string(single, number) : NULL;
+	}
+	if (text == NULL) {return NULL;}
+
+	Id3v23Frame *frame = NULL;
+	if (mapping->kind == ID3V23_FRAME_UFID && strlen(text) > ID3V23_MAX_UFID_SIZE) {
+		GST_WARNING("Tag %s is too long for a %s frame", mapping->tag, mapping->id);
+	}
+	else {
+		frame = tags_text_to_frame(text, mapping->id, arena);
+	}
+	if (arena == NULL) {
+		g_free(joined);
+	}
+	if (frame == NULL) {return NULL;}
 
-//
-// This function writes the gstreamer tags that have been collected so far.
-//
-static GstBuffer* gst_id3v23_mux_render_tag (
-	GstTagLibMuxPriv * mux, 
-	GstTagList *tags
-) {
-	
+	frame->kind = mapping->kind;
+	switch (mapping->kind) {
 
-	// Print the tags (DEBUG)
-	gst_tag_list_foreach(tags, tags_print_loop, NULL);
-	
-	// Trivial frames (tag -> frame)
-	ID3_Frame *title = tags_tag_to_frame(tags, GST_TAG_TITLE, ID3FID_TITLE);	
-	ID3_Frame *album = tags_tag_to_frame(tags, GST_TAG_ALBUM, ID3FID_ALBUM);	
-	ID3_Frame *artist = tags_tag_to_frame(tags, GST_TAG_ARTIST, ID3FID_LEADARTIST);	
-	ID3_Frame *genre = tags_tag_to_frame(tags, GST_TAG_GENRE, ID3FID_CONTENTTYPE);
-	
-	// Composed frames (two gst tags -> 1 frame)
-	ID3_Frame *track_number = tags_composed_tags_to_frame(tags, GST_TAG_TRACK_NUMBER, GST_TAG_TRACK_COUNT, ID3FID_TRACKNUM);
-	ID3_Frame *part_in_set = tags_composed_tags_to_frame(tags, GST_TAG_ALBUM_VOLUME_NUMBER, GST_TAG_ALBUM_VOLUME_COUNT, ID3FID_PARTINSET);
-
-
-	GDate *track_date = tags_tag_to_date(tags, GST_TAG_DATE);
-	ID3_Frame *frame_year = NULL;
-	ID3_Frame *frame_date = NULL;
-	if (track_date != NULL) {
-		
-		// The year frame format YYYY
-		GDateYear year = g_date_get_year(track_date);
-		if (year != G_DATE_BAD_YEAR) {
-			gchar *value = g_strdup_printf("%04u", year);
-			frame_year = tags_text_to_frame(value, ID3FID_YEAR);
-			g_free(value);
-		}
-	
-		// The date frame format DDMM
-		GDateMonth month = g_date_get_month(track_date);
-		GDateDay day = g_date_get_day(track_date);
-		if (month != G_DATE_BAD_MONTH && day != G_DATE_BAD_DAY) {
-			gchar *value = g_strdup_printf("%02u%02u", day, month);
-			frame_date = tags_text_to_frame(value, ID3FID_DATE);
-			g_free(value);
-		}
+		case ID3V23_FRAME_COMMENT:
+			// The language, the description is empty
+			frame->language = ID3V23_LANGUAGE_UNKNOWN;
+		break;
+
+		case ID3V23_FRAME_USER_TEXT:
+			frame->description = tags_utils_strdup(mapping->description, arena);
+		break;
+
+		case ID3V23_FRAME_UFID:
+			// The owner, there's no encoding
+			frame->description = tags_utils_strdup(mapping->description, arena);
+		break;
+
+		default:
+		break;
 	}
-	g_free(track_date);
-	
-	
-	// Images
-	ID3_Frame *image = tags_image_tag_to_frame(tags, GST_TAG_IMAGE, ID3FID_PICTURE);
-	ID3_Frame *image_preview = tags_image_tag_to_frame(tags, GST_TAG_PREVIEW_IMAGE, ID3FID_PICTURE);
-	
 
-	// Add the frames to the tag
-	ID3_Tag tag;
-	TAG_ADD_FRAME(tag, title);
-	TAG_ADD_FRAME(tag, artist);
-	TAG_ADD_FRAME(tag, album);
-	TAG_ADD_FRAME(tag, part_in_set);
-	TAG_ADD_FRAME(tag, track_number);
-	TAG_ADD_FRAME(tag, genre);
-	TAG_ADD_FRAME(tag, frame_year);
-	TAG_ADD_FRAME(tag, frame_date);
-	TAG_ADD_FRAME(tag, image);
-	TAG_ADD_FRAME(tag, image_preview);
-	
-	// Write the tag's binary data into a gstreamer buffer
-	int length = tag.Size() * (sizeof(unicode_t)/sizeof(uchar));
-	uchar *data = new uchar[length];
-	tag.Render(data, ID3TT_ID3V2);
-	GstBuffer *buffer = gst_buffer_new_and_alloc(length);
-	memcpy(GST_BUFFER_DATA(buffer), data, length);
-	gst_buffer_set_caps(buffer, GST_PAD_CAPS(mux->srcpad));
-	delete [] data;
-
-	delete title;
-	delete artist;
-	delete album;
-	delete part_in_set;
-	delete track_number;
-	delete genre;
-	delete frame_year;
-	delete frame_date;
-	delete image;
-	delete image_preview;
-	
-	return buffer;
+	return frame;
 }
 
 
@@ -345,302 +2652,349 @@ static GstBuffer* gst_id3v23_mux_render_tag (
 // by the longest number.
 //
 // Parameters:
-//   tagger: the plugin used to collect the tags.
-//   left:   the left tag to lookup.
-//   right:  the right tag to lookup.
+//   left:  the value of the left tag (the number), can be NULL.
+//   right: the value of the right tag (the count), can be NULL.
+//   id:    the ID3 frame ID.
+//   arena: where to allocate the frame, NULL for the heap.
 //
 // Returns:
-//   The value of the tag as a string or NULL if the tag couldn't be found.
+//   The corresponding frame.
 //
-//
-static ID3_Frame* tags_composed_tags_to_frame(
-	const GstTagList  *tags, 
-	const gchar       *left,
-	const gchar       *right,
-	const ID3_FrameID id
+static Id3v23Frame* tags_composed_tags_to_frame(
+	const GValue      *left,
+	const GValue      *right,
+	const gchar       *id,
+	Id3v23Arena       *arena
 ) {
 	
+	// Two numbers of 10 digits, the separator and the terminator
+	gchar composed[24];
+
 	// The values to render
-	gboolean found;
 	guint left_value;
-	found = gst_tag_list_get_uint(tags, left, &left_value);
-	if (! found) {
+	if (left != NULL && G_VALUE_HOLDS_UINT(left)) {
+		left_value = g_value_get_uint(left);
+	}
+	else {
 		// Assume that his is the first item of composed group (set or track) 
 		left_value = 1;
 	}
 	
 	// Check if the right value is there
-	guint right_value = left_value;
-	found = gst_tag_list_get_uint(tags, right, &right_value);
-	if (! found) {
+	if (right == NULL || ! G_VALUE_HOLDS_UINT(right)) {
 		// Return a single value
-		gchar *as_string = g_strdup_printf("%u", left_value);
-		ID3_Frame *frame = tags_text_to_frame(as_string, id);
-		g_free(as_string);
-		
-		return frame;
+		g_snprintf(composed, sizeof(composed), "%u", left_value);
+		return tags_text_to_frame(composed, id, arena);
 	}
+	guint right_value = g_value_get_uint(right);
 	
 	
-	// Compute the format, it depends on the longest number (number of digits)
-	size_t left_length = tags_utils_number_length(left_value);
-	size_t right_length = tags_utils_number_length(right_value);
-	size_t length = left_length < right_length ? right_length : left_length;
-	gchar *format = g_strdup_printf("%%0%uu/%%0%uu", length, length);
-
-	// The text to add to the content of the tag
-	gchar *composed = g_strdup_printf(format, left_value, right_value);
-	g_free(format);
-
+	// The numbers are padded to the length of the longest number (number of digits)
+	guint left_length = tags_utils_number_length(left_value);
+	guint right_length = tags_utils_number_length(right_value);
+	gint length = (gint) MAX(left_length, right_length);
+	g_snprintf(composed, sizeof(composed), "%0*u/%0*u", length, left_value, length, right_value);
 
-	ID3_Frame *frame = tags_text_to_frame(composed, id);
-	g_free(composed);
-
-	return frame;
+	return tags_text_to_frame(composed, id, arena);
 }
 
 
 //
 // Returns the length (number of digits) of the given number.
 //
-static size_t tags_utils_number_length(const guint i) {
-	// Compute the length by counting the number
-	// of characters in the string representation
-	gchar *string = g_strdup_printf("%u", i);
-	size_t length = strlen(string);
-	g_free(string);
+static guint tags_utils_number_length (
+	const guint i
+) {
+
+	guint length = 1;
+	for (guint rest = i / 10; rest > 0; rest /= 10) {
+		++length;
+	}
 	return length;
 }
 
 
 //
-// Returns the value of the given tag as an UTF-8 string.
-// If the tag holds a value that's not a string, the value
-// will be converted to a string.
-//
+// Converts a date into the frames TYER (YYYY) and TDAT (DDMM).
 //
 // Parameters:
-//   tags: the tags collected so far.
-//   tag:  the tag to lookup.
-//
-// Returns:
-//   The value of the tag as a string or NULL if the tag couldn't be found.
-//   The value has to be freed with g_free.
+//   value:  the value of the date tag.
+//   frames: where to add the frames.
+//   arena:  where to allocate the frames, NULL for the heap.
 //
-static gchar* tags_tag_to_string(
-	const GstTagList *tags, 
-	const gchar      *tag
+static void tags_date_to_frames (
+	const GValue *value,
+	GPtrArray    *frames,
+	Id3v23Arena  *arena
 ) {
 
-	gchar *value = NULL;
-	gboolean copied = FALSE;
+	if (! GST_VALUE_HOLDS_DATE(value)) {
+		GST_WARNING("Tag %s isn't a date (%s)", GST_TAG_DATE, G_VALUE_TYPE_NAME(value));
+		return;
+	}
+	const GDate *date = gst_value_get_date(value);
+	if (date == NULL) {return;}
 
-	GType type = gst_tag_get_type(tag);
-	switch (type) {
-	
-		case G_TYPE_STRING:
-		{
-			copied = gst_tag_list_get_string(tags, tag, &value);
-			if (copied) {
-				GST_LOG("Tag %s has a STRING of value %s", tag, value);
-			}
-		}
-		break;
-		
-		case G_TYPE_UINT:
-		{
-			guint tmp;
-			copied = gst_tag_list_get_uint(tags, tag, &tmp);
-			if (copied) {
-				value = g_strdup_printf("%u", tmp);
-				GST_LOG("Tag %s has an UINT of value %s", tag, value);
-			}
-		}
-		break;
-		
-		case G_TYPE_UINT64:
-		{
-			guint64 tmp;
-			gst_tag_list_get_uint64(tags, tag, &tmp);
-			if (copied) {
-				value = g_strdup_printf("%" G_GUINT64_FORMAT, tmp);
-				GST_LOG("Tag %s has an UINT64 of value %s", tag, value);
-			}
-		}
-		break;
-		
-		default:
-		{
-		
-			// Some types are not defined through constants but through functions!
-			// In such a case it's impossible to use a switch/case
-			if (type == GST_TYPE_DATE || type == G_TYPE_DATE) {
-				GDate *tmp = NULL;
-				copied = gst_tag_list_get_date(tags, tag, &tmp);
-				if (copied) {
-					GDateYear year = g_date_get_year(tmp);
-					if (copied) {
-						value = g_strdup_printf("%u", year);
-						GST_LOG("Tag %s has a DATE with year %s", tag, value);
-					}
-				}
-				g_free(tmp);
-				break;
-			}
+	gchar text[8];
 
-			GST_WARNING("Tag %s is a non supported type (%s)", tag, g_type_name(type));
-			value = g_strdup("");
-			copied = TRUE;
-		}
+	// The year frame format YYYY
+	GDateYear year = g_date_get_year(date);
+	if (year != G_DATE_BAD_YEAR) {
+		g_snprintf(text, sizeof(text), "%04u", (guint) year);
+		Id3v23Frame *frame = tags_text_to_frame(text, "TYER", arena);
+		TAG_ADD_FRAME(frames, frame);
 	}
 
-
-	if (! copied) {
-		value = NULL;
+	// The date frame format DDMM
+	GDateMonth month = g_date_get_month(date);
+	GDateDay day = g_date_get_day(date);
+	if (month != G_DATE_BAD_MONTH && day != G_DATE_BAD_DAY) {
+		g_snprintf(text, sizeof(text), "%02u%02u", (guint) day, (guint) month);
+		Id3v23Frame *frame = tags_text_to_frame(text, "TDAT", arena);
+		TAG_ADD_FRAME(frames, frame);
 	}
-	
-	return value;
 }
 
 
 //
-// Returns the value of the given tag as a date.
-//
+// Converts the duration of the stream into a TLEN frame.
 //
 // Parameters:
-//   tags: the tags collected so far.
-//   tag:  the tag to lookup.
+//   value: the value of the tag, a duration in nanoseconds.
+//   arena: where to allocate the frame, NULL for the heap.
 //
 // Returns:
-//   The value of the tag as a date or NULL if the tag can't be found.
-//   The return value has to be freed with g_free.
+//   The corresponding frame or NULL if the duration can't be written.
 //
-static GDate* tags_tag_to_date(
-	const GstTagList *tags,
-	const gchar      *tag
+static Id3v23Frame* tags_length_to_frame (
+	const GValue *value,
+	Id3v23Arena  *arena
 ) {
-	GDate *tmp = NULL;
-	gboolean copied = gst_tag_list_get_date(tags, tag, &tmp);
-	if (! copied) {return NULL;}
-	return tmp;
+
+	if (! G_VALUE_HOLDS_UINT64(value)) {
+		GST_WARNING("Tag %s isn't a duration (%s)", GST_TAG_DURATION, G_VALUE_TYPE_NAME(value));
+		return NULL;
+	}
+	guint64 duration = g_value_get_uint64(value);
+	if (duration == 0 || duration == GST_CLOCK_TIME_NONE) {return NULL;}
+
+	// The frame format is the number of milliseconds, rounded
+	gchar text[24];
+	g_snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT, (duration + GST_MSECOND / 2) / GST_MSECOND);
+
+	return tags_text_to_frame(text, "TLEN", arena);
 }
 
 
 //
-// Converts a GST image tag into an ID3 tag.
-//
+// Converts the value of a GST image tag into an APIC frame.
 //
 // Parameters:
-//   tags: the tags collected so far.
-//   tag:  the tag to lookup.
+//   mapping: the mapping of the tag.
+//   value:   the value of the tag.
+//   arena:   where to allocate the frame, NULL for the heap.
 //
 // Returns:
-//   The value of the tag as an image or NULL if the tag can't be found.
-// 
+//   The corresponding frame or NULL if the image can't be written.
 //
-static ID3_Frame* tags_image_tag_to_frame (
-	const GstTagList  *tags, 
-	const gchar       *tag,
-	const ID3_FrameID id
+static Id3v23Frame* tags_image_to_frame (
+	const Id3v23Mapping *mapping,
+	const GValue        *value,
+	Id3v23Arena         *arena
 ) {
 	
-	guint size = gst_tag_list_get_tag_size(tags, tag);
-	if (size > 1) {
-		GST_WARNING("Tag %s has more than one value (%d), but only one tag will be written", tag, size);
-	}
-	
 	// Get the data of the image (if there's an image)
-	const GValue *value = gst_tag_list_get_value_index(tags, tag, 0);
-	if (value == NULL) {return NULL;}
-	
 	GstBuffer *image = (GstBuffer *) gst_value_get_mini_object(value);
 	if (! tags_buffer_has_data(image)) {
 		GST_WARNING("Image buffer has no data");
 		return NULL;
 	}
+	if (GST_BUFFER_CAPS(image) == NULL) {
+		GST_WARNING("Image buffer has no caps");
+		return NULL;
+	}
 
 	
 	GstStructure *structure = gst_caps_get_structure(GST_BUFFER_CAPS(image), 0);
 	const gchar *mime_type = gst_structure_get_name(structure);
 
-	const gchar *image_format;
-	if (g_ascii_strcasecmp(mime_type, "image/png") == 0) {
-		image_format = "PNG";
-	}
-	else if (g_ascii_strcasecmp(mime_type, "image/jpeg") == 0) {
-		image_format = "JPG";
-	}
-	else {
+	if (
+		g_ascii_strcasecmp(mime_type, "image/png") != 0 &&
+		g_ascii_strcasecmp(mime_type, "image/jpeg") != 0
+	) {
 		GST_WARNING("Unsupported image type %s", mime_type);
 		return NULL;
 	}
 
 
-	ID3_Frame *frame = new ID3_Frame(id);
-
-	ID3_Field *field = frame->GetField(ID3FN_IMAGEFORMAT);
-	field->Set(image_format);
-	
-	field = frame->GetField(ID3FN_MIMETYPE);
-	field->Set(mime_type);
-	
-	// The picture types are taken from taglib/gstid3v2mux.cc
-	field = frame->GetField(ID3FN_PICTURETYPE);
-	if (g_ascii_strcasecmp(tag, GST_TAG_PREVIEW_IMAGE) == 0) {
-		field->Set(ID3PT_OTHER);
-	}
-	else {
-		field->Set(ID3PT_PNG32ICON);
-	}
+	Id3v23Frame *frame = tags_frame_new(mapping->id, ID3V23_FRAME_PICTURE, arena);
+	frame->mime_type = mime_type;
+	frame->image = gst_buffer_ref(image);
+	frame->picture_type = mapping->picture_type;
 
 	// The image description is also taken from taglib/gstid3v2mux.cc
 	// NOTE: This seems wrong as there's no description in the image.
 	const gchar *description = gst_structure_get_string(structure, "image-description");
-	if (description) {
-		tags_set_frame_field_to_unicode(frame, ID3FN_DESCRIPTION, description);
+	Id3v23TextInfo info;
+	if (description && id3v23_text_scan(description, strlen(description), &info)) {
+		frame->text = tags_utils_strdup(description, arena);
 	}
-
-	field = frame->GetField(ID3FN_DATA);
-	field->Set(
-		GST_BUFFER_DATA(image), 
-		GST_BUFFER_SIZE(image)
-	);
 	
 	return frame;
 }
 
 
 //
-// Converts a GST text tag into an ID3 tag.
-// The tag will be written as a string, no matter the tag's type.
-//
+// Returns the first value of a tag, a warning is issued when the tag has
+// more than one value as only one will be written.
 //
 // Parameters:
-//   tags: the tags collected so far.
-//   tag:  the tag to lookup.
+//   mapping: the mapping of the tag.
+//   value:   the value of the tag, can be a list of values or NULL.
 //
 // Returns:
-//   The value of the tag as a sting or NULL if the tag can't be found.
-// 
+//   The first value of the tag or NULL.
 //
-static ID3_Frame* tags_tag_to_frame (
-	const GstTagList  *tags, 
-	const gchar       *tag,
-	const ID3_FrameID id
+static const GValue* tags_value_first (
+	const Id3v23Mapping *mapping,
+	const GValue        *value
 ) {
-	
-	guint size = gst_tag_list_get_tag_size(tags, tag);
+
+	if (value == NULL || ! GST_VALUE_HOLDS_LIST(value)) {return value;}
+
+	guint size = gst_value_list_get_size(value);
 	if (size > 1) {
-		GST_WARNING("Tag %s has more than one value (%d), but only one tag will be written", tag, size);
+		GST_WARNING("Tag %s has more than one value (%u), but only one tag will be written", mapping->tag, size);
 	}
-	
-	gchar *value = tags_tag_to_string(tags, tag);
+
+	return size > 0 ? gst_value_list_get_value(value, 0) : NULL;
+}
+
+
+//
+// Joins the values of a tag with many values with '/'. The length of the
+// string is measured first, the values are then written straight into it.
+//
+// Parameters:
+//   value: the list of values of the tag.
+//   arena: where to allocate the string, NULL for the heap.
+//
+// Returns:
+//   The values as a string or NULL if none of them can be converted. Without
+//   arena the string has to be freed with g_free.
+//
+static gchar* tags_values_join (
+	const GValue *value,
+	Id3v23Arena  *arena
+) {
+
+	gchar number[ID3V23_NUMBER_SIZE];
+	guint size = gst_value_list_get_size(value);
+	gsize length = 0;
+	for (guint i = 0; i < size; ++i) {
+		const gchar *string = tags_utils_value_to_string(gst_value_list_get_value(value, i), number);
+		if (string == NULL) {continue;}
+		length += (length > 0 ? 1 : 0) + strlen(string);
+	}
+
+	// No string means no frame
+	if (length == 0) {return NULL;}
+
+	gchar *joined = (gchar *) (arena != NULL ? id3v23_arena_alloc(arena, length + 1) : g_malloc(length + 1));
+	gchar *end = joined;
+	for (guint i = 0; i < size; ++i) {
+		const gchar *string = tags_utils_value_to_string(gst_value_list_get_value(value, i), number);
+		if (string == NULL) {continue;}
+
+		gsize string_length = strlen(string);
+		if (end > joined) {
+			*end++ = '/';
+		}
+		memcpy(end, string, string_length);
+		end += string_length;
+	}
+	*end = '\0';
+
+	return joined;
+}
+
+
+//
+// Returns the value of the given tag as an UTF-8 string.
+// If the tag holds a value that's not a string, the value
+// will be converted to a string.
+//
+//
+// Parameters:
+//   tags:   the tags collected so far.
+//   tag:    the tag to lookup.
+//   number: where to write a number, ID3V23_NUMBER_SIZE bytes.
+//
+// Returns:
+//   The value of the tag as a string or NULL if the tag couldn't be found.
+//   The string belongs to the tags or to number.
+//
+static const gchar* tags_tag_to_string(
+	const GstTagList *tags, 
+	const gchar      *tag,
+	gchar            *number
+) {
+
+	const GValue *value = gst_tag_list_get_value_index(tags, tag, 0);
 	if (value == NULL) {return NULL;}
-	
-	ID3_Frame *frame = tags_text_to_frame(value, id);
-	g_free(value);
-	
-	return frame;
+
+	return tags_utils_value_to_string(value, number);
+}
+
+
+//
+// Converts a single value into an UTF-8 string. The numbers are written in
+// decimal, the real numbers are rounded and only the year of a date is kept.
+//
+// Parameters:
+//   value:  the value to convert.
+//   number: where to write a number, ID3V23_NUMBER_SIZE bytes.
+//
+// Returns:
+//   The value as a string or NULL if its type isn't supported. A string is
+//   the one of the value, a number is written in number. Nothing is
+//   allocated.
+//
+static const gchar* tags_utils_value_to_string (
+	const GValue *value,
+	gchar        *number
+) {
+
+	if (G_VALUE_HOLDS_STRING(value)) {
+		return g_value_get_string(value);
+	}
+	else if (G_VALUE_HOLDS_UINT(value)) {
+		g_snprintf(number, ID3V23_NUMBER_SIZE, "%u", g_value_get_uint(value));
+		return number;
+	}
+	else if (G_VALUE_HOLDS_INT(value)) {
+		g_snprintf(number, ID3V23_NUMBER_SIZE, "%d", g_value_get_int(value));
+		return number;
+	}
+	else if (G_VALUE_HOLDS_UINT64(value)) {
+		g_snprintf(number, ID3V23_NUMBER_SIZE, "%" G_GUINT64_FORMAT, g_value_get_uint64(value));
+		return number;
+	}
+	else if (G_VALUE_HOLDS_DOUBLE(value)) {
+		// ID3v2.3 has no real numbers (ex: TBPM is an integer)
+		gdouble real = g_value_get_double(value);
+		g_snprintf(number, ID3V23_NUMBER_SIZE, "%u", real > 0.0 ? (guint) (real + 0.5) : 0);
+		return number;
+	}
+	else if (GST_VALUE_HOLDS_DATE(value)) {
+		const GDate *date = gst_value_get_date(value);
+		if (date == NULL || g_date_get_year(date) == G_DATE_BAD_YEAR) {return NULL;}
+		g_snprintf(number, ID3V23_NUMBER_SIZE, "%u", g_date_get_year(date));
+		return number;
+	}
+
+	GST_WARNING("Values of type %s aren't supported", G_VALUE_TYPE_NAME(value));
+	return NULL;
 }
 
 
@@ -651,105 +3005,156 @@ static ID3_Frame* tags_tag_to_frame (
 // Parameters:
 //   value: the value of the tag.
 //   id:    the ID3 frame ID.
+//   arena: where to allocate the frame, NULL for the heap.
 //
 // Returns:
-//   The corresponding ID3_Frame.
+//   The corresponding frame or NULL if the value isn't a valid UTF-8 string.
 //
-static ID3_Frame* tags_text_to_frame (
+static Id3v23Frame* tags_text_to_frame (
 	const gchar       *value,
-	const ID3_FrameID id
+	const gchar       *id,
+	Id3v23Arena       *arena
 ) {
 	
-	ID3_Frame *frame = new ID3_Frame(id);
-	tags_set_frame_field_to_unicode(frame, ID3FN_TEXT, value);
+	Id3v23TextInfo info;
+	if (! id3v23_text_scan(value, strlen(value), &info)) {
+		GST_WARNING("Frame %s has a value that isn't valid UTF-8", id);
+		return NULL;
+	}
+
+	Id3v23Frame *frame = tags_frame_new(id, ID3V23_FRAME_TEXT, arena);
+	frame->text = tags_utils_strdup(value, arena);
 
 	return frame;
 }
 
 
 //
-// Sets the value of a frame field to UNICODE (UTF-16). This is a capricious
-//  operation as lib3id is not handling properly UTF-8.
+// Returns a new empty frame.
 //
 // Parameters:
-//   frame:    the frame on which to operate.
-//   field_id: the ID of the field to set as UNICODE.
-//   value:    the content to set as an UTF-8 string.
+//   id:    the ID3 frame ID.
+//   kind:  the kind of frame.
+//   arena: where to allocate the frame, NULL for the heap.
 //
-// Returns:
-//   The corresponding ID3_Frame.
+static Id3v23Frame* tags_frame_new (
+	const gchar     *id,
+	Id3v23FrameKind kind,
+	Id3v23Arena     *arena
+) {
+
+	Id3v23Frame *frame = arena != NULL
+		? (Id3v23Frame *) id3v23_arena_alloc(arena, sizeof(Id3v23Frame))
+		: g_new0(Id3v23Frame, 1)
+	;
+	g_strlcpy(frame->id, id, sizeof(frame->id));
+	frame->kind = kind;
+
+	return frame;
+}
+
+
+//
+// Returns the number of CPUs online.
+//
+static guint tags_utils_cpus (void) {
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (guint) cpus : 1;
+}
+
+
+//
+// Copies a string in the arena or on the heap when there's no arena.
 //
-static void tags_set_frame_field_to_unicode (
-	const ID3_Frame   *frame,
-	const ID3_FieldID field_id,
-	const gchar       *value
+static gchar* tags_utils_strdup (
+	const gchar *text,
+	Id3v23Arena *arena
 ) {
-	
-	// Set the text value to UTF-16
-	unicode_t *utf16 = tags_utils_utf8_to_utf16(value);
-	
-	// Create a frame for the value and set the encoding to UTF-16
-	ID3_Field *field = frame->GetField(field_id);
-	field->SetEncoding(ID3TE_UTF16);
-	field->Set(utf16);
-		
-	ID3_Field *encoding = frame->GetField(ID3FN_TEXTENC);
-	encoding->Set(ID3TE_UTF16);
-	g_free(utf16);
+
+	return arena != NULL ? id3v23_arena_strdup(arena, text) : g_strdup(text);
 }
 
 
+#ifdef HAVE_ID3LIB
 //
 // Converts an UTF-8 string to UTF-16.
 //
-// The conversion is made with g_convert.
-//
 // The UTF-16 string returned is specially made for id3lib which seems to be 
-// very picky about UNICODE strings.
+// very picky about UNICODE strings: big endian, without BOM and terminated by
+// two null bytes.
 //
 // Parameters:
-//   text: the original string in UTF-8.
+//   text:  a valid UTF-8 string.
+//   arena: where to allocate the string.
 //
 // Returns:
-//   The string in UTF-16, this string must be freed with g_free.
+//   The string in UTF-16, it lives until the arena is reset.
 //
 static unicode_t* tags_utils_utf8_to_utf16 (
-	const gchar *text 
+	const gchar *text,
+	Id3v23Arena *arena
 ) {
-	
-	// Perform the conversion
-	GError *error = NULL;
-	gsize bytes_written = 0;
-	gchar *converted = g_convert(
-		text, -1, 
-		"UTF-16BE", "UTF-8",
-		NULL, &bytes_written, 
-		&error
-	);
-	
-	// Check that all was perfect
-	if (error != NULL) {
-		GST_WARNING("Converstion from %s to %s failed: %s", "UTF-8", "UTF-16BE", error->message);
-		g_error_free(error);
-	}
-	
-	// Just in case that the conversion returns NULL without an error
-	if (converted == NULL) {
-		return NULL;
-	}
-	
-	// g_convert seems to end the strings with a single null character but an 
-	// UTF-16 string needs two of them. In order to correct this, the string has
-	// to be resized to one character more and then it needs to have the extra
-	// null character appended.
-	converted = (gchar *) g_realloc(converted, bytes_written + 2);
-	converted[bytes_written] = 0;
-	converted[bytes_written + 1] = 0;
+
+	gsize length = strlen(text);
+	Id3v23TextInfo info;
+	id3v23_text_scan(text, length, &info);
+
+	guint8 *converted = (guint8 *) id3v23_arena_alloc(arena, info.utf16_length + 2);
+	guint8 *end = id3v23_text_write_utf16(text, length, converted);
+	end[0] = 0;
+	end[1] = 0;
 
 	return (unicode_t *) converted;
 }
 
 
+//
+// Converts an UTF-8 string to ISO-8859-1, the characters that don't exist in
+// ISO-8859-1 are replaced by '?'.
+//
+// Parameters:
+//   text:  a valid UTF-8 string.
+//   arena: where to allocate the string.
+//
+// Returns:
+//   The string in ISO-8859-1, it lives until the arena is reset.
+//
+static gchar* tags_utils_utf8_to_latin1 (
+	const gchar *text,
+	Id3v23Arena *arena
+) {
+
+	gsize length = strlen(text);
+	Id3v23TextInfo info;
+	id3v23_text_scan(text, length, &info);
+
+	gchar *converted = (gchar *) id3v23_arena_alloc(arena, info.chars + 1);
+	guint8 *end = id3v23_text_write_latin1(text, length, (guint8 *) converted);
+	*end = '\0';
+
+	return converted;
+}
+#endif
+
+
+//
+// Returns true if the given buffers hold the same data.
+//
+static gboolean tags_utils_same_data (
+	const GstBuffer *a,
+	const GstBuffer *b
+) {
+
+	return GST_BUFFER_SIZE(a) == GST_BUFFER_SIZE(b)
+		&& (
+			GST_BUFFER_DATA(a) == GST_BUFFER_DATA(b)
+			|| memcmp(GST_BUFFER_DATA(a), GST_BUFFER_DATA(b), GST_BUFFER_SIZE(a)) == 0
+		)
+	;
+}
+
+
 //
 // Returns true if teh given buffer is not empty.
 //
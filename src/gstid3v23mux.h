@@ -44,14 +44,43 @@
 #define GST_ID3V23_MUX_H
 
 #include "gsttaglibmux.h"
+#include "id3v23arena.h"
 
 G_BEGIN_DECLS
 
 typedef struct _GstId3v23Mux      GstId3v23Mux;
 typedef struct _GstId3v23MuxClass GstId3v23MuxClass;
 
+/* Text encodings selected through the property "encoding" */
+typedef enum {
+	GST_ID3V23_MUX_ENCODING_AUTO,        /* ISO-8859-1 when possible, UTF-16 otherwise */
+	GST_ID3V23_MUX_ENCODING_ISO_8859_1,  /* ISO-8859-1, other characters become '?' */
+	GST_ID3V23_MUX_ENCODING_UTF16        /* UTF-16 */
+} GstId3v23MuxEncoding;
+
+/* When the tag is unsynchronised, through the property "unsynchronise" */
+typedef enum {
+	GST_ID3V23_MUX_UNSYNC_OFF,     /* never */
+	GST_ID3V23_MUX_UNSYNC_AUTO,    /* only when the tag has a false MPEG sync */
+	GST_ID3V23_MUX_UNSYNC_ALWAYS   /* always */
+} GstId3v23MuxUnsync;
+
 struct _GstId3v23Mux {
 	GstTagLibMuxPriv  taglibmux;
+
+	gboolean          use_id3lib; /* render through id3lib (needs ID3LIB=1) */
+	gboolean          zero_copy;  /* push the pictures as sub-buffers */
+	guint             padding;    /* minimal padding after the frames */
+	guint             align_to;   /* pad the tag to a multiple of this size */
+	gboolean          use_template;     /* reuse the frames of the previous tag */
+	GPtrArray        *template_frames;  /* the frames of the previous tag */
+	GPtrArray        *prepared_frames;  /* the frames encoded ahead of the tag */
+	GstId3v23MuxEncoding encoding;      /* encoding of the text frames */
+	Id3v23Arena       arena;            /* scratch memory of the renders */
+	guint             compress_frames;  /* compress the frames of at least this size (0 disables) */
+	gint              compress_level;   /* zlib level of the compressed frames */
+	guint             max_threads;      /* threads encoding the frames (0: one per CPU) */
+	GstId3v23MuxUnsync unsynchronise;   /* when the tag is unsynchronised */
 };
 
 struct _GstId3v23MuxClass {
@@ -64,7 +93,18 @@ struct _GstId3v23MuxClass {
 #define GST_IS_ID3V23_MUX(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_ID3V23_MUX))
 #define GST_IS_ID3V23_MUX_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_ID3V23_MUX))
 
+#define GST_TYPE_ID3V23_MUX_ENCODING   (gst_id3v23_mux_encoding_get_type())
+#define GST_TYPE_ID3V23_MUX_UNSYNC     (gst_id3v23_mux_unsync_get_type())
+
 GType gst_id3v23_mux_get_type (void);
+GType gst_id3v23_mux_encoding_get_type (void);
+GType gst_id3v23_mux_unsync_get_type (void);
+
+/* Renders the tags as an ID3v2.3 tag outside of a pipeline */
+GstBuffer * gst_id3v23_mux_render_tags (const GstTagList *tags, guint padding, guint align_to);
+
+/* Tells if the element writes the frames of this ID (and TXXX description or UFID owner) */
+gboolean gst_id3v23_mux_writes_frame (const gchar *id, const gchar *description);
 
 G_END_DECLS
 
@@ -28,10 +28,40 @@
 #include <gst/tag/tag.h>
 
 #include "gsttaglibmux.h"
+#include "id3v23probes.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_tag_lib_mux_priv_debug);
 #define GST_CAT_DEFAULT gst_tag_lib_mux_priv_debug
 
+#define DEFAULT_RESERVED_SIZE 4096
+
+/* tags larger than this can't be described by the 28 bits of an ID3v2 size */
+#define MAX_RESERVED_SIZE 0x0FFFFFFF
+
+/* sizes of the ID3 tags found in the stream with strip-existing */
+#define ID3V2_HEADER_SIZE 10
+#define ID3V1_TAG_SIZE 128
+
+enum
+{
+  PROP_0,
+  PROP_POST_STATS,
+  PROP_LATE_TAGS,
+  PROP_RESERVED_SIZE,
+  PROP_SCAN_MPEG,
+  PROP_STRIP_EXISTING,
+  PROP_RENDER_TIME,
+  PROP_TAG_BYTES,
+  PROP_TAG_FRAMES,
+  PROP_IMAGE_BYTES,
+  PROP_PASSTHROUGH_BUFFERS,
+  PROP_PASSTHROUGH_BYTES,
+  PROP_TIME_TO_FIRST_BUFFER,
+  PROP_DURATION,
+  PROP_MPEG_FRAMES,
+  PROP_STRIPPED_BYTES
+};
+
 static GstStaticPadTemplate gst_tag_lib_mux_priv_sink_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
@@ -58,7 +88,25 @@ GST_BOILERPLATE_FULL (GstTagLibMuxPriv, gst_tag_lib_mux_priv,
 static GstStateChangeReturn
 gst_tag_lib_mux_priv_change_state (GstElement * element, GstStateChange transition);
 static GstFlowReturn gst_tag_lib_mux_priv_chain (GstPad * pad, GstBuffer * buffer);
+static GstFlowReturn gst_tag_lib_mux_priv_chain_list (GstPad * pad,
+    GstBufferList * list);
 static gboolean gst_tag_lib_mux_priv_sink_event (GstPad * pad, GstEvent * event);
+static gboolean gst_tag_lib_mux_priv_src_event (GstPad * pad, GstEvent * event);
+static gboolean gst_tag_lib_mux_priv_sink_query (GstPad * pad,
+    GstQuery * query);
+static gboolean gst_tag_lib_mux_priv_src_query (GstPad * pad,
+    GstQuery * query);
+static void gst_tag_lib_mux_priv_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_tag_lib_mux_priv_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+static void gst_tag_lib_mux_priv_reset_stats (GstTagLibMuxPriv * mux);
+static void gst_tag_lib_mux_priv_post_stats (GstTagLibMuxPriv * mux);
+static void gst_tag_lib_mux_priv_add_duration (GstTagLibMuxPriv * mux);
+static void gst_tag_lib_mux_priv_reset_strip (GstTagLibMuxPriv * mux);
+static GstBuffer *gst_tag_lib_mux_priv_strip (GstTagLibMuxPriv * mux,
+    GstBuffer * buffer);
+static GstBuffer *gst_tag_lib_mux_priv_strip_eos (GstTagLibMuxPriv * mux);
 
 static void
 gst_tag_lib_mux_priv_finalize (GObject * obj)
@@ -75,6 +123,13 @@ gst_tag_lib_mux_priv_finalize (GObject * obj)
     mux->event_tags = NULL;
   }
 
+  gst_tag_lib_mux_priv_reset_strip (mux);
+
+  if (mux->tag_list) {
+    gst_buffer_list_unref (mux->tag_list);
+    mux->tag_list = NULL;
+  }
+
   G_OBJECT_CLASS (parent_class)->finalize (obj);
 }
 
@@ -100,8 +155,77 @@ gst_tag_lib_mux_priv_class_init (GstTagLibMuxPrivClass * klass)
   gstelement_class = (GstElementClass *) klass;
 
   gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_tag_lib_mux_priv_finalize);
+  gobject_class->set_property = gst_tag_lib_mux_priv_set_property;
+  gobject_class->get_property = gst_tag_lib_mux_priv_get_property;
   gstelement_class->change_state =
       GST_DEBUG_FUNCPTR (gst_tag_lib_mux_priv_change_state);
+
+  g_object_class_install_property (gobject_class, PROP_POST_STATS,
+      g_param_spec_boolean ("post-stats", "Post statistics",
+          "Post an element message with the statistics at EOS",
+          FALSE, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_LATE_TAGS,
+      g_param_spec_boolean ("late-tags", "Late tags",
+          "Push a placeholder tag of reserved-size bytes as soon as the "
+          "stream starts and rewrite it at EOS with all the tags received "
+          "(only when downstream is seekable)", FALSE, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_RESERVED_SIZE,
+      g_param_spec_uint ("reserved-size", "Reserved size",
+          "Size of the placeholder tag pushed in the late-tags mode "
+          "(in bytes)", 0, MAX_RESERVED_SIZE, DEFAULT_RESERVED_SIZE,
+          G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_RENDER_TIME,
+      g_param_spec_uint64 ("render-time", "Render time",
+          "Time spent rendering the tag (in nanoseconds)",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_TAG_BYTES,
+      g_param_spec_uint64 ("tag-bytes", "Tag bytes",
+          "Size of the tag, padding included",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_TAG_FRAMES,
+      g_param_spec_uint ("tag-frames", "Tag frames",
+          "Number of frames in the tag", 0, G_MAXUINT, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_IMAGE_BYTES,
+      g_param_spec_uint64 ("image-bytes", "Image bytes",
+          "Bytes of pictures in the tag",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_PASSTHROUGH_BUFFERS,
+      g_param_spec_uint64 ("passthrough-buffers", "Passthrough buffers",
+          "Number of buffers pushed after the tag",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_PASSTHROUGH_BYTES,
+      g_param_spec_uint64 ("passthrough-bytes", "Passthrough bytes",
+          "Number of bytes pushed after the tag",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_TIME_TO_FIRST_BUFFER,
+      g_param_spec_uint64 ("time-to-first-buffer", "Time to first buffer",
+          "Time between the change from READY to PAUSED and the push of the "
+          "tag (in nanoseconds, -1 until the tag is pushed)",
+          0, G_MAXUINT64, GST_CLOCK_TIME_NONE, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_SCAN_MPEG,
+      g_param_spec_boolean ("scan-mpeg", "Scan MPEG",
+          "Follow the MPEG audio frames passed through and write their "
+          "duration in the tag at EOS, the tag is reserved as in the "
+          "late-tags mode (only when downstream is seekable)",
+          FALSE, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_STRIP_EXISTING,
+      g_param_spec_boolean ("strip-existing", "Strip existing",
+          "Drop the ID3v2 tag at the start of the stream and the ID3v1 tag "
+          "at its end, their tags are merged with the tags received "
+          "(no need for id3demux upstream)", FALSE, G_PARAM_READWRITE));
+  g_object_class_install_property (gobject_class, PROP_DURATION,
+      g_param_spec_uint64 ("duration", "Duration",
+          "Duration of the MPEG audio frames passed through (in "
+          "nanoseconds, only with scan-mpeg)",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_MPEG_FRAMES,
+      g_param_spec_uint64 ("mpeg-frames", "MPEG frames",
+          "Number of MPEG audio frames passed through (only with scan-mpeg)",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+  g_object_class_install_property (gobject_class, PROP_STRIPPED_BYTES,
+      g_param_spec_uint64 ("stripped-bytes", "Stripped bytes",
+          "Bytes of the ID3 tags dropped (only with strip-existing)",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
 }
 
 static void
@@ -115,8 +239,12 @@ gst_tag_lib_mux_priv_init (GstTagLibMuxPriv * mux, GstTagLibMuxPrivClass * mux_c
       gst_pad_new_from_static_template (&gst_tag_lib_mux_priv_sink_template, "sink");
   gst_pad_set_chain_function (mux->sinkpad,
       GST_DEBUG_FUNCPTR (gst_tag_lib_mux_priv_chain));
+  gst_pad_set_chain_list_function (mux->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_tag_lib_mux_priv_chain_list));
   gst_pad_set_event_function (mux->sinkpad,
       GST_DEBUG_FUNCPTR (gst_tag_lib_mux_priv_sink_event));
+  gst_pad_set_query_function (mux->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_tag_lib_mux_priv_sink_query));
   gst_element_add_pad (GST_ELEMENT (mux), mux->sinkpad);
 
   /* pad through which data goes out of the element */
@@ -124,49 +252,316 @@ gst_tag_lib_mux_priv_init (GstTagLibMuxPriv * mux, GstTagLibMuxPrivClass * mux_c
   if (tmpl) {
     mux->srcpad = gst_pad_new_from_template (tmpl, "src");
     gst_pad_use_fixed_caps (mux->srcpad);
+    gst_pad_set_event_function (mux->srcpad,
+        GST_DEBUG_FUNCPTR (gst_tag_lib_mux_priv_src_event));
+    gst_pad_set_query_function (mux->srcpad,
+        GST_DEBUG_FUNCPTR (gst_tag_lib_mux_priv_src_query));
     gst_pad_set_caps (mux->srcpad, gst_pad_template_get_caps (tmpl));
     gst_element_add_pad (GST_ELEMENT (mux), mux->srcpad);
   }
 
   mux->render_tag = TRUE;
+  mux->post_stats = FALSE;
+  mux->late_tags = FALSE;
+  mux->reserved_size = DEFAULT_RESERVED_SIZE;
+  mux->tag_reserve = 0;
+  mux->tag_list = NULL;
+  mux->tag_resend = -1;
+  mux->scan_mpeg = FALSE;
+  id3v23_mpeg_scanner_init (&mux->scanner);
+  mux->strip_existing = FALSE;
+  mux->strip_head = NULL;
+  mux->strip_tail = NULL;
+  gst_tag_lib_mux_priv_reset_strip (mux);
+  mux->start_time = GST_CLOCK_TIME_NONE;
+  gst_tag_lib_mux_priv_reset_stats (mux);
 }
 
-static GstBuffer *
-gst_tag_lib_mux_priv_render_tag (GstTagLibMuxPriv * mux)
+static void
+gst_tag_lib_mux_priv_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstTagLibMuxPriv *mux = GST_TAG_LIB_MUX (object);
+
+  switch (prop_id) {
+    case PROP_POST_STATS:
+      mux->post_stats = g_value_get_boolean (value);
+      break;
+    case PROP_LATE_TAGS:
+      mux->late_tags = g_value_get_boolean (value);
+      break;
+    case PROP_RESERVED_SIZE:
+      mux->reserved_size = g_value_get_uint (value);
+      break;
+    case PROP_SCAN_MPEG:
+      mux->scan_mpeg = g_value_get_boolean (value);
+      break;
+    case PROP_STRIP_EXISTING:
+      mux->strip_existing = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_tag_lib_mux_priv_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstTagLibMuxPriv *mux = GST_TAG_LIB_MUX (object);
+
+  switch (prop_id) {
+    case PROP_POST_STATS:
+      g_value_set_boolean (value, mux->post_stats);
+      break;
+    case PROP_LATE_TAGS:
+      g_value_set_boolean (value, mux->late_tags);
+      break;
+    case PROP_RESERVED_SIZE:
+      g_value_set_uint (value, mux->reserved_size);
+      break;
+    case PROP_SCAN_MPEG:
+      g_value_set_boolean (value, mux->scan_mpeg);
+      break;
+    case PROP_STRIP_EXISTING:
+      g_value_set_boolean (value, mux->strip_existing);
+      break;
+    case PROP_RENDER_TIME:
+      g_value_set_uint64 (value, mux->stats.render_time);
+      break;
+    case PROP_TAG_BYTES:
+      g_value_set_uint64 (value, mux->stats.tag_bytes);
+      break;
+    case PROP_TAG_FRAMES:
+      g_value_set_uint (value, mux->stats.frames);
+      break;
+    case PROP_IMAGE_BYTES:
+      g_value_set_uint64 (value, mux->stats.image_bytes);
+      break;
+    case PROP_PASSTHROUGH_BUFFERS:
+      g_value_set_uint64 (value, mux->stats.passthrough_buffers);
+      break;
+    case PROP_PASSTHROUGH_BYTES:
+      g_value_set_uint64 (value, mux->stats.passthrough_bytes);
+      break;
+    case PROP_TIME_TO_FIRST_BUFFER:
+      g_value_set_uint64 (value, mux->stats.time_to_first_buffer);
+      break;
+    case PROP_DURATION:
+      g_value_set_uint64 (value, mux->stats.duration);
+      break;
+    case PROP_MPEG_FRAMES:
+      g_value_set_uint64 (value, mux->stats.mpeg_frames);
+      break;
+    case PROP_STRIPPED_BYTES:
+      g_value_set_uint64 (value, mux->stats.stripped_bytes);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_tag_lib_mux_priv_reset_stats (GstTagLibMuxPriv * mux)
+{
+  memset (&mux->stats, 0, sizeof (mux->stats));
+  mux->stats.time_to_first_buffer = GST_CLOCK_TIME_NONE;
+}
+
+/* Adds the duration of the MPEG audio frames that went through to the tags
+ * received, the tag rewritten at EOS then has it */
+static void
+gst_tag_lib_mux_priv_add_duration (GstTagLibMuxPriv * mux)
+{
+  Id3v23MpegScanner *scanner = &mux->scanner;
+  guint i;
+
+  mux->stats.mpeg_frames = scanner->frames;
+  mux->stats.duration = id3v23_mpeg_scanner_duration (scanner);
+  if (scanner->frames == 0) {
+    GST_WARNING_OBJECT (mux, "no MPEG audio frame found, no duration");
+    return;
+  }
+
+  GST_INFO_OBJECT (mux, "%" G_GUINT64_FORMAT " MPEG audio frames (%s, %u "
+      "bit/s on average, %" G_GUINT64_FORMAT " bytes lost), duration %"
+      GST_TIME_FORMAT, scanner->frames, scanner->vbr ? "VBR" : "CBR",
+      id3v23_mpeg_scanner_average_bitrate (scanner), scanner->lost,
+      GST_TIME_ARGS (mux->stats.duration));
+  for (i = 0; i < G_N_ELEMENTS (scanner->bitrates); i++) {
+    if (scanner->bitrates[i] != 0)
+      GST_DEBUG_OBJECT (mux, "%u kbit/s: %" G_GUINT64_FORMAT " frames",
+          id3v23_mpeg_scanner_bitrate (scanner, i), scanner->bitrates[i]);
+  }
+
+  if (mux->event_tags == NULL)
+    mux->event_tags = gst_tag_list_new ();
+  gst_tag_list_add (mux->event_tags, GST_TAG_MERGE_REPLACE,
+      GST_TAG_DURATION, mux->stats.duration, NULL);
+}
+
+/* Posts the statistics of the stream as an element message named
+ * "taglibmux-stats" with a field for each statistic */
+static void
+gst_tag_lib_mux_priv_post_stats (GstTagLibMuxPriv * mux)
+{
+  GstStructure *structure;
+
+  structure = gst_structure_new ("taglibmux-stats",
+      "render-time", G_TYPE_UINT64, mux->stats.render_time,
+      "tag-bytes", G_TYPE_UINT64, mux->stats.tag_bytes,
+      "tag-frames", G_TYPE_UINT, mux->stats.frames,
+      "image-bytes", G_TYPE_UINT64, mux->stats.image_bytes,
+      "passthrough-buffers", G_TYPE_UINT64, mux->stats.passthrough_buffers,
+      "passthrough-bytes", G_TYPE_UINT64, mux->stats.passthrough_bytes,
+      "time-to-first-buffer", G_TYPE_UINT64, mux->stats.time_to_first_buffer,
+      NULL);
+
+  if (mux->scan_mpeg) {
+    gst_structure_set (structure,
+        "duration", G_TYPE_UINT64, mux->stats.duration,
+        "mpeg-frames", G_TYPE_UINT64, mux->stats.mpeg_frames,
+        "bitrate", G_TYPE_UINT,
+        id3v23_mpeg_scanner_average_bitrate (&mux->scanner),
+        "vbr", G_TYPE_BOOLEAN, mux->scanner.vbr, NULL);
+  }
+
+  if (mux->strip_existing) {
+    gst_structure_set (structure,
+        "stripped-bytes", G_TYPE_UINT64, mux->stats.stripped_bytes, NULL);
+  }
+
+  gst_element_post_message (GST_ELEMENT (mux),
+      gst_message_new_element (GST_OBJECT (mux), structure));
+}
+
+/* Returns the tags set on the element merged with the tags received from
+ * upstream, following the merge mode of the tag setter */
+static GstTagList *
+gst_tag_lib_mux_priv_merge_tags (GstTagLibMuxPriv * mux)
 {
-  GstTagLibMuxPrivClass *klass;
   GstTagMergeMode merge_mode;
   GstTagSetter *tagsetter;
-  GstBuffer *buffer;
   const GstTagList *tagsetter_tags;
   GstTagList *taglist;
-  GstEvent *event;
+  gboolean log;
+
+  /* serializing the tag lists (pictures included) is expensive, it's only
+   * done when the messages are really logged */
+  log = gst_debug_category_get_threshold (GST_CAT_DEFAULT) >= GST_LEVEL_LOG;
 
   tagsetter = GST_TAG_SETTER (mux);
 
   tagsetter_tags = gst_tag_setter_get_tag_list (tagsetter);
   merge_mode = gst_tag_setter_get_tag_merge_mode (tagsetter);
 
-  GST_LOG_OBJECT (mux, "merging tags, merge mode = %d", merge_mode);
-  GST_LOG_OBJECT (mux, "event tags: %" GST_PTR_FORMAT, mux->event_tags);
-  GST_LOG_OBJECT (mux, "set   tags: %" GST_PTR_FORMAT, tagsetter_tags);
+  if (log) {
+    GST_LOG_OBJECT (mux, "merging tags, merge mode = %d", merge_mode);
+    GST_LOG_OBJECT (mux, "event tags: %" GST_PTR_FORMAT, mux->event_tags);
+    GST_LOG_OBJECT (mux, "set   tags: %" GST_PTR_FORMAT, tagsetter_tags);
+  }
 
   taglist = gst_tag_list_merge (tagsetter_tags, mux->event_tags, merge_mode);
 
-  GST_LOG_OBJECT (mux, "final tags: %" GST_PTR_FORMAT, taglist);
+  if (log)
+    GST_LOG_OBJECT (mux, "final tags: %" GST_PTR_FORMAT, taglist);
+
+  return taglist;
+}
+
+/* Hands the tags known so far to the subclass so that it encodes them before
+ * the first buffer, the tag is then rendered from what was prepared and only
+ * what changed in between is encoded again */
+static void
+gst_tag_lib_mux_priv_prepare_tags (GstTagLibMuxPriv * mux)
+{
+  GstTagLibMuxPrivClass *klass;
+  GstTagList *taglist;
+
+  klass = GST_TAG_LIB_MUX_CLASS (G_OBJECT_GET_CLASS (mux));
+  if (klass->prepare_tags == NULL)
+    return;
+
+  taglist = gst_tag_lib_mux_priv_merge_tags (mux);
+  if (taglist == NULL)
+    return;
+
+  klass->prepare_tags (mux, taglist);
+  gst_tag_list_free (taglist);
+}
+
+static GstBufferList *
+gst_tag_lib_mux_priv_render_tag (GstTagLibMuxPriv * mux)
+{
+  GstTagLibMuxPrivClass *klass;
+  GstBufferList *list;
+  GstBufferListIterator *it;
+  GstBuffer *buffer;
+  GstTagList *taglist;
+  GstEvent *event;
+  GstClockTime start, render_time;
+  gsize tag_size;
+
+  ID3V23_PROBE (render__start);
+  start = gst_util_get_timestamp ();
+
+  taglist = gst_tag_lib_mux_priv_merge_tags (mux);
 
   klass = GST_TAG_LIB_MUX_CLASS (G_OBJECT_GET_CLASS (mux));
 
-  if (klass->render_tag == NULL)
+  if (klass->render_tag_list != NULL) {
+    list = klass->render_tag_list (mux, taglist);
+  } else if (klass->render_tag != NULL) {
+    list = NULL;
+    buffer = klass->render_tag (mux, taglist);
+    if (buffer != NULL) {
+      list = gst_buffer_list_new ();
+      it = gst_buffer_list_iterate (list);
+      gst_buffer_list_iterator_add_group (it);
+      gst_buffer_list_iterator_add (it, buffer);
+      gst_buffer_list_iterator_free (it);
+    }
+  } else {
     goto no_vfunc;
+  }
 
-  buffer = klass->render_tag (mux, taglist);
-
-  if (buffer == NULL)
+  if (list == NULL)
     goto render_error;
 
-  mux->tag_size = GST_BUFFER_SIZE (buffer);
-  GST_LOG_OBJECT (mux, "tag size = %" G_GSIZE_FORMAT " bytes", mux->tag_size);
+  /* the buffers were just rendered, so their metadata is writable; the
+   * tag size covers everything that precedes the audio, padding included */
+  tag_size = 0;
+  it = gst_buffer_list_iterate (list);
+  while (gst_buffer_list_iterator_next_group (it)) {
+    while ((buffer = gst_buffer_list_iterator_next (it)) != NULL) {
+      GST_BUFFER_OFFSET (buffer) = tag_size;
+      tag_size += GST_BUFFER_SIZE (buffer);
+    }
+  }
+  gst_buffer_list_iterator_free (it);
+
+  if (mux->tag_reserve != 0 && tag_size != mux->tag_reserve) {
+    if (!mux->render_tag)
+      goto does_not_fit;
+
+    /* the placeholder is pushed all the same, it already has the tags
+     * received so far, the ones received later are lost */
+    GST_WARNING_OBJECT (mux, "tag of %" G_GSIZE_FORMAT " bytes doesn't fit "
+        "in the %" G_GSIZE_FORMAT " reserved bytes, late tags disabled",
+        tag_size, mux->tag_reserve);
+    mux->tag_reserve = 0;
+  }
+
+  mux->tag_size = tag_size;
+  render_time = gst_util_get_timestamp () - start;
+  mux->stats.tag_bytes = tag_size;
+  mux->stats.render_time += render_time;
+  ID3V23_PROBE2 (render__done, tag_size, render_time);
+
+  GST_LOG_OBJECT (mux, "tag size = %" G_GSIZE_FORMAT " bytes, rendered in %"
+      GST_TIME_FORMAT, tag_size, GST_TIME_ARGS (render_time));
 
   /* Send newsegment event from byte position 0, so the tag really gets
    * written to the start of the file, independent of the upstream segment */
@@ -178,9 +573,7 @@ gst_tag_lib_mux_priv_render_tag (GstTagLibMuxPriv * mux)
   event = gst_event_new_tag (taglist);
   gst_pad_push_event (mux->srcpad, event);
 
-  GST_BUFFER_OFFSET (buffer) = 0;
-
-  return buffer;
+  return list;
 
 no_vfunc:
   {
@@ -195,6 +588,151 @@ render_error:
     gst_tag_list_free (taglist);
     return NULL;
   }
+
+does_not_fit:
+  {
+    GST_WARNING_OBJECT (mux, "final tag of %" G_GSIZE_FORMAT " bytes doesn't "
+        "fit in the %" G_GSIZE_FORMAT " reserved bytes, keeping the "
+        "placeholder", tag_size, mux->tag_reserve);
+    gst_buffer_list_unref (list);
+    gst_tag_list_free (taglist);
+    return NULL;
+  }
+}
+
+/* Pushes the buffers of the rendered tag one after the other. Each buffer is
+ * pushed on its own so that sub-buffers referencing large payloads (pictures)
+ * never get merged into a single buffer. Takes ownership of the list, which
+ * is kept in order to serve the seeks that land in the tag. */
+static GstFlowReturn
+gst_tag_lib_mux_priv_push_tag (GstTagLibMuxPriv * mux, GstBufferList * list)
+{
+  GstBufferListIterator *it;
+  GstBuffer *buffer;
+  GstFlowReturn ret;
+
+  ret = GST_FLOW_OK;
+  it = gst_buffer_list_iterate (list);
+  while (ret == GST_FLOW_OK && gst_buffer_list_iterator_next_group (it)) {
+    while (ret == GST_FLOW_OK
+        && (buffer = gst_buffer_list_iterator_next (it)) != NULL) {
+      ret = gst_pad_push (mux->srcpad, gst_buffer_ref (buffer));
+    }
+  }
+  gst_buffer_list_iterator_free (it);
+
+  GST_OBJECT_LOCK (mux);
+  if (mux->tag_list)
+    gst_buffer_list_unref (mux->tag_list);
+  mux->tag_list = list;
+  GST_OBJECT_UNLOCK (mux);
+
+  return ret;
+}
+
+/* Pushes the tag again from the given byte after a seek that landed in it,
+ * the buffers of the tag are pushed from the cached tag (the one that
+ * contains the byte is pushed as a sub-buffer) */
+static GstFlowReturn
+gst_tag_lib_mux_priv_resend_tag (GstTagLibMuxPriv * mux, gint64 offset)
+{
+  GstBufferListIterator *it;
+  GstBufferList *list;
+  GstBuffer *buffer, *sub;
+  GstFlowReturn ret;
+  gint64 position;
+  guint size;
+
+  GST_OBJECT_LOCK (mux);
+  list = mux->tag_list != NULL ? gst_buffer_list_ref (mux->tag_list) : NULL;
+  GST_OBJECT_UNLOCK (mux);
+  if (list == NULL)
+    return GST_FLOW_OK;
+
+  GST_DEBUG_OBJECT (mux, "pushing the tag again from byte %" G_GINT64_FORMAT,
+      offset);
+
+  ret = GST_FLOW_OK;
+  position = 0;
+  it = gst_buffer_list_iterate (list);
+  while (ret == GST_FLOW_OK && gst_buffer_list_iterator_next_group (it)) {
+    while (ret == GST_FLOW_OK
+        && (buffer = gst_buffer_list_iterator_next (it)) != NULL) {
+      size = GST_BUFFER_SIZE (buffer);
+      if (position >= offset) {
+        ret = gst_pad_push (mux->srcpad, gst_buffer_ref (buffer));
+      } else if (position + size > offset) {
+        sub = gst_buffer_create_sub (buffer, offset - position,
+            size - (offset - position));
+        GST_BUFFER_OFFSET (sub) = offset;
+        ret = gst_pad_push (mux->srcpad, sub);
+      }
+      position += size;
+    }
+  }
+  gst_buffer_list_iterator_free (it);
+  gst_buffer_list_unref (list);
+
+  return ret;
+}
+
+/* Returns TRUE when downstream can seek back in bytes, which is needed to
+ * overwrite the placeholder of the late-tags mode at EOS */
+static gboolean
+gst_tag_lib_mux_priv_peer_seekable (GstTagLibMuxPriv * mux)
+{
+  GstQuery *query;
+  gboolean seekable;
+
+  seekable = FALSE;
+  query = gst_query_new_seeking (GST_FORMAT_BYTES);
+  if (gst_pad_peer_query (mux->srcpad, query))
+    gst_query_parse_seeking (query, NULL, &seekable, NULL, NULL);
+  gst_query_unref (query);
+
+  return seekable;
+}
+
+/* Renders the tag again with all the tags received and pushes it over the
+ * placeholder: the newsegment event pushed by render_tag makes downstream
+ * seek back to the byte 0. The placeholder stays when the tag doesn't fit. */
+static void
+gst_tag_lib_mux_priv_rewrite_tag (GstTagLibMuxPriv * mux)
+{
+  GstBufferList *tag_list;
+  GstFlowReturn ret;
+
+  GST_INFO_OBJECT (mux, "Rewriting the tag at the start of the stream");
+  tag_list = gst_tag_lib_mux_priv_render_tag (mux);
+  if (tag_list == NULL)
+    return;
+
+  ret = gst_tag_lib_mux_priv_push_tag (mux, tag_list);
+  if (ret != GST_FLOW_OK)
+    GST_WARNING_OBJECT (mux, "failed to rewrite the tag, flow: %s",
+        gst_flow_get_name (ret));
+}
+
+/* Converts a byte of the input into the output, where our tag replaces the
+ * stripped ID3v2 tag */
+static inline gint64
+gst_tag_lib_mux_priv_to_output (GstTagLibMuxPriv * mux, gint64 position)
+{
+  if (position == -1)
+    return -1;
+
+  return MAX (position - (gint64) mux->strip_size, 0) + mux->tag_size;
+}
+
+/* Converts a byte of the output into the input, the bytes of our tag are
+ * the start of the audio */
+static inline gint64
+gst_tag_lib_mux_priv_to_input (GstTagLibMuxPriv * mux, gint64 position)
+{
+  if (position == -1)
+    return -1;
+
+  return MAX (position - (gint64) mux->tag_size, 0) + mux->strip_size;
 }
 
 static GstEvent *
@@ -209,12 +747,9 @@ gst_tag_lib_mux_priv_adjust_event_offsets (GstTagLibMuxPriv * mux,
 
   g_assert (format == GST_FORMAT_BYTES);
 
-  if (start != -1)
-    start += mux->tag_size;
-  if (stop != -1)
-    stop += mux->tag_size;
-  if (cur != -1)
-    cur += mux->tag_size;
+  start = gst_tag_lib_mux_priv_to_output (mux, start);
+  stop = gst_tag_lib_mux_priv_to_output (mux, stop);
+  cur = gst_tag_lib_mux_priv_to_output (mux, cur);
 
   GST_DEBUG_OBJECT (mux, "adjusting newsegment event offsets to start=%"
       G_GINT64_FORMAT ", stop=%" G_GINT64_FORMAT ", cur=%" G_GINT64_FORMAT
@@ -223,62 +758,466 @@ gst_tag_lib_mux_priv_adjust_event_offsets (GstTagLibMuxPriv * mux,
   return gst_event_new_new_segment (TRUE, 1.0, format, start, stop, cur);
 }
 
+/* Renders and pushes the tag, followed by the cached newsegment event with
+ * its offsets moved behind the tag. Called with the first buffer (or buffer
+ * list) received from upstream. */
 static GstFlowReturn
-gst_tag_lib_mux_priv_chain (GstPad * pad, GstBuffer * buffer)
+gst_tag_lib_mux_priv_start (GstTagLibMuxPriv * mux)
 {
-  GstTagLibMuxPriv *mux = GST_TAG_LIB_MUX (GST_OBJECT_PARENT (pad));
+  GstFlowReturn ret;
+  GstBufferList *tag_list;
+
+  GST_INFO_OBJECT (mux, "Adding tags to stream");
+  tag_list = gst_tag_lib_mux_priv_render_tag (mux);
+  if (tag_list == NULL)
+    goto no_tag_buffer;
+  ret = gst_tag_lib_mux_priv_push_tag (mux, tag_list);
+  if (ret != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (mux, "flow: %s", gst_flow_get_name (ret));
+    return ret;
+  }
 
+  if (GST_CLOCK_TIME_IS_VALID (mux->start_time))
+    mux->stats.time_to_first_buffer =
+        gst_util_get_timestamp () - mux->start_time;
+
+  /* Now send the cached newsegment event that we got from upstream */
+  if (mux->newsegment_ev) {
+    GST_DEBUG_OBJECT (mux, "sending cached newsegment event");
+    gst_pad_push_event (mux->srcpad,
+        gst_tag_lib_mux_priv_adjust_event_offsets (mux, mux->newsegment_ev));
+    gst_event_unref (mux->newsegment_ev);
+    mux->newsegment_ev = NULL;
+  } else {
+    /* upstream sent no newsegment event or only one in a non-BYTE format */
+  }
+
+  mux->render_tag = FALSE;
+
+  return GST_FLOW_OK;
+
+/* ERRORS */
+no_tag_buffer:
+  {
+    /* Doesn't compile in some Linux distributions (Fedora 9, Debian Lenny) when
+		 * using -Werror.
+    GST_ELEMENT_ERROR (mux, LIBRARY, ENCODE, (NULL), (NULL));
+		*/
+    GST_ERROR_OBJECT (mux, "Got an error, no tags in buffer?");
+    return GST_FLOW_ERROR;
+  }
+}
+
+/* Moves the offset of a buffer coming after the tag behind the tag and gives
+ * it the caps of the source pad. Buffers that have no offset and already
+ * carry these caps are passed as they are; the metadata of the others is
+ * made writable, which only copies it when the buffer is shared. The caps
+ * are only replaced when they differ, in the steady state of a stream whose
+ * buffers are owned by the element this is a single field update. */
+static inline GstBuffer *
+gst_tag_lib_mux_priv_fixup_buffer (GstTagLibMuxPriv * mux, GstBuffer * buffer,
+    GstCaps * caps)
+{
+  if (GST_BUFFER_OFFSET (buffer) == GST_BUFFER_OFFSET_NONE
+      && GST_BUFFER_CAPS (buffer) == caps)
+    return buffer;
+
+  buffer = gst_buffer_make_metadata_writable (buffer);
+
+  if (GST_BUFFER_OFFSET (buffer) != GST_BUFFER_OFFSET_NONE) {
+    guint64 offset;
+
+    offset = gst_tag_lib_mux_priv_to_output (mux, GST_BUFFER_OFFSET (buffer));
+    GST_LOG_OBJECT (mux, "Adjusting buffer offset from %" G_GINT64_FORMAT
+        " to %" G_GINT64_FORMAT, GST_BUFFER_OFFSET (buffer), offset);
+    GST_BUFFER_OFFSET (buffer) = offset;
+  }
+
+  if (GST_BUFFER_CAPS (buffer) != caps)
+    gst_buffer_set_caps (buffer, caps);
+
+  return buffer;
+}
+
+/* Forgets the ID3 tags found in the stream with strip-existing */
+static void
+gst_tag_lib_mux_priv_reset_strip (GstTagLibMuxPriv * mux)
+{
+  if (mux->strip_head) {
+    gst_buffer_unref (mux->strip_head);
+    mux->strip_head = NULL;
+  }
+  if (mux->strip_tail) {
+    gst_buffer_unref (mux->strip_tail);
+    mux->strip_tail = NULL;
+  }
+  mux->strip_size = 0;
+  mux->strip_done = FALSE;
+  mux->strip_position = 0;
+  mux->strip_end = -1;
+}
+
+/* Merges the tags of an ID3 tag found in the stream with the tags received,
+ * the tags received win. Takes ownership of the tags. */
+static void
+gst_tag_lib_mux_priv_add_existing_tags (GstTagLibMuxPriv * mux,
+    GstTagList * tags, const gchar * version)
+{
+  if (tags == NULL) {
+    GST_WARNING_OBJECT (mux, "can't parse the %s tag of the stream", version);
+    return;
+  }
+
+  if (gst_debug_category_get_threshold (GST_CAT_DEFAULT) >= GST_LEVEL_INFO)
+    GST_INFO_OBJECT (mux, "found an %s tag: %" GST_PTR_FORMAT, version, tags);
+  if (mux->event_tags != NULL) {
+    gst_tag_list_insert (mux->event_tags, tags, GST_TAG_MERGE_KEEP);
+    gst_tag_list_free (tags);
+  } else {
+    mux->event_tags = tags;
+  }
+
+  if (mux->render_tag || mux->tag_reserve != 0)
+    gst_tag_lib_mux_priv_prepare_tags (mux);
+}
+
+/* Returns a sub-buffer of the bytes of a buffer from the given position, its
+ * offset follows the one of the buffer. Takes ownership of the buffer. */
+static GstBuffer *
+gst_tag_lib_mux_priv_split (GstBuffer * buffer, guint position)
+{
+  GstBuffer *rest;
+
+  rest = gst_buffer_create_sub (buffer, position,
+      GST_BUFFER_SIZE (buffer) - position);
+  if (GST_BUFFER_OFFSET (buffer) != GST_BUFFER_OFFSET_NONE)
+    GST_BUFFER_OFFSET (rest) = GST_BUFFER_OFFSET (buffer) + position;
+  else
+    GST_BUFFER_OFFSET (rest) = GST_BUFFER_OFFSET_NONE;
+  gst_buffer_unref (buffer);
+
+  return rest;
+}
+
+/* Holds back the bytes of the stream from where an ID3v1 tag would start,
+ * they're only known to be a tag at EOS. Returns the audio in front of them,
+ * NULL if there's none. Takes ownership of the buffer. */
+static GstBuffer *
+gst_tag_lib_mux_priv_strip_tail (GstTagLibMuxPriv * mux, GstBuffer * buffer,
+    guint64 position)
+{
+  GstBuffer *tail;
+  guint kept;
+
+  if (mux->strip_end < 0
+      || position + GST_BUFFER_SIZE (buffer) <= (guint64) mux->strip_end)
+    return buffer;
+
+  kept = position < (guint64) mux->strip_end ? mux->strip_end - position : 0;
+  if (kept == 0) {
+    tail = buffer;
+    buffer = NULL;
+  } else {
+    tail = gst_buffer_create_sub (buffer, kept, GST_BUFFER_SIZE (buffer) - kept);
+    buffer = gst_buffer_make_metadata_writable (buffer);
+    GST_BUFFER_SIZE (buffer) = kept;
+  }
+
+  mux->strip_tail = mux->strip_tail != NULL
+      ? gst_buffer_join (mux->strip_tail, tail) : tail;
+
+  return buffer;
+}
+
+/* Drops the ID3 tags found in the stream with strip-existing. The leading
+ * ID3v2 tag is collected until it's complete and parsed, only its bytes are
+ * copied; the audio that follows it in the same buffer goes on as a
+ * sub-buffer and the buffers after it go through untouched. Returns the
+ * audio of the buffer, NULL if there's none. Takes ownership of the buffer. */
+static GstBuffer *
+gst_tag_lib_mux_priv_strip (GstTagLibMuxPriv * mux, GstBuffer * buffer)
+{
+  guint64 position;
+  guint held, needed, taken;
+  GstBuffer *head;
+  GstFormat format;
+  gint64 total;
+
+  position = mux->strip_position;
+  mux->strip_position += GST_BUFFER_SIZE (buffer);
+  if (mux->strip_done)
+    return gst_tag_lib_mux_priv_strip_tail (mux, buffer, position);
+
+  /* the size of the tag is in its header, usually in the first buffer */
+  if (mux->strip_head == NULL
+      && GST_BUFFER_SIZE (buffer) >= ID3V2_HEADER_SIZE)
+    mux->strip_size = gst_tag_get_id3v2_tag_size (buffer);
+
+  while (buffer != NULL && !mux->strip_done) {
+    held = mux->strip_head != NULL ? GST_BUFFER_SIZE (mux->strip_head) : 0;
+    if (held == 0 && mux->strip_size == 0
+        && GST_BUFFER_SIZE (buffer) >= ID3V2_HEADER_SIZE) {
+      GST_DEBUG_OBJECT (mux, "no ID3v2 tag at the start of the stream");
+      mux->strip_done = TRUE;
+      break;
+    }
+
+    needed = mux->strip_size != 0 ? mux->strip_size : ID3V2_HEADER_SIZE;
+    taken = MIN (needed - held, GST_BUFFER_SIZE (buffer));
+    head = gst_buffer_create_sub (buffer, 0, taken);
+    mux->strip_head = mux->strip_head != NULL
+        ? gst_buffer_join (mux->strip_head, head) : head;
+    position += taken;
+    if (taken == GST_BUFFER_SIZE (buffer)) {
+      gst_buffer_unref (buffer);
+      buffer = NULL;
+    } else {
+      buffer = gst_tag_lib_mux_priv_split (buffer, taken);
+    }
+    if (GST_BUFFER_SIZE (mux->strip_head) < needed)
+      break;
+
+    if (mux->strip_size == 0) {
+      /* the header was split, now it's complete */
+      mux->strip_size = gst_tag_get_id3v2_tag_size (mux->strip_head);
+      if (mux->strip_size == 0) {
+        /* the bytes held are audio, this only happens with tiny buffers;
+         * they go back in front of the buffer and so does its position */
+        GST_DEBUG_OBJECT (mux, "no ID3v2 tag at the start of the stream");
+        mux->strip_done = TRUE;
+        position -= GST_BUFFER_SIZE (mux->strip_head);
+        buffer = buffer != NULL
+            ? gst_buffer_join (mux->strip_head, buffer) : mux->strip_head;
+        mux->strip_head = NULL;
+      }
+      continue;
+    }
+
+    GST_DEBUG_OBJECT (mux, "dropping the ID3v2 tag of %" G_GSIZE_FORMAT
+        " bytes at the start of the stream", mux->strip_size);
+    mux->stats.stripped_bytes += mux->strip_size;
+    mux->strip_done = TRUE;
+    gst_tag_lib_mux_priv_add_existing_tags (mux,
+        gst_tag_list_from_id3v2_tag (mux->strip_head), "ID3v2");
+    gst_buffer_unref (mux->strip_head);
+    mux->strip_head = NULL;
+  }
+
+  if (!mux->strip_done)
+    return buffer;
+
+  /* an ID3v1 tag can only be found at the end when the size is known */
+  format = GST_FORMAT_BYTES;
+  if (gst_pad_query_peer_duration (mux->sinkpad, &format, &total)
+      && format == GST_FORMAT_BYTES
+      && total >= (gint64) (mux->strip_size + ID3V1_TAG_SIZE)) {
+    mux->strip_end = total - ID3V1_TAG_SIZE;
+  } else {
+    GST_DEBUG_OBJECT (mux, "size of the stream unknown, ID3v1 tag kept");
+  }
+
+  if (buffer == NULL)
+    return NULL;
+
+  return gst_tag_lib_mux_priv_strip_tail (mux, buffer, position);
+}
+
+/* Called at EOS with strip-existing, drops the ID3v1 tag held back and
+ * returns the audio that was held back with it, NULL if there's none */
+static GstBuffer *
+gst_tag_lib_mux_priv_strip_eos (GstTagLibMuxPriv * mux)
+{
+  GstBuffer *buffer;
+
+  if (mux->strip_head != NULL) {
+    if (mux->strip_size != 0) {
+      GST_WARNING_OBJECT (mux, "dropping a truncated ID3v2 tag");
+      mux->stats.stripped_bytes += GST_BUFFER_SIZE (mux->strip_head);
+      gst_buffer_unref (mux->strip_head);
+      mux->strip_head = NULL;
+    } else {
+      /* the stream is shorter than a header */
+      buffer = mux->strip_head;
+      mux->strip_head = NULL;
+      return buffer;
+    }
+  }
+
+  buffer = mux->strip_tail;
+  mux->strip_tail = NULL;
+  if (buffer == NULL)
+    return NULL;
+
+  if (GST_BUFFER_SIZE (buffer) == ID3V1_TAG_SIZE
+      && memcmp (GST_BUFFER_DATA (buffer), "TAG", 3) == 0) {
+    GST_DEBUG_OBJECT (mux, "dropping the ID3v1 tag at the end of the stream");
+    mux->stats.stripped_bytes += ID3V1_TAG_SIZE;
+    /* without a placeholder (late-tags or scan-mpeg) the tag is already
+     * out and can't be written again, the tags of the ID3v1 tag are lost */
+    if (!mux->render_tag && mux->tag_reserve == 0)
+      GST_WARNING_OBJECT (mux, "the tags of the ID3v1 tag dropped can't be "
+          "added to the tag already written, set late-tags or scan-mpeg to "
+          "keep them");
+    gst_tag_lib_mux_priv_add_existing_tags (mux,
+        gst_tag_list_new_from_id3v1 (GST_BUFFER_DATA (buffer)), "ID3v1");
+    gst_buffer_unref (buffer);
+    return NULL;
+  }
+
+  return buffer;
+}
+
+/* Pushes a buffer of audio, the tag is pushed first if needed */
+static GstFlowReturn
+gst_tag_lib_mux_priv_push_audio (GstTagLibMuxPriv * mux, GstBuffer * buffer)
+{
   if (mux->render_tag) {
     GstFlowReturn ret;
-    GstBuffer *tag_buffer;
 
-    GST_INFO_OBJECT (mux, "Adding tags to stream");
-    tag_buffer = gst_tag_lib_mux_priv_render_tag (mux);
-    if (tag_buffer == NULL)
-      goto no_tag_buffer;
-    ret = gst_pad_push (mux->srcpad, tag_buffer);
+    ret = gst_tag_lib_mux_priv_start (mux);
     if (ret != GST_FLOW_OK) {
-      GST_DEBUG_OBJECT (mux, "flow: %s", gst_flow_get_name (ret));
       gst_buffer_unref (buffer);
       return ret;
     }
+  }
 
-    /* Now send the cached newsegment event that we got from upstream */
-    if (mux->newsegment_ev) {
-      GST_DEBUG_OBJECT (mux, "sending cached newsegment event");
-      gst_pad_push_event (mux->srcpad,
-          gst_tag_lib_mux_priv_adjust_event_offsets (mux, mux->newsegment_ev));
-      gst_event_unref (mux->newsegment_ev);
-      mux->newsegment_ev = NULL;
-    } else {
-      /* upstream sent no newsegment event or only one in a non-BYTE format */
-    }
+  buffer = gst_tag_lib_mux_priv_fixup_buffer (mux, buffer,
+      GST_PAD_CAPS (mux->srcpad));
+
+  if (mux->scan_mpeg)
+    id3v23_mpeg_scanner_push (&mux->scanner, GST_BUFFER_DATA (buffer),
+        GST_BUFFER_SIZE (buffer));
+
+  mux->stats.passthrough_buffers++;
+  mux->stats.passthrough_bytes += GST_BUFFER_SIZE (buffer);
+
+  return gst_pad_push (mux->srcpad, buffer);
+}
+
+static GstFlowReturn
+gst_tag_lib_mux_priv_chain (GstPad * pad, GstBuffer * buffer)
+{
+  GstTagLibMuxPriv *mux = GST_TAG_LIB_MUX (GST_OBJECT_PARENT (pad));
 
-    mux->render_tag = FALSE;
+  ID3V23_PROBE2 (chain, GST_BUFFER_SIZE (buffer), GST_BUFFER_OFFSET (buffer));
+
+  /* the tags of the leading ID3v2 tag have to be known before ours is
+   * rendered */
+  if (mux->strip_existing) {
+    buffer = gst_tag_lib_mux_priv_strip (mux, buffer);
+    if (buffer == NULL)
+      return GST_FLOW_OK;
   }
 
-  buffer = gst_buffer_make_metadata_writable (buffer);
+  return gst_tag_lib_mux_priv_push_audio (mux, buffer);
+}
 
-  if (GST_BUFFER_OFFSET (buffer) != GST_BUFFER_OFFSET_NONE) {
-    GST_LOG_OBJECT (mux, "Adjusting buffer offset from %" G_GINT64_FORMAT
-        " to %" G_GINT64_FORMAT, GST_BUFFER_OFFSET (buffer),
-        GST_BUFFER_OFFSET (buffer) + mux->tag_size);
-    GST_BUFFER_OFFSET (buffer) += mux->tag_size;
+static GstBufferListItem
+gst_tag_lib_mux_priv_fixup_list_item (GstBuffer ** buffer, guint group,
+    guint idx, gpointer user_data)
+{
+  GstTagLibMuxPriv *mux = GST_TAG_LIB_MUX (user_data);
+
+  *buffer = gst_tag_lib_mux_priv_fixup_buffer (mux, *buffer,
+      GST_PAD_CAPS (mux->srcpad));
+
+  if (mux->scan_mpeg)
+    id3v23_mpeg_scanner_push (&mux->scanner, GST_BUFFER_DATA (*buffer),
+        GST_BUFFER_SIZE (*buffer));
+
+  mux->stats.passthrough_buffers++;
+  mux->stats.passthrough_bytes += GST_BUFFER_SIZE (*buffer);
+
+  return GST_BUFFER_LIST_CONTINUE;
+}
+
+static GstBufferListItem
+gst_tag_lib_mux_priv_list_size_item (GstBuffer ** buffer, guint group,
+    guint idx, gpointer user_data)
+{
+  *(guint64 *) user_data += GST_BUFFER_SIZE (*buffer);
+
+  return GST_BUFFER_LIST_CONTINUE;
+}
+
+/* Tells if a list goes through strip-existing untouched: the leading tag
+ * is gone and the list ends before where an ID3v1 tag would start. The
+ * position of the stripping then moves past the list. */
+static gboolean
+gst_tag_lib_mux_priv_strip_passes (GstTagLibMuxPriv * mux,
+    GstBufferList * list)
+{
+  guint64 size;
+
+  if (!mux->strip_done)
+    return FALSE;
+
+  size = 0;
+  gst_buffer_list_foreach (list, gst_tag_lib_mux_priv_list_size_item, &size);
+  if (mux->strip_end >= 0
+      && mux->strip_position + size > (guint64) mux->strip_end)
+    return FALSE;
+
+  mux->strip_position += size;
+  return TRUE;
+}
+
+/* Pushes the buffers of a list one after the other through the stripping.
+ * The buffers are only referenced, the groups aren't merged as this would
+ * copy the audio. Takes ownership of the list. */
+static GstFlowReturn
+gst_tag_lib_mux_priv_chain_groups (GstTagLibMuxPriv * mux,
+    GstBufferList * list)
+{
+  GstBufferListIterator *it;
+  GstBuffer *buffer;
+  GstFlowReturn ret;
+
+  ret = GST_FLOW_OK;
+  it = gst_buffer_list_iterate (list);
+  while (ret == GST_FLOW_OK && gst_buffer_list_iterator_next_group (it)) {
+    while (ret == GST_FLOW_OK
+        && (buffer = gst_buffer_list_iterator_next (it)) != NULL) {
+      buffer = gst_tag_lib_mux_priv_strip (mux, gst_buffer_ref (buffer));
+      if (buffer != NULL)
+        ret = gst_tag_lib_mux_priv_push_audio (mux, buffer);
+    }
   }
+  gst_buffer_list_iterator_free (it);
+  gst_buffer_list_unref (list);
 
-  gst_buffer_set_caps (buffer, GST_PAD_CAPS (mux->srcpad));
-  return gst_pad_push (mux->srcpad, buffer);
+  return ret;
+}
 
-/* ERRORS */
-no_tag_buffer:
-  {
-    /* Doesn't compile in some Linux distributions (Fedora 9, Debian Lenny) when
-		 * using -Werror.
-    GST_ELEMENT_ERROR (mux, LIBRARY, ENCODE, (NULL), (NULL));
-		*/
-    GST_ERROR_OBJECT (mux, "Got an error, no tags in buffer?");
-    return GST_FLOW_ERROR;
+/* Passes a whole list of buffers in a single push. The list is fixed up in
+ * place, so it's only copied when upstream still holds a reference to it. */
+static GstFlowReturn
+gst_tag_lib_mux_priv_chain_list (GstPad * pad, GstBufferList * list)
+{
+  GstTagLibMuxPriv *mux = GST_TAG_LIB_MUX (GST_OBJECT_PARENT (pad));
+
+  ID3V23_PROBE1 (chain__list, gst_buffer_list_n_groups (list));
+
+  /* the ID3 tags can start or end anywhere in the list, the buffers around
+   * them go through the stripping one by one; past the leading tag the list
+   * is pushed as it is */
+  if (mux->strip_existing && !gst_tag_lib_mux_priv_strip_passes (mux, list))
+    return gst_tag_lib_mux_priv_chain_groups (mux, list);
+
+  if (mux->render_tag) {
+    GstFlowReturn ret;
+
+    ret = gst_tag_lib_mux_priv_start (mux);
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_list_unref (list);
+      return ret;
+    }
   }
+
+  list = gst_buffer_list_make_writable (list);
+  gst_buffer_list_foreach (list, gst_tag_lib_mux_priv_fixup_list_item, mux);
+
+  return gst_pad_push_list (mux->srcpad, list);
 }
 
 static gboolean
@@ -290,13 +1229,16 @@ gst_tag_lib_mux_priv_sink_event (GstPad * pad, GstEvent * event)
   mux = GST_TAG_LIB_MUX (gst_pad_get_parent (pad));
   result = FALSE;
 
+  ID3V23_PROBE1 (sink__event, GST_EVENT_TYPE (event));
+
   switch (GST_EVENT_TYPE (event)) {
     case GST_EVENT_TAG:{
       GstTagList *tags;
 
       gst_event_parse_tag (event, &tags);
 
-      GST_INFO_OBJECT (mux, "Got tag event: %" GST_PTR_FORMAT, tags);
+      if (gst_debug_category_get_threshold (GST_CAT_DEFAULT) >= GST_LEVEL_INFO)
+        GST_INFO_OBJECT (mux, "Got tag event: %" GST_PTR_FORMAT, tags);
 
       if (mux->event_tags != NULL) {
         gst_tag_list_insert (mux->event_tags, tags, GST_TAG_MERGE_REPLACE);
@@ -304,8 +1246,14 @@ gst_tag_lib_mux_priv_sink_event (GstPad * pad, GstEvent * event)
         mux->event_tags = gst_tag_list_copy (tags);
       }
 
-      GST_INFO_OBJECT (mux, "Event tags are now: %" GST_PTR_FORMAT,
-          mux->event_tags);
+      if (gst_debug_category_get_threshold (GST_CAT_DEFAULT) >= GST_LEVEL_INFO)
+        GST_INFO_OBJECT (mux, "Event tags are now: %" GST_PTR_FORMAT,
+            mux->event_tags);
+
+      /* encode the tags while there's no data to push yet, or before EOS
+       * when the tag is rewritten at the end */
+      if (mux->render_tag || mux->tag_reserve != 0)
+        gst_tag_lib_mux_priv_prepare_tags (mux);
 
       /* just drop the event, we'll push a new tag event in render_tag */
       gst_event_unref (event);
@@ -337,16 +1285,70 @@ gst_tag_lib_mux_priv_sink_event (GstPad * pad, GstEvent * event)
 
         GST_LOG_OBJECT (mux, "caching newsegment event for later");
         mux->newsegment_ev = event;
+
+        /* in the late-tags mode the placeholder goes out right away, the
+         * tags received from now on are written at EOS (so is the duration
+         * found by the scan of the MPEG frames) */
+        if ((mux->late_tags || mux->scan_mpeg) && mux->reserved_size > 0
+            && gst_tag_lib_mux_priv_peer_seekable (mux)) {
+          GST_DEBUG_OBJECT (mux, "pushing a placeholder of %u bytes",
+              mux->reserved_size);
+          mux->tag_reserve = mux->reserved_size;
+          if (gst_tag_lib_mux_priv_start (mux) != GST_FLOW_OK)
+            break;
+        }
       } else {
+        GstEvent *adjusted;
+        gint64 resend, stop;
+
+        GST_OBJECT_LOCK (mux);
+        resend = mux->tag_resend;
+        mux->tag_resend = -1;
+        GST_OBJECT_UNLOCK (mux);
+
         GST_DEBUG_OBJECT (mux, "got newsegment event, adjusting offsets");
-        gst_pad_push_event (mux->srcpad,
-            gst_tag_lib_mux_priv_adjust_event_offsets (mux, event));
+        adjusted = gst_tag_lib_mux_priv_adjust_event_offsets (mux, event);
         gst_event_unref (event);
+
+        /* a seek landed in the tag, the segment starts in the tag and the
+         * end of the tag is pushed before the audio */
+        if (resend != -1) {
+          gst_event_parse_new_segment (adjusted, NULL, NULL, NULL, NULL,
+              &stop, NULL);
+          gst_event_unref (adjusted);
+          adjusted = gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_BYTES,
+              resend, stop, resend);
+        }
+        gst_pad_push_event (mux->srcpad, adjusted);
+        if (resend != -1)
+          gst_tag_lib_mux_priv_resend_tag (mux, resend);
       }
       event = NULL;
       result = TRUE;
       break;
     }
+    case GST_EVENT_EOS:{
+      if (mux->strip_existing) {
+        GstBuffer *buffer;
+
+        /* the audio held back with the ID3v1 tag goes out first */
+        buffer = gst_tag_lib_mux_priv_strip_eos (mux);
+        if (buffer != NULL)
+          gst_tag_lib_mux_priv_push_audio (mux, buffer);
+      }
+
+      if (mux->scan_mpeg)
+        gst_tag_lib_mux_priv_add_duration (mux);
+
+      if (mux->tag_reserve != 0 && !mux->render_tag)
+        gst_tag_lib_mux_priv_rewrite_tag (mux);
+
+      if (mux->post_stats)
+        gst_tag_lib_mux_priv_post_stats (mux);
+
+      result = gst_pad_event_default (pad, event);
+      break;
+    }
     default:
       result = gst_pad_event_default (pad, event);
       break;
@@ -357,6 +1359,201 @@ gst_tag_lib_mux_priv_sink_event (GstPad * pad, GstEvent * event)
   return result;
 }
 
+/* Moves a seek in bytes from the output into the input. A seek that lands in
+ * the tag makes upstream seek to the start of the audio, the end of the tag
+ * is pushed again from the cached tag once upstream is there. Takes
+ * ownership of the event, returns NULL when the seek can't be done. */
+static GstEvent *
+gst_tag_lib_mux_priv_adjust_seek (GstTagLibMuxPriv * mux, GstEvent * event)
+{
+  GstSeekType start_type, stop_type;
+  GstSeekFlags flags;
+  GstFormat format;
+  gdouble rate;
+  gint64 start, stop, resend;
+
+  gst_event_parse_seek (event, &rate, &format, &flags, &start_type, &start,
+      &stop_type, &stop);
+  if (format != GST_FORMAT_BYTES)
+    return event;
+
+  /* the size of the tag isn't known before it's rendered */
+  if (mux->render_tag) {
+    GST_DEBUG_OBJECT (mux, "can't seek in bytes before the tag is out");
+    gst_event_unref (event);
+    return NULL;
+  }
+
+  resend = -1;
+  if (start_type == GST_SEEK_TYPE_SET) {
+    if (start >= 0 && start < (gint64) mux->tag_size)
+      resend = start;
+    start = gst_tag_lib_mux_priv_to_input (mux, start);
+  }
+  if (stop_type == GST_SEEK_TYPE_SET)
+    stop = gst_tag_lib_mux_priv_to_input (mux, stop);
+
+  GST_DEBUG_OBJECT (mux, "seeking upstream to %" G_GINT64_FORMAT
+      " (tag pushed again from %" G_GINT64_FORMAT ")", start, resend);
+
+  GST_OBJECT_LOCK (mux);
+  mux->tag_resend = resend;
+  GST_OBJECT_UNLOCK (mux);
+
+  gst_event_unref (event);
+  return gst_event_new_seek (rate, format, flags, start_type, start,
+      stop_type, stop);
+}
+
+static gboolean
+gst_tag_lib_mux_priv_src_event (GstPad * pad, GstEvent * event)
+{
+  GstTagLibMuxPriv *mux;
+  gboolean result;
+
+  mux = GST_TAG_LIB_MUX (gst_pad_get_parent (pad));
+  if (mux == NULL) {
+    gst_event_unref (event);
+    return FALSE;
+  }
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_SEEK) {
+    event = gst_tag_lib_mux_priv_adjust_seek (mux, event);
+    if (event == NULL) {
+      gst_object_unref (mux);
+      return FALSE;
+    }
+  }
+
+  result = gst_pad_event_default (pad, event);
+
+  /* no newsegment comes when upstream refused the seek */
+  if (!result) {
+    GST_OBJECT_LOCK (mux);
+    mux->tag_resend = -1;
+    GST_OBJECT_UNLOCK (mux);
+  }
+
+  gst_object_unref (mux);
+
+  return result;
+}
+
+/* Asks a query in bytes to the peer of the given pad and moves its answer
+ * from the coordinates of one side of the element to the other */
+static gboolean
+gst_tag_lib_mux_priv_bytes_query (GstTagLibMuxPriv * mux, GstPad * peer_of,
+    GstQuery * query, gboolean to_output)
+{
+  gint64 (*convert) (GstTagLibMuxPriv *, gint64);
+  GstFormat format;
+  gboolean seekable;
+  gint64 value, start, end;
+
+  /* the size of the tag isn't known before it's rendered */
+  if (mux->render_tag)
+    return FALSE;
+
+  if (!gst_pad_peer_query (peer_of, query))
+    return FALSE;
+
+  convert = to_output
+      ? gst_tag_lib_mux_priv_to_output : gst_tag_lib_mux_priv_to_input;
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_POSITION:
+      gst_query_parse_position (query, &format, &value);
+      gst_query_set_position (query, format, convert (mux, value));
+      break;
+    case GST_QUERY_DURATION:
+      gst_query_parse_duration (query, &format, &value);
+      gst_query_set_duration (query, format, convert (mux, value));
+      break;
+    case GST_QUERY_SEEKING:
+      /* the tag can be sought in too, it's served from the cached tag */
+      gst_query_parse_seeking (query, &format, &seekable, &start, &end);
+      if (to_output && start <= (gint64) mux->strip_size)
+        start = 0;
+      else
+        start = convert (mux, start);
+      gst_query_set_seeking (query, format, seekable, start,
+          convert (mux, end));
+      break;
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+/* Returns the format of a position, duration or seeking query, the format
+ * is undefined for the other queries */
+static GstFormat
+gst_tag_lib_mux_priv_query_format (GstQuery * query)
+{
+  GstFormat format;
+
+  format = GST_FORMAT_UNDEFINED;
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_POSITION:
+      gst_query_parse_position (query, &format, NULL);
+      break;
+    case GST_QUERY_DURATION:
+      gst_query_parse_duration (query, &format, NULL);
+      break;
+    case GST_QUERY_SEEKING:
+      gst_query_parse_seeking (query, &format, NULL, NULL, NULL);
+      break;
+    default:
+      break;
+  }
+
+  return format;
+}
+
+/* The queries in bytes asked by downstream are answered by upstream, the
+ * answer is moved behind the tag */
+static gboolean
+gst_tag_lib_mux_priv_src_query (GstPad * pad, GstQuery * query)
+{
+  GstTagLibMuxPriv *mux;
+  gboolean result;
+
+  mux = GST_TAG_LIB_MUX (gst_pad_get_parent (pad));
+  if (mux == NULL)
+    return FALSE;
+
+  if (gst_tag_lib_mux_priv_query_format (query) == GST_FORMAT_BYTES)
+    result = gst_tag_lib_mux_priv_bytes_query (mux, mux->sinkpad, query, TRUE);
+  else
+    result = gst_pad_query_default (pad, query);
+
+  gst_object_unref (mux);
+
+  return result;
+}
+
+/* The queries in bytes asked by upstream are answered by downstream, the
+ * answer is moved in front of the tag */
+static gboolean
+gst_tag_lib_mux_priv_sink_query (GstPad * pad, GstQuery * query)
+{
+  GstTagLibMuxPriv *mux;
+  gboolean result;
+
+  mux = GST_TAG_LIB_MUX (gst_pad_get_parent (pad));
+  if (mux == NULL)
+    return FALSE;
+
+  if (gst_tag_lib_mux_priv_query_format (query) == GST_FORMAT_BYTES)
+    result = gst_tag_lib_mux_priv_bytes_query (mux, mux->srcpad, query, FALSE);
+  else
+    result = gst_pad_query_default (pad, query);
+
+  gst_object_unref (mux);
+
+  return result;
+}
+
 
 static GstStateChangeReturn
 gst_tag_lib_mux_priv_change_state (GstElement * element, GstStateChange transition)
@@ -366,12 +1563,24 @@ gst_tag_lib_mux_priv_change_state (GstElement * element, GstStateChange transiti
 
   mux = GST_TAG_LIB_MUX (element);
 
+  /* the tags set on the element are encoded before the pads get activated,
+   * the streaming thread isn't running yet */
+  if (transition == GST_STATE_CHANGE_READY_TO_PAUSED)
+    gst_tag_lib_mux_priv_prepare_tags (mux);
+
   result = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
   if (result != GST_STATE_CHANGE_SUCCESS) {
     return result;
   }
 
   switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:{
+      gst_tag_lib_mux_priv_reset_stats (mux);
+      gst_tag_lib_mux_priv_reset_strip (mux);
+      id3v23_mpeg_scanner_init (&mux->scanner);
+      mux->start_time = gst_util_get_timestamp ();
+      break;
+    }
     case GST_STATE_CHANGE_PAUSED_TO_READY:{
       if (mux->newsegment_ev) {
         gst_event_unref (mux->newsegment_ev);
@@ -381,7 +1590,16 @@ gst_tag_lib_mux_priv_change_state (GstElement * element, GstStateChange transiti
         gst_tag_list_free (mux->event_tags);
         mux->event_tags = NULL;
       }
+      gst_tag_lib_mux_priv_reset_strip (mux);
+      GST_OBJECT_LOCK (mux);
+      if (mux->tag_list) {
+        gst_buffer_list_unref (mux->tag_list);
+        mux->tag_list = NULL;
+      }
+      mux->tag_resend = -1;
+      GST_OBJECT_UNLOCK (mux);
       mux->tag_size = 0;
+      mux->tag_reserve = 0;
       mux->render_tag = TRUE;
       break;
     }
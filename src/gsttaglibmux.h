@@ -23,10 +23,28 @@
 
 #include <gst/gst.h>
 
+#include "id3v23mpeg.h"
+
 G_BEGIN_DECLS
 
 typedef struct _GstTagLibMuxPriv GstTagLibMuxPriv;
 typedef struct _GstTagLibMuxPrivClass GstTagLibMuxPrivClass;
+typedef struct _GstTagLibMuxStats GstTagLibMuxStats;
+
+/* Statistics of the stream, exposed as read-only properties. They are only
+ * updated by the streaming thread. */
+struct _GstTagLibMuxStats {
+  GstClockTime  render_time;          /* time spent rendering the tag */
+  guint64       tag_bytes;            /* size of the tag, padding included */
+  guint         frames;               /* frames in the tag (set by subclass) */
+  guint64       image_bytes;          /* bytes of pictures (set by subclass) */
+  guint64       passthrough_buffers;  /* buffers pushed after the tag */
+  guint64       passthrough_bytes;    /* bytes pushed after the tag */
+  GstClockTime  time_to_first_buffer; /* from READY to PAUSED to the tag */
+  GstClockTime  duration;             /* duration of the MPEG audio frames */
+  guint64       mpeg_frames;          /* MPEG audio frames passed through */
+  guint64       stripped_bytes;       /* bytes of ID3 tags dropped */
+};
 
 /* Definition of structure storing data for this element. */
 struct _GstTagLibMuxPriv {
@@ -39,6 +57,35 @@ struct _GstTagLibMuxPriv {
   gboolean      render_tag;
 
   GstEvent     *newsegment_ev; /* cached newsegment event from upstream */
+
+  GstBufferList *tag_list;   /* the tag pushed, the seeks that land in it are
+                              * served from it (protected by the object lock) */
+  gint64        tag_resend;  /* when not -1, the byte of the tag from which
+                              * it's pushed again after the seek in progress
+                              * (protected by the object lock) */
+
+  gboolean      late_tags;     /* push a placeholder, rewrite it at EOS */
+  guint         reserved_size; /* size of the placeholder */
+  gsize         tag_reserve;   /* when not 0, the size that the rendered tag
+                                * has to fill exactly (set by the base class,
+                                * honoured by the subclass) */
+
+  gboolean      scan_mpeg;   /* follow the MPEG audio frames passed through */
+  Id3v23MpegScanner scanner; /* and write their duration in the tag at EOS */
+
+  gboolean      strip_existing; /* drop the ID3 tags found in the stream */
+  GstBuffer    *strip_head;     /* the leading ID3v2 tag received so far */
+  gsize         strip_size;     /* size of the leading tag, 0 when unknown
+                                 * or when there's none */
+  gboolean      strip_done;     /* the leading tag is dropped (or absent) */
+  guint64       strip_position; /* bytes received */
+  gint64        strip_end;      /* where an ID3v1 tag would start, -1 when
+                                 * the size of the stream is unknown */
+  GstBuffer    *strip_tail;     /* the bytes received from strip_end on */
+
+  gboolean      post_stats;  /* post the statistics at EOS */
+  GstClockTime  start_time;  /* when the element went from READY to PAUSED */
+  GstTagLibMuxStats stats;
 };
 
 /* Standard definition defining a class for this element. */
@@ -47,6 +94,15 @@ struct _GstTagLibMuxPrivClass {
 
   /* vfuncs */
   GstBuffer  * (*render_tag) (GstTagLibMuxPriv * mux, GstTagList * tag_list);
+
+  /* optional, renders the tag as a sequence of buffers (one per group), it's
+   * used instead of render_tag when implemented */
+  GstBufferList * (*render_tag_list) (GstTagLibMuxPriv * mux,
+      GstTagList * tag_list);
+
+  /* optional, called with the tags known so far each time they change before
+   * the tag is rendered, lets the subclass encode them ahead of time */
+  void (*prepare_tags) (GstTagLibMuxPriv * mux, const GstTagList * tag_list);
 };
 
 /* Standard macros for defining types for this element.  */
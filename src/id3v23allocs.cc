@@ -0,0 +1,532 @@
+/* Allocation accounting of the element id3v23mux
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// Counts the allocations done by the element id3v23mux, in order to prove
+// that once the tag is out the buffers pass through without allocating and
+// to catch the regressions, which only show up at scale as jitter.
+//
+// The program replaces malloc(), calloc(), realloc() and the operator new
+// (GLib allocates through malloc(), GSlice is disabled) and wraps
+// gst_mini_object_new() to count the buffers and events created. Only the
+// allocations of the main thread are counted, while it drives the element: a
+// source pad and a sink pad owned by the program are linked to the element
+// and everything happens synchronously in gst_pad_push().
+//
+// It reports the allocations of the first buffer (which renders the tag), of
+// gst_id3v23_mux_render_tags(), and of each buffer passed through by the
+// chain and the chain_list functions. It fails when the buffers passed
+// through allocate more than the budget.
+//
+// Usage:
+//   id3v23allocs [--buffers=N] [--buffer-size=BYTES] [--budget=ALLOCS] [--id3lib]
+//
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "gstid3v23mux.h"
+
+#include <dlfcn.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gst/tag/tag.h>
+
+
+// Default number of buffers passed through
+#define ALLOCS_BUFFERS      10000
+
+// Default size of the buffers, a frame of a 128 kbps MP3
+#define ALLOCS_BUFFER_SIZE  418
+
+// Default number of tags rendered through gst_id3v23_mux_render_tags()
+#define ALLOCS_RENDERS      100
+
+// Number of buffers in each buffer list
+#define ALLOCS_LIST_SIZE    16
+
+
+// The allocations counted
+typedef struct _AllocCounts AllocCounts;
+struct _AllocCounts {
+	guint64 mallocs;       // malloc(), calloc() and realloc(), GLib included
+	guint64 news;          // operator new
+	guint64 mini_objects;  // buffers, events, messages...
+	guint64 buffers;       // buffers only
+};
+
+
+static gint opt_buffers = ALLOCS_BUFFERS;
+static gint opt_buffer_size = ALLOCS_BUFFER_SIZE;
+static gint opt_renders = ALLOCS_RENDERS;
+static gdouble opt_budget = 0.0;
+static gboolean opt_id3lib = FALSE;
+
+static GOptionEntry entries [] = {
+	{"buffers", 'b', 0, G_OPTION_ARG_INT, &opt_buffers, "Number of buffers passed through", "N"},
+	{"buffer-size", 's', 0, G_OPTION_ARG_INT, &opt_buffer_size, "Size of the buffers passed through", "BYTES"},
+	{"renders", 'r', 0, G_OPTION_ARG_INT, &opt_renders, "Number of tags rendered", "N"},
+	{"budget", 'B', 0, G_OPTION_ARG_DOUBLE, &opt_budget, "Allocations allowed per buffer passed through (default: 0)", "ALLOCS"},
+	{"id3lib", 0, 0, G_OPTION_ARG_NONE, &opt_id3lib, "Render the tags with id3lib (needs ID3LIB=1)", NULL},
+	{NULL}
+};
+
+
+// The counters, only the allocations of the thread that sets the flag are
+// counted
+static __thread gboolean allocs_counting = FALSE;
+static AllocCounts allocs_counts;
+
+// The buffers received by the sink pad
+static guint64 allocs_received = 0;
+
+
+extern "C" {
+	void *__libc_malloc (size_t size);
+	void *__libc_calloc (size_t blocks, size_t size);
+	void *__libc_realloc (void *mem, size_t size);
+}
+
+
+static void allocs_start (void);
+
+static void allocs_stop (
+	AllocCounts *counts
+);
+
+static GstTagList* allocs_tags (void);
+
+static GstBuffer* allocs_buffer_new (
+	guint64 offset
+);
+
+static GstFlowReturn allocs_sink_chain (
+	GstPad    *pad,
+	GstBuffer *buffer
+);
+
+static GstFlowReturn allocs_sink_chain_list (
+	GstPad        *pad,
+	GstBufferList *list
+);
+
+static gboolean allocs_sink_event (
+	GstPad   *pad,
+	GstEvent *event
+);
+
+static void allocs_report (
+	const gchar       *name,
+	const AllocCounts *counts,
+	guint64           ops
+);
+
+static gdouble allocs_per_op (
+	const AllocCounts *counts,
+	guint64           ops
+);
+
+
+
+
+int main (int argc, char **argv) {
+
+	g_setenv("G_SLICE", "always-malloc", TRUE);
+
+	GError *error = NULL;
+	GOptionContext *context = g_option_context_new("- count the allocations of the element id3v23mux");
+	g_option_context_add_main_entries(context, entries, NULL);
+	g_option_context_add_group(context, gst_init_get_option_group());
+	if (! g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (opt_buffers <= 0 || opt_buffer_size <= 0 || opt_renders <= 0) {
+		g_printerr("The numbers of buffers and renders and the buffer size must be positive\n");
+		return 1;
+	}
+
+	// The element is registered without loading the plugin
+	if (! gst_id3v23_mux_plugin_init(NULL)) {
+		g_printerr("Can't register the element %s\n", PLUGIN);
+		return 1;
+	}
+
+	GstElement *mux = gst_element_factory_make(PLUGIN, "mux");
+#ifdef HAVE_ID3LIB
+	g_object_set(mux, "id3lib", opt_id3lib, NULL);
+#else
+	if (opt_id3lib) {
+		g_printerr("The element was built without id3lib (ID3LIB=1)\n");
+		return 1;
+	}
+#endif
+
+	GstTagList *tags = allocs_tags();
+	gst_tag_setter_merge_tags(GST_TAG_SETTER(mux), tags, GST_TAG_MERGE_REPLACE);
+
+	// The pads driving the element
+	GstPad *src = gst_pad_new("src", GST_PAD_SRC);
+	GstPad *sink = gst_pad_new("sink", GST_PAD_SINK);
+	gst_pad_set_chain_function(sink, allocs_sink_chain);
+	gst_pad_set_chain_list_function(sink, allocs_sink_chain_list);
+	gst_pad_set_event_function(sink, allocs_sink_event);
+
+	GstPad *mux_sink = gst_element_get_static_pad(mux, "sink");
+	GstPad *mux_src = gst_element_get_static_pad(mux, "src");
+	gst_pad_link(src, mux_sink);
+	gst_pad_link(mux_src, sink);
+	gst_object_unref(mux_sink);
+	gst_object_unref(mux_src);
+
+	gst_pad_set_active(src, TRUE);
+	gst_pad_set_active(sink, TRUE);
+	gst_element_set_state(mux, GST_STATE_PAUSED);
+	gst_pad_push_event(src, gst_event_new_new_segment(FALSE, 1.0, GST_FORMAT_BYTES, 0, -1, 0));
+
+	// The buffers are allocated beforehand, each is owned by the element
+	// once pushed
+	guint lists = (opt_buffers + ALLOCS_LIST_SIZE - 1) / ALLOCS_LIST_SIZE;
+	GstBuffer *first = allocs_buffer_new(0);
+	GPtrArray *buffers = g_ptr_array_sized_new(opt_buffers);
+	GPtrArray *buffer_lists = g_ptr_array_sized_new(lists);
+	guint64 offset = opt_buffer_size;
+	for (gint i = 0; i < opt_buffers; ++i, offset += opt_buffer_size) {
+		g_ptr_array_add(buffers, allocs_buffer_new(offset));
+	}
+	for (guint i = 0; i < lists; ++i) {
+		GstBufferList *list = gst_buffer_list_new();
+		GstBufferListIterator *it = gst_buffer_list_iterate(list);
+		gst_buffer_list_iterator_add_group(it);
+		for (guint j = 0; j < ALLOCS_LIST_SIZE; ++j, offset += opt_buffer_size) {
+			gst_buffer_list_iterator_add(it, allocs_buffer_new(offset));
+		}
+		gst_buffer_list_iterator_free(it);
+		g_ptr_array_add(buffer_lists, list);
+	}
+
+	// The first buffer renders the tag
+	AllocCounts first_counts;
+	allocs_start();
+	gst_pad_push(src, first);
+	allocs_stop(&first_counts);
+
+	// The buffers that follow are only passed through
+	AllocCounts chain_counts;
+	allocs_received = 0;
+	allocs_start();
+	for (guint i = 0; i < buffers->len; ++i) {
+		gst_pad_push(src, (GstBuffer *) g_ptr_array_index(buffers, i));
+	}
+	allocs_stop(&chain_counts);
+	guint64 chain_buffers = allocs_received;
+
+	AllocCounts chain_list_counts;
+	allocs_received = 0;
+	allocs_start();
+	for (guint i = 0; i < buffer_lists->len; ++i) {
+		gst_pad_push_list(src, (GstBufferList *) g_ptr_array_index(buffer_lists, i));
+	}
+	allocs_stop(&chain_list_counts);
+	guint64 chain_list_buffers = allocs_received;
+
+	g_ptr_array_free(buffers, TRUE);
+	g_ptr_array_free(buffer_lists, TRUE);
+
+	// The renderer alone, after a first render
+	gst_buffer_unref(gst_id3v23_mux_render_tags(tags, 0, 0));
+	AllocCounts render_counts;
+	allocs_start();
+	for (gint i = 0; i < opt_renders; ++i) {
+		gst_buffer_unref(gst_id3v23_mux_render_tags(tags, 0, 0));
+	}
+	allocs_stop(&render_counts);
+
+	gst_element_set_state(mux, GST_STATE_NULL);
+	gst_object_unref(mux);
+	gst_object_unref(src);
+	gst_object_unref(sink);
+	gst_tag_list_free(tags);
+
+	printf("%-24s %10s %10s %10s %10s %10s\n", "", "ops", "mallocs", "news", "objects", "buffers");
+	allocs_report("first buffer (render)", &first_counts, 1);
+	allocs_report("render_tags()", &render_counts, opt_renders);
+	allocs_report("chain (per buffer)", &chain_counts, chain_buffers);
+	allocs_report("chain_list (per buffer)", &chain_list_counts, chain_list_buffers);
+
+	if (chain_buffers != (guint64) opt_buffers || chain_list_buffers != (guint64) lists * ALLOCS_LIST_SIZE) {
+		printf("FAIL: buffers were lost (%" G_GUINT64_FORMAT " and %" G_GUINT64_FORMAT " received)\n", chain_buffers, chain_list_buffers);
+		return 1;
+	}
+
+	gdouble chain = allocs_per_op(&chain_counts, chain_buffers);
+	gdouble chain_list = allocs_per_op(&chain_list_counts, chain_list_buffers);
+	if (chain > opt_budget || chain_list > opt_budget) {
+		printf("FAIL: %.2f and %.2f allocations per buffer passed through, the budget is %.2f\n", chain, chain_list, opt_budget);
+		return 1;
+	}
+
+	printf("OK: %.2f and %.2f allocations per buffer passed through, the budget is %.2f\n", chain, chain_list, opt_budget);
+	return 0;
+}
+
+
+//
+// The allocators replacing the ones of the C library, they count the
+// allocations of the thread that counts.
+//
+extern "C" void *malloc (size_t size) {
+	if (allocs_counting) {++allocs_counts.mallocs;}
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc (size_t blocks, size_t size) {
+	if (allocs_counting) {++allocs_counts.mallocs;}
+	return __libc_calloc(blocks, size);
+}
+
+extern "C" void *realloc (void *mem, size_t size) {
+	if (allocs_counting) {++allocs_counts.mallocs;}
+	return __libc_realloc(mem, size);
+}
+
+void *operator new (size_t size) {
+	if (allocs_counting) {++allocs_counts.news;}
+	void *mem = __libc_malloc(size > 0 ? size : 1);
+	if (mem == NULL) {throw std::bad_alloc();}
+	return mem;
+}
+
+void *operator new[] (size_t size) {
+	return operator new(size);
+}
+
+void operator delete (void *mem) {
+	free(mem);
+}
+
+void operator delete[] (void *mem) {
+	free(mem);
+}
+
+
+//
+// Wraps the creation of the mini objects (buffers, events...), the real
+// function is found in libgstreamer.
+//
+GstMiniObject* gst_mini_object_new (GType type) {
+
+	typedef GstMiniObject* (*MiniObjectNew) (GType type);
+	static MiniObjectNew real_new = NULL;
+	if (real_new == NULL) {
+		gboolean counting = allocs_counting;
+		allocs_counting = FALSE;
+		real_new = (MiniObjectNew) dlsym(RTLD_NEXT, "gst_mini_object_new");
+		allocs_counting = counting;
+	}
+
+	if (allocs_counting) {
+		++allocs_counts.mini_objects;
+		if (type == GST_TYPE_BUFFER) {++allocs_counts.buffers;}
+	}
+
+	return real_new(type);
+}
+
+
+//
+// Starts counting the allocations of the current thread.
+//
+static void allocs_start (void) {
+	memset(&allocs_counts, 0, sizeof(allocs_counts));
+	allocs_counting = TRUE;
+}
+
+
+//
+// Stops counting the allocations.
+//
+// Parameters:
+//   counts: set to the allocations counted since allocs_start().
+//
+static void allocs_stop (
+	AllocCounts *counts
+) {
+	allocs_counting = FALSE;
+	*counts = allocs_counts;
+}
+
+
+//
+// Returns the tags of a typical track with a small cover.
+//
+static GstTagList* allocs_tags (void) {
+
+	GstTagList *tags = gst_tag_list_new();
+	GDate *date = g_date_new_dmy(21, G_DATE_MARCH, 1975);
+	gst_tag_list_add(
+		tags, GST_TAG_MERGE_REPLACE,
+		GST_TAG_TITLE, "Shine On You Crazy Diamond (Parts I-V)",
+		GST_TAG_ARTIST, "Pink Floyd",
+		GST_TAG_ALBUM, "Wish You Were Here",
+		GST_TAG_GENRE, "Progressive Rock",
+		GST_TAG_TRACK_NUMBER, 1,
+		GST_TAG_TRACK_COUNT, 5,
+		GST_TAG_ALBUM_VOLUME_NUMBER, 1,
+		GST_TAG_ALBUM_VOLUME_COUNT, 1,
+		GST_TAG_DATE, date,
+		NULL
+	);
+	g_date_free(date);
+
+	GstBuffer *image = gst_buffer_new_and_alloc(16 * 1024);
+	memset(GST_BUFFER_DATA(image), 0xA5, GST_BUFFER_SIZE(image));
+	GstCaps *caps = gst_caps_new_simple("image/jpeg", NULL);
+	gst_buffer_set_caps(image, caps);
+	gst_caps_unref(caps);
+	gst_tag_list_add(tags, GST_TAG_MERGE_APPEND, GST_TAG_IMAGE, image, NULL);
+	gst_buffer_unref(image);
+
+	return tags;
+}
+
+
+//
+// Returns a buffer as an MP3 encoder would push it, with its own caps and
+// its offset in the stream.
+//
+static GstBuffer* allocs_buffer_new (
+	guint64 offset
+) {
+
+	static GstCaps *caps = NULL;
+	if (caps == NULL) {
+		caps = gst_caps_new_simple("audio/mpeg", "mpegversion", G_TYPE_INT, 1, "layer", G_TYPE_INT, 3, NULL);
+	}
+
+	GstBuffer *buffer = gst_buffer_new_and_alloc(opt_buffer_size);
+	memset(GST_BUFFER_DATA(buffer), 0, GST_BUFFER_SIZE(buffer));
+	GST_BUFFER_OFFSET(buffer) = offset;
+	gst_buffer_set_caps(buffer, caps);
+
+	return buffer;
+}
+
+
+//
+// The sink pad drops what it receives and counts the buffers.
+//
+static GstFlowReturn allocs_sink_chain (
+	GstPad    *pad,
+	GstBuffer *buffer
+) {
+	++allocs_received;
+	gst_buffer_unref(buffer);
+	return GST_FLOW_OK;
+}
+
+static GstFlowReturn allocs_sink_chain_list (
+	GstPad        *pad,
+	GstBufferList *list
+) {
+	GstBufferListIterator *it = gst_buffer_list_iterate(list);
+	while (gst_buffer_list_iterator_next_group(it)) {
+		allocs_received += gst_buffer_list_iterator_n_buffers(it);
+	}
+	gst_buffer_list_iterator_free(it);
+	gst_buffer_list_unref(list);
+	return GST_FLOW_OK;
+}
+
+static gboolean allocs_sink_event (
+	GstPad   *pad,
+	GstEvent *event
+) {
+	gst_event_unref(event);
+	return TRUE;
+}
+
+
+//
+// Prints the allocations per operation.
+//
+static void allocs_report (
+	const gchar       *name,
+	const AllocCounts *counts,
+	guint64           ops
+) {
+
+	gdouble n = ops > 0 ? ops : 1;
+	printf(
+		"%-24s %10" G_GUINT64_FORMAT " %10.2f %10.2f %10.2f %10.2f\n",
+		name,
+		ops,
+		counts->mallocs / n,
+		counts->news / n,
+		counts->mini_objects / n,
+		counts->buffers / n
+	);
+}
+
+
+//
+// Returns the number of allocations per operation (malloc() and new, the
+// mini objects are allocated through malloc()).
+//
+static gdouble allocs_per_op (
+	const AllocCounts *counts,
+	guint64           ops
+) {
+	return ops > 0 ? (gdouble) (counts->mallocs + counts->news) / ops : 0.0;
+}
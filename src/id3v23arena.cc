@@ -0,0 +1,187 @@
+/* Scratch memory for the renders of the ID3v2.3 writer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+//
+// A bump allocator for the memory that only lives while a tag is rendered:
+// the frames, their texts and the strings converted for id3lib. Handing out
+// memory is a matter of moving a pointer and the memory is released all at
+// once when the tag is out.
+//
+// The arena owns a single block. When a render needs more than the block the
+// extra memory comes from chunks of the heap and, at the next reset, the
+// block is replaced by one big enough for that render. This way an element
+// that renders similar tags over and over ends up allocating nothing.
+//
+// An arena isn't thread safe, it belongs to a single element.
+//
+
+#include "id3v23arena.h"
+
+#include <string.h>
+
+// Alignment of the memory handed out
+#define ID3V23_ARENA_ALIGN       8
+
+// Smallest block allocated
+#define ID3V23_ARENA_MIN_SIZE    1024
+
+#define ID3V23_ARENA_ROUND(size) (((size) + ID3V23_ARENA_ALIGN - 1) & ~((gsize) ID3V23_ARENA_ALIGN - 1))
+
+
+
+
+//
+// Initializes an empty arena.
+//
+void id3v23_arena_init (
+	Id3v23Arena *arena
+) {
+
+	memset(arena, 0, sizeof(*arena));
+}
+
+
+//
+// Returns zeroed memory that lives until the arena is reset.
+//
+// Parameters:
+//   arena: the arena.
+//   size:  the number of bytes needed.
+//
+// Returns:
+//   The memory, aligned on 8 bytes.
+//
+gpointer id3v23_arena_alloc (
+	Id3v23Arena *arena,
+	gsize       size
+) {
+
+	size = ID3V23_ARENA_ROUND(size);
+	arena->needed += size;
+
+	gpointer memory;
+	if (arena->size - arena->used >= size) {
+		memory = arena->block + arena->used;
+		arena->used += size;
+	}
+	else {
+		// The block is full, the block will be grown at the next reset
+		memory = g_malloc(size);
+		arena->overflow = g_slist_prepend(arena->overflow, memory);
+	}
+
+	memset(memory, 0, size);
+	return memory;
+}
+
+
+//
+// Copies a string into the arena.
+//
+// Parameters:
+//   arena: the arena.
+//   text:  the string to copy, can be NULL.
+//
+// Returns:
+//   The copy or NULL if the string is NULL.
+//
+gchar* id3v23_arena_strdup (
+	Id3v23Arena *arena,
+	const gchar *text
+) {
+
+	if (text == NULL) {return NULL;}
+
+	gsize length = strlen(text) + 1;
+	gchar *copy = (gchar *) id3v23_arena_alloc(arena, length);
+	memcpy(copy, text, length);
+
+	return copy;
+}
+
+
+//
+// Forgets the memory handed out. When the last use didn't fit in the block
+// the block is replaced by a block that fits it.
+//
+// Parameters:
+//   arena: the arena.
+//
+void id3v23_arena_reset (
+	Id3v23Arena *arena
+) {
+
+	if (arena->overflow != NULL) {
+		g_slist_foreach(arena->overflow, (GFunc) g_free, NULL);
+		g_slist_free(arena->overflow);
+		arena->overflow = NULL;
+
+		gsize size = MAX(arena->size, ID3V23_ARENA_MIN_SIZE);
+		while (size < arena->needed) {
+			size *= 2;
+		}
+
+		g_free(arena->block);
+		arena->block = (guint8 *) g_malloc(size);
+		arena->size = size;
+	}
+
+	arena->used = 0;
+	arena->needed = 0;
+}
+
+
+//
+// Releases all the memory of the arena, the arena can still be used.
+//
+// Parameters:
+//   arena: the arena.
+//
+void id3v23_arena_clear (
+	Id3v23Arena *arena
+) {
+
+	id3v23_arena_reset(arena);
+	g_free(arena->block);
+	id3v23_arena_init(arena);
+}
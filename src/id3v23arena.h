@@ -0,0 +1,79 @@
+/* Scratch memory for the renders of the ID3v2.3 writer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef ID3V23_ARENA_H
+#define ID3V23_ARENA_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Id3v23Arena Id3v23Arena;
+
+/* A bump allocator, the memory is released all at once */
+struct _Id3v23Arena {
+	guint8   *block;     /* the memory handed out by the arena */
+	gsize    size;       /* size of the block */
+	gsize    used;       /* bytes of the block handed out so far */
+	GSList   *overflow;  /* the chunks allocated once the block was full */
+	gsize    needed;     /* bytes handed out since the last reset */
+};
+
+/* Initializes an empty arena, nothing is allocated until it's used */
+void id3v23_arena_init (Id3v23Arena *arena);
+
+/* Returns zeroed memory that lives until the arena is reset */
+gpointer id3v23_arena_alloc (Id3v23Arena *arena, gsize size);
+
+/* Copies a string into the arena */
+gchar * id3v23_arena_strdup (Id3v23Arena *arena, const gchar *text);
+
+/* Forgets what has been handed out, the block is kept for the next use */
+void id3v23_arena_reset (Id3v23Arena *arena);
+
+/* Releases all the memory of the arena */
+void id3v23_arena_clear (Id3v23Arena *arena);
+
+G_END_DECLS
+
+#endif /* ID3V23_ARENA_H */
@@ -0,0 +1,581 @@
+/* Benchmarks of the element id3v23mux
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// Benchmarks of the element id3v23mux, meant to be run on each release in
+// order to catch the performance regressions.
+//
+// The renderer is timed on synthetic tag lists (texts only, all the frames,
+// covers of 100 KB, 2 MB and 10 MB, multi-byte texts) through
+// gst_id3v23_mux_render_tags(), which is what the element does when the
+// first buffer arrives. The pass-through is timed end to end with the
+// pipeline "fakesrc ! id3v23mux ! fakesink" for each buffer size, and with
+// the element id3v2mux of gst-plugins-good (taglib) when it's installed.
+//
+// The results are written in JSON: the time (ns/op), the bytes written
+// (bytes/op) and the allocations (allocs/op) per operation, an operation
+// being a tag rendered or a buffer passed through, and the buffers per second
+// of the pipelines. The allocations are counted through the GLib memory
+// table, GSlice is disabled so that the buffers are counted as well. The
+// versions of GLib that ignore the memory table (2.46 and later) can't count
+// them, the member "allocs_counted" of the results is then false.
+//
+// Usage:
+//   id3v23bench [--iterations=N] [--buffers=N] [--buffer-sizes=418,4096] [--output=FILE]
+//
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstid3v23mux.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gst/tag/tag.h>
+
+
+// Default number of tags rendered by each benchmark of the renderer
+#define BENCH_ITERATIONS    200
+
+// Default number of buffers pushed through each pipeline
+#define BENCH_BUFFERS       200000
+
+// Default sizes of the buffers pushed through the pipelines, the first one is
+// the size of a frame of a 128 kbps MP3
+#define BENCH_BUFFER_SIZES  "418,4096,65536"
+
+
+// A tag list to render
+typedef struct _BenchTags BenchTags;
+struct _BenchTags {
+	const gchar *name;
+	GstTagList  *tags;
+};
+
+// The measures of a benchmark
+typedef struct _BenchResult BenchResult;
+struct _BenchResult {
+	guint64 ops;      // operations done
+	gdouble seconds;  // time taken
+	guint64 bytes;    // bytes written
+	guint64 allocs;   // allocations done
+};
+
+
+static gint opt_iterations = BENCH_ITERATIONS;
+static gint opt_buffers = BENCH_BUFFERS;
+static gchar *opt_buffer_sizes = NULL;
+static gchar *opt_output = NULL;
+
+static GOptionEntry entries [] = {
+	{"iterations", 'n', 0, G_OPTION_ARG_INT, &opt_iterations, "Number of tags rendered by each benchmark", "N"},
+	{"buffers", 'b', 0, G_OPTION_ARG_INT, &opt_buffers, "Number of buffers pushed through each pipeline", "N"},
+	{"buffer-sizes", 's', 0, G_OPTION_ARG_STRING, &opt_buffer_sizes, "Sizes of the buffers pushed through the pipelines (default: " BENCH_BUFFER_SIZES ")", "SIZE,SIZE..."},
+	{"output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Write the results in this file instead of the standard output", "FILE"},
+	{NULL}
+};
+
+
+// Number of allocations done through the GLib memory table
+static volatile gint bench_allocs = 0;
+
+
+static gpointer bench_malloc (
+	gsize size
+);
+
+static gpointer bench_realloc (
+	gpointer mem,
+	gsize    size
+);
+
+static gpointer bench_calloc (
+	gsize blocks,
+	gsize size
+);
+
+static GstTagList* bench_tags_text (void);
+
+static GstTagList* bench_tags_all (void);
+
+static GstTagList* bench_tags_cover (
+	gsize size
+);
+
+static GstBuffer* bench_image (
+	gsize       size,
+	const gchar *mime_type
+);
+
+static GstTagList* bench_tags_multibyte (void);
+
+static void bench_render (
+	const GstTagList *tags,
+	guint            iterations,
+	BenchResult      *result
+);
+
+static gboolean bench_pipeline (
+	const gchar      *element,
+	const GstTagList *tags,
+	guint            buffer_size,
+	guint            buffers,
+	BenchResult      *result
+);
+
+static void bench_print_result (
+	FILE              *out,
+	const BenchResult *result
+);
+
+
+
+
+int main (int argc, char **argv) {
+
+	// The memory table has to be set before anything is allocated and GSlice
+	// would hide the allocations of the buffers
+	static GMemVTable vtable = {
+		bench_malloc,
+		bench_realloc,
+		free,
+		bench_calloc,
+		bench_malloc,
+		bench_realloc,
+	};
+	g_setenv("G_SLICE", "always-malloc", TRUE);
+	g_mem_set_vtable(&vtable);
+
+	GError *error = NULL;
+	GOptionContext *context = g_option_context_new("- benchmark the element id3v23mux");
+	g_option_context_add_main_entries(context, entries, NULL);
+	g_option_context_add_group(context, gst_init_get_option_group());
+	if (! g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (opt_iterations <= 0 || opt_buffers <= 0) {
+		g_printerr("The number of iterations and of buffers must be positive\n");
+		return 1;
+	}
+
+	// The element is registered without loading the plugin
+	if (! gst_id3v23_mux_plugin_init(NULL)) {
+		g_printerr("Can't register the element %s\n", PLUGIN);
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if (opt_output != NULL) {
+		out = fopen(opt_output, "w");
+		if (out == NULL) {
+			g_printerr("Can't open %s: %s\n", opt_output, g_strerror(errno));
+			return 1;
+		}
+	}
+
+	BenchTags inputs [] = {
+		{"text", bench_tags_text()},
+		{"all-frames", bench_tags_all()},
+		{"cover-100k", bench_tags_cover(100 * 1024)},
+		{"cover-2m", bench_tags_cover(2 * 1024 * 1024)},
+		{"cover-10m", bench_tags_cover(10 * 1024 * 1024)},
+		{"multibyte", bench_tags_multibyte()},
+	};
+
+	gboolean counted = ! g_mem_is_system_malloc();
+	if (! counted) {
+		g_printerr("GLib ignores the memory table, the allocations aren't counted\n");
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"version\": \"%s\",\n", VERSION);
+	fprintf(out, "  \"allocs_counted\": %s,\n", counted ? "true" : "false");
+
+	// The renderer
+	fprintf(out, "  \"render\": [\n");
+	for (guint i = 0; i < G_N_ELEMENTS(inputs); ++i) {
+		g_printerr("render %s\n", inputs[i].name);
+
+		BenchResult result;
+		bench_render(inputs[i].tags, opt_iterations, &result);
+
+		fprintf(out, "    {\"name\": \"%s\", ", inputs[i].name);
+		bench_print_result(out, &result);
+		fprintf(out, "}%s\n", i + 1 < G_N_ELEMENTS(inputs) ? "," : "");
+	}
+	fprintf(out, "  ],\n");
+
+	// The pass-through, the stock muxer is skipped when it isn't installed
+	const gchar *elements [] = {PLUGIN, "id3v2mux"};
+	gchar **sizes = g_strsplit(opt_buffer_sizes != NULL ? opt_buffer_sizes : BENCH_BUFFER_SIZES, ",", 0);
+	gboolean first = TRUE;
+	fprintf(out, "  \"pipeline\": [\n");
+	for (guint e = 0; e < G_N_ELEMENTS(elements); ++e) {
+		GstElementFactory *factory = gst_element_factory_find(elements[e]);
+		if (factory == NULL) {
+			g_printerr("pipeline %s: element not found, skipped\n", elements[e]);
+			continue;
+		}
+		gst_object_unref(factory);
+
+		for (gchar **size = sizes; *size != NULL; ++size) {
+			guint buffer_size = (guint) atoi(*size);
+			if (buffer_size == 0) {continue;}
+			g_printerr("pipeline %s, buffers of %u bytes\n", elements[e], buffer_size);
+
+			BenchResult result;
+			if (! bench_pipeline(elements[e], inputs[0].tags, buffer_size, opt_buffers, &result)) {
+				continue;
+			}
+
+			fprintf(out, "%s    {\"element\": \"%s\", \"buffer_size\": %u, ", first ? "" : ",\n", elements[e], buffer_size);
+			bench_print_result(out, &result);
+			fprintf(out, ", \"buffers_per_sec\": %.0f}", result.ops / result.seconds);
+			first = FALSE;
+		}
+	}
+	fprintf(out, "%s  ]\n", first ? "" : "\n");
+	fprintf(out, "}\n");
+	g_strfreev(sizes);
+
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	for (guint i = 0; i < G_N_ELEMENTS(inputs); ++i) {
+		gst_tag_list_free(inputs[i].tags);
+	}
+
+	return 0;
+}
+
+
+//
+// The allocators of the memory table, they count the allocations.
+//
+static gpointer bench_malloc (
+	gsize size
+) {
+
+	g_atomic_int_inc(&bench_allocs);
+	return malloc(size);
+}
+
+static gpointer bench_realloc (
+	gpointer mem,
+	gsize    size
+) {
+
+	g_atomic_int_inc(&bench_allocs);
+	return realloc(mem, size);
+}
+
+static gpointer bench_calloc (
+	gsize blocks,
+	gsize size
+) {
+
+	g_atomic_int_inc(&bench_allocs);
+	return calloc(blocks, size);
+}
+
+
+//
+// Returns the tags of a typical track, texts only.
+//
+static GstTagList* bench_tags_text (void) {
+
+	GstTagList *tags = gst_tag_list_new();
+	GDate *date = g_date_new_dmy(21, G_DATE_MARCH, 1975);
+	gst_tag_list_add(
+		tags, GST_TAG_MERGE_REPLACE,
+		GST_TAG_TITLE, "Shine On You Crazy Diamond (Parts I-V)",
+		GST_TAG_ARTIST, "Pink Floyd",
+		GST_TAG_ALBUM, "Wish You Were Here",
+		GST_TAG_GENRE, "Progressive Rock",
+		GST_TAG_TRACK_NUMBER, 1,
+		GST_TAG_TRACK_COUNT, 5,
+		GST_TAG_DATE, date,
+		NULL
+	);
+	g_date_free(date);
+
+	return tags;
+}
+
+
+//
+// Returns a value for each tag of the mapping of the element, every kind of
+// frame written (texts, numbers, date, length, COMM, UFID, TXXX, APIC) is
+// rendered.
+//
+static GstTagList* bench_tags_all (void) {
+
+	GstTagList *tags = bench_tags_cover(4096);
+	gst_tag_list_add(
+		tags, GST_TAG_MERGE_APPEND,
+		GST_TAG_ARTIST, "David Gilmour",
+		GST_TAG_ALBUM_ARTIST, "Pink Floyd",
+		GST_TAG_COMPOSER, "Roger Waters",
+		GST_TAG_COMPOSER, "Richard Wright",
+		NULL
+	);
+	gst_tag_list_add(
+		tags, GST_TAG_MERGE_REPLACE,
+		GST_TAG_ALBUM_VOLUME_NUMBER, 1,
+		GST_TAG_ALBUM_VOLUME_COUNT, 2,
+		GST_TAG_COPYRIGHT, "1975 Pink Floyd Music Ltd.",
+		GST_TAG_ORGANIZATION, "Harvest",
+		GST_TAG_ENCODER, "LAME 3.98",
+		GST_TAG_BEATS_PER_MINUTE, 62.5,
+		GST_TAG_ISRC, "GBN9Y1100085",
+		GST_TAG_DURATION, (guint64) 810 * GST_SECOND,
+		GST_TAG_COMMENT, "Remastered",
+		GST_TAG_MUSICBRAINZ_TRACKID, "b4b8a8b0-8f0d-4b6c-9d5c-0b1c1c5c1f2e",
+		GST_TAG_MUSICBRAINZ_ARTISTID, "83d91898-7763-47d7-b03b-b92132375c47",
+		GST_TAG_MUSICBRAINZ_ALBUMID, "3e6ab3e4-d6d3-4bd8-9cb4-9d1a4e4d1c57",
+		GST_TAG_MUSICBRAINZ_ALBUMARTISTID, "83d91898-7763-47d7-b03b-b92132375c47",
+		GST_TAG_MUSICBRAINZ_TRMID, "f1a7b6c2-3d4e-4f50-8a9b-0c1d2e3f4a5b",
+		NULL
+	);
+
+	GstBuffer *preview = bench_image(512, "image/png");
+	gst_tag_list_add(tags, GST_TAG_MERGE_REPLACE, GST_TAG_PREVIEW_IMAGE, preview, NULL);
+	gst_buffer_unref(preview);
+
+	return tags;
+}
+
+
+//
+// Returns the tags of a typical track with a JPEG cover of the given size.
+// The bytes of the picture are random so that they don't compress.
+//
+static GstTagList* bench_tags_cover (
+	gsize size
+) {
+
+	GstBuffer *image = bench_image(size, "image/jpeg");
+	GstTagList *tags = bench_tags_text();
+	gst_tag_list_add(tags, GST_TAG_MERGE_APPEND, GST_TAG_IMAGE, image, NULL);
+	gst_buffer_unref(image);
+
+	return tags;
+}
+
+
+//
+// Returns a picture of the given size and type, its bytes are random.
+//
+static GstBuffer* bench_image (
+	gsize       size,
+	const gchar *mime_type
+) {
+
+	GstBuffer *image = gst_buffer_new_and_alloc(size);
+	GRand *rand = g_rand_new_with_seed(size);
+	for (gsize i = 0; i < size; ++i) {
+		GST_BUFFER_DATA(image)[i] = (guint8) g_rand_int(rand);
+	}
+	g_rand_free(rand);
+
+	GstCaps *caps = gst_caps_new_simple(mime_type, NULL);
+	gst_buffer_set_caps(image, caps);
+	gst_caps_unref(caps);
+
+	return image;
+}
+
+
+//
+// Returns the tags of a track whose texts can't be written in ISO-8859-1.
+//
+static GstTagList* bench_tags_multibyte (void) {
+
+	GstTagList *tags = bench_tags_text();
+	gst_tag_list_add(
+		tags, GST_TAG_MERGE_REPLACE,
+		GST_TAG_TITLE, "あの夏へ",
+		GST_TAG_ARTIST, "久石譲",
+		GST_TAG_ALBUM, "千と千尋の神隠し オリジナル・サウンドトラック",
+		GST_TAG_GENRE, "サウンドトラック",
+		NULL
+	);
+
+	return tags;
+}
+
+
+//
+// Renders the same tags over and over.
+//
+static void bench_render (
+	const GstTagList *tags,
+	guint            iterations,
+	BenchResult      *result
+) {
+
+	memset(result, 0, sizeof(*result));
+	g_atomic_int_set(&bench_allocs, 0);
+	GTimer *timer = g_timer_new();
+
+	for (guint i = 0; i < iterations; ++i) {
+		GstBuffer *buffer = gst_id3v23_mux_render_tags(tags, 0, 0);
+		if (buffer == NULL) {
+			g_error("The tag can't be rendered");
+		}
+		result->bytes += GST_BUFFER_SIZE(buffer);
+		gst_buffer_unref(buffer);
+	}
+
+	result->seconds = g_timer_elapsed(timer, NULL);
+	result->allocs = g_atomic_int_get(&bench_allocs);
+	result->ops = iterations;
+	g_timer_destroy(timer);
+}
+
+
+//
+// Pushes buffers through "fakesrc ! ELEMENT ! fakesink" and measures the time
+// from PLAYING to EOS.
+//
+// Parameters:
+//   element:     the name of the muxer.
+//   tags:        the tags set on the muxer.
+//   buffer_size: the size of the buffers.
+//   buffers:     the number of buffers.
+//   result:      set to the measures.
+//
+// Returns:
+//   TRUE if the pipeline reached EOS.
+//
+static gboolean bench_pipeline (
+	const gchar      *element,
+	const GstTagList *tags,
+	guint            buffer_size,
+	guint            buffers,
+	BenchResult      *result
+) {
+
+	// sizetype=2 gives buffers of sizemax bytes, filltype=1 leaves them as
+	// they are allocated
+	gchar *description = g_strdup_printf(
+		"fakesrc num-buffers=%u sizetype=2 sizemax=%u filltype=1 ! %s name=mux ! fakesink sync=false",
+		buffers, buffer_size, element
+	);
+	GError *error = NULL;
+	GstElement *pipeline = gst_parse_launch(description, &error);
+	g_free(description);
+	if (pipeline == NULL) {
+		g_printerr("Can't create the pipeline: %s\n", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	GstElement *mux = gst_bin_get_by_name(GST_BIN(pipeline), "mux");
+	gst_tag_setter_merge_tags(GST_TAG_SETTER(mux), tags, GST_TAG_MERGE_REPLACE);
+	gst_object_unref(mux);
+
+	gst_element_set_state(pipeline, GST_STATE_PAUSED);
+	gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+	memset(result, 0, sizeof(*result));
+	g_atomic_int_set(&bench_allocs, 0);
+	GTimer *timer = g_timer_new();
+
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+	GstBus *bus = gst_element_get_bus(pipeline);
+	GstMessage *message = gst_bus_timed_pop_filtered(
+		bus,
+		GST_CLOCK_TIME_NONE,
+		(GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR)
+	);
+
+	result->seconds = g_timer_elapsed(timer, NULL);
+	result->allocs = g_atomic_int_get(&bench_allocs);
+	result->ops = buffers;
+	result->bytes = (guint64) buffers * buffer_size;
+	g_timer_destroy(timer);
+
+	gboolean eos = GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+	if (! eos) {
+		GError *error = NULL;
+		gst_message_parse_error(message, &error, NULL);
+		g_printerr("The pipeline failed: %s\n", error->message);
+		g_error_free(error);
+	}
+	gst_message_unref(message);
+	gst_object_unref(bus);
+
+	gst_element_set_state(pipeline, GST_STATE_NULL);
+	gst_object_unref(pipeline);
+
+	return eos;
+}
+
+
+//
+// Writes the measures per operation as JSON members.
+//
+static void bench_print_result (
+	FILE              *out,
+	const BenchResult *result
+) {
+
+	fprintf(
+		out,
+		"\"ops\": %" G_GUINT64_FORMAT ", \"ns_per_op\": %.1f, \"bytes_per_op\": %.1f, \"allocs_per_op\": %.2f",
+		result->ops,
+		result->seconds * 1e9 / result->ops,
+		(gdouble) result->bytes / result->ops,
+		(gdouble) result->allocs / result->ops
+	);
+}
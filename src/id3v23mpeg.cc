@@ -0,0 +1,455 @@
+/* Scanner of the MPEG audio frames passed through the ID3v2.3 writer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+
+//
+// A scanner of the MPEG audio frame headers (MPEG 1, 2 and 2.5, layers I, II
+// and III). The muxer feeds it with the buffers passed through and, at EOS,
+// knows the exact duration of the stream without reading the file again.
+//
+// The stream is followed from frame to frame: once a header is found, the
+// length of its frame tells where the next header is and the bytes in
+// between aren't looked at. Only the bytes that don't belong to a frame are
+// searched for a sync word, with memchr() which compares many bytes at once.
+// A header split across two buffers is kept until the next buffer completes
+// it.
+//
+// The first frame of a VBR file is usually a Xing, Info or VBRI frame
+// carrying no audio, it isn't counted when its tag is in the same buffer as
+// its header. The frames whose version, layer or sample rate differ from the
+// first frame are taken as false syncs.
+//
+
+#include "id3v23mpeg.h"
+
+#include <string.h>
+
+// Values of the version and layer bits of a header
+#define ID3V23_MPEG_VERSION_2_5   0
+#define ID3V23_MPEG_VERSION_1     3
+#define ID3V23_MPEG_LAYER_3       1
+#define ID3V23_MPEG_LAYER_1       3
+
+// Channel mode of a mono frame
+#define ID3V23_MPEG_MONO          3
+
+typedef struct _Id3v23MpegHeader Id3v23MpegHeader;
+struct _Id3v23MpegHeader {
+	guint    version;
+	guint    layer;
+	guint    bitrate_index;
+	guint    sample_rate;
+	guint    samples;   // Samples per channel
+	gsize    length;    // Length of the frame, header included
+	gboolean mono;
+};
+
+
+// Bitrates in kbit/s for MPEG 1 layers I, II, III and MPEG 2/2.5 layers I, II/III
+static const guint16 id3v23_mpeg_bitrates [5][16] = {
+	{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+	{0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+	{0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0},
+	{0, 32, 48, 56,  64,  80,  96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+	{0,  8, 16, 24,  32,  40,  48,  56,  64,  80,  96, 112, 128, 144, 160, 0},
+};
+
+// Sample rates of MPEG 1, the ones of MPEG 2 are halved and of MPEG 2.5 quartered
+static const guint id3v23_mpeg_sample_rates [3] = {44100, 48000, 32000};
+
+
+static gboolean id3v23_mpeg_parse_header (
+	const guint8     *data,
+	Id3v23MpegHeader *header
+);
+
+static guint id3v23_mpeg_table (
+	guint version,
+	guint layer
+);
+
+static gboolean id3v23_mpeg_matches (
+	const Id3v23MpegScanner *scanner,
+	const Id3v23MpegHeader  *header
+);
+
+static gboolean id3v23_mpeg_is_info_frame (
+	const Id3v23MpegHeader *header,
+	const guint8           *data,
+	gsize                  size
+);
+
+static void id3v23_mpeg_count (
+	Id3v23MpegScanner      *scanner,
+	const Id3v23MpegHeader *header,
+	const guint8           *data,
+	gsize                  size
+);
+
+
+
+
+//
+// Initializes a scanner that hasn't seen any frame.
+//
+void id3v23_mpeg_scanner_init (
+	Id3v23MpegScanner *scanner
+) {
+
+	memset(scanner, 0, sizeof(*scanner));
+}
+
+
+//
+// Scans the next bytes of the stream.
+//
+// Parameters:
+//   scanner: the scanner.
+//   data:    the bytes that follow the ones scanned so far.
+//   size:    the number of bytes.
+//
+void id3v23_mpeg_scanner_push (
+	Id3v23MpegScanner *scanner,
+	const guint8      *data,
+	gsize             size
+) {
+
+	Id3v23MpegHeader header;
+
+	while (size > 0) {
+
+		// The rest of the current frame
+		if (scanner->skip > 0) {
+			gsize length = MIN(scanner->skip, size);
+			scanner->skip -= length;
+			data += length;
+			size -= length;
+			continue;
+		}
+
+		// A header started in the previous buffer
+		if (scanner->held > 0) {
+			gsize length = MIN(sizeof(scanner->header) - scanner->held, size);
+			memcpy(scanner->header + scanner->held, data, length);
+			scanner->held += length;
+			data += length;
+			size -= length;
+			if (scanner->held < sizeof(scanner->header)) {break;}
+
+			if (id3v23_mpeg_parse_header(scanner->header, &header) && id3v23_mpeg_matches(scanner, &header)) {
+				scanner->held = 0;
+				id3v23_mpeg_count(scanner, &header, NULL, 0);
+				scanner->skip = header.length - sizeof(scanner->header);
+				continue;
+			}
+
+			// A false sync, the search goes on from the next byte held
+			const guint8 *sync = (const guint8 *) memchr(scanner->header + 1, 0xFF, sizeof(scanner->header) - 1);
+			guint kept = sync != NULL ? scanner->header + sizeof(scanner->header) - sync : 0;
+			scanner->lost += scanner->held - kept;
+			if (kept > 0) {
+				memmove(scanner->header, sync, kept);
+			}
+			scanner->held = kept;
+			continue;
+		}
+
+		// Look for the next sync word
+		const guint8 *sync = (const guint8 *) memchr(data, 0xFF, size);
+		if (sync == NULL) {
+			scanner->lost += size;
+			break;
+		}
+		scanner->lost += sync - data;
+		size -= sync - data;
+		data = sync;
+
+		if (size < sizeof(scanner->header)) {
+			memcpy(scanner->header, data, size);
+			scanner->held = size;
+			break;
+		}
+
+		if (id3v23_mpeg_parse_header(data, &header) && id3v23_mpeg_matches(scanner, &header)) {
+			id3v23_mpeg_count(scanner, &header, data, size);
+			scanner->skip = header.length;
+		}
+		else {
+			scanner->lost++;
+			data++;
+			size--;
+		}
+	}
+}
+
+
+//
+// Returns the duration of the frames found.
+//
+// Parameters:
+//   scanner: the scanner.
+//
+// Returns:
+//   The duration in nanoseconds or 0 if no frame was found.
+//
+guint64 id3v23_mpeg_scanner_duration (
+	const Id3v23MpegScanner *scanner
+) {
+
+	if (scanner->sample_rate == 0) {return 0;}
+
+	// Split in order not to overflow with long streams
+	guint64 seconds = scanner->samples / scanner->sample_rate;
+	guint64 rest = scanner->samples % scanner->sample_rate;
+
+	return seconds * G_GUINT64_CONSTANT(1000000000) + rest * G_GUINT64_CONSTANT(1000000000) / scanner->sample_rate;
+}
+
+
+//
+// Returns the average bitrate of the frames found.
+//
+// Parameters:
+//   scanner: the scanner.
+//
+// Returns:
+//   The bitrate in bit/s or 0 if no frame was found.
+//
+guint id3v23_mpeg_scanner_average_bitrate (
+	const Id3v23MpegScanner *scanner
+) {
+
+	if (scanner->samples == 0) {return 0;}
+
+	return (guint) (scanner->bytes * 8 * scanner->sample_rate / scanner->samples);
+}
+
+
+//
+// Returns the bitrate of an index of the histogram.
+//
+// Parameters:
+//   scanner: the scanner, it must have found a frame.
+//   index:   the bitrate index (from 0 to 15).
+//
+// Returns:
+//   The bitrate in kbit/s or 0 if the index isn't valid.
+//
+guint id3v23_mpeg_scanner_bitrate (
+	const Id3v23MpegScanner *scanner,
+	guint                   index
+) {
+
+	if (scanner->sample_rate == 0 || index >= G_N_ELEMENTS(id3v23_mpeg_bitrates[0])) {return 0;}
+
+	return id3v23_mpeg_bitrates[id3v23_mpeg_table(scanner->version, scanner->layer)][index];
+}
+
+
+//
+// Parses a frame header.
+//
+// Parameters:
+//   data:   the 4 bytes of the header.
+//   header: where to store the header.
+//
+// Returns:
+//   TRUE if the bytes are a valid header. The free format (bitrate index 0)
+//   isn't supported as the length of its frames isn't in the header.
+//
+static gboolean id3v23_mpeg_parse_header (
+	const guint8     *data,
+	Id3v23MpegHeader *header
+) {
+
+	// Sync word (11 bits)
+	if (data[0] != 0xFF || (data[1] & 0xE0) != 0xE0) {return FALSE;}
+
+	guint version = (data[1] >> 3) & 0x03;
+	guint layer = (data[1] >> 1) & 0x03;
+	guint bitrate_index = data[2] >> 4;
+	guint rate_index = (data[2] >> 2) & 0x03;
+	guint padding = (data[2] >> 1) & 0x01;
+	guint emphasis = data[3] & 0x03;
+
+	// Reserved values
+	if (version == 1 || layer == 0 || rate_index == 3 || emphasis == 2) {return FALSE;}
+	if (bitrate_index == 0 || bitrate_index == 15) {return FALSE;}
+
+	guint bitrate = id3v23_mpeg_bitrates[id3v23_mpeg_table(version, layer)][bitrate_index] * 1000;
+	guint sample_rate = id3v23_mpeg_sample_rates[rate_index];
+	if (version != ID3V23_MPEG_VERSION_1) {
+		sample_rate /= version == ID3V23_MPEG_VERSION_2_5 ? 4 : 2;
+	}
+
+	header->version = version;
+	header->layer = layer;
+	header->bitrate_index = bitrate_index;
+	header->sample_rate = sample_rate;
+	header->mono = (data[3] >> 6) == ID3V23_MPEG_MONO;
+
+	if (layer == ID3V23_MPEG_LAYER_1) {
+		header->samples = 384;
+		header->length = (12 * bitrate / sample_rate + padding) * 4;
+	}
+	else if (layer == ID3V23_MPEG_LAYER_3 && version != ID3V23_MPEG_VERSION_1) {
+		header->samples = 576;
+		header->length = 72 * bitrate / sample_rate + padding;
+	}
+	else {
+		header->samples = 1152;
+		header->length = 144 * bitrate / sample_rate + padding;
+	}
+
+	return TRUE;
+}
+
+
+//
+// Returns the row of the bitrate table of a version and a layer.
+//
+static guint id3v23_mpeg_table (
+	guint version,
+	guint layer
+) {
+
+	if (version == ID3V23_MPEG_VERSION_1) {
+		return ID3V23_MPEG_LAYER_1 - layer;
+	}
+
+	return layer == ID3V23_MPEG_LAYER_1 ? 3 : 4;
+}
+
+
+//
+// Tells if a header belongs to the stream followed by the scanner.
+//
+static gboolean id3v23_mpeg_matches (
+	const Id3v23MpegScanner *scanner,
+	const Id3v23MpegHeader  *header
+) {
+
+	if (scanner->sample_rate == 0) {return TRUE;}
+
+	return header->version == scanner->version
+		&& header->layer == scanner->layer
+		&& header->sample_rate == scanner->sample_rate
+	;
+}
+
+
+//
+// Tells if a frame is a Xing, Info or VBRI frame (a frame of silence that
+// describes the stream rather than audio).
+//
+// Parameters:
+//   header: the header of the frame.
+//   data:   the frame, header included.
+//   size:   the number of bytes available, the frame can be truncated.
+//
+// Returns:
+//   TRUE if the tag of such a frame is found in the bytes available.
+//
+static gboolean id3v23_mpeg_is_info_frame (
+	const Id3v23MpegHeader *header,
+	const guint8           *data,
+	gsize                  size
+) {
+
+	if (header->layer != ID3V23_MPEG_LAYER_3) {return FALSE;}
+
+	// The Xing tag follows the side information, VBRI is always at 36
+	gsize offset = header->version == ID3V23_MPEG_VERSION_1
+		? (header->mono ? 17 : 32)
+		: (header->mono ? 9 : 17)
+	;
+	offset += 4;
+
+	if (offset + 4 <= size && (memcmp(data + offset, "Xing", 4) == 0 || memcmp(data + offset, "Info", 4) == 0)) {
+		return TRUE;
+	}
+
+	return 36 + 4 <= size && memcmp(data + 36, "VBRI", 4) == 0;
+}
+
+
+//
+// Accounts a frame found.
+//
+// Parameters:
+//   scanner: the scanner.
+//   header:  the header of the frame.
+//   data:    the frame, header included, NULL when the header was split.
+//   size:    the number of bytes of the frame available.
+//
+static void id3v23_mpeg_count (
+	Id3v23MpegScanner      *scanner,
+	const Id3v23MpegHeader *header,
+	const guint8           *data,
+	gsize                  size
+) {
+
+	if (scanner->sample_rate == 0) {
+		scanner->version = header->version;
+		scanner->layer = header->layer;
+		scanner->sample_rate = header->sample_rate;
+
+		if (data != NULL && id3v23_mpeg_is_info_frame(header, data, size)) {
+			scanner->info_frame = TRUE;
+			return;
+		}
+	}
+
+	guint bitrate = id3v23_mpeg_bitrates[id3v23_mpeg_table(header->version, header->layer)][header->bitrate_index];
+	if (scanner->frames == 0) {
+		scanner->bitrate = bitrate;
+	}
+	else if (bitrate != scanner->bitrate) {
+		scanner->vbr = TRUE;
+	}
+
+	scanner->frames++;
+	scanner->samples += header->samples;
+	scanner->bytes += header->length;
+	scanner->bitrates[header->bitrate_index]++;
+}
@@ -0,0 +1,91 @@
+/* Scanner of the MPEG audio frames passed through the ID3v2.3 writer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+
+#ifndef ID3V23_MPEG_H
+#define ID3V23_MPEG_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Id3v23MpegScanner Id3v23MpegScanner;
+
+/* Follows the MPEG audio frames of a stream fed one buffer at a time */
+struct _Id3v23MpegScanner {
+	guint8   header[4];     /* start of a header split across buffers */
+	guint    held;          /* bytes of header */
+	gsize    skip;          /* bytes left in the current frame */
+	guint    version;       /* version, layer and sample rate of the first */
+	guint    layer;         /* frame, the frames that don't match are */
+	guint    sample_rate;   /* ignored (0 until the first frame) */
+	guint64  frames;        /* audio frames found */
+	guint64  samples;       /* samples per channel in these frames */
+	guint64  bytes;         /* bytes of these frames */
+	guint64  lost;          /* bytes that aren't part of a frame */
+	guint64  bitrates[16];  /* frames per bitrate index */
+	guint    bitrate;       /* bitrate of the first frame (kbit/s) */
+	gboolean vbr;           /* TRUE once a frame has another bitrate */
+	gboolean info_frame;    /* TRUE when the first frame is a Xing/VBRI one */
+};
+
+/* Initializes a scanner that hasn't seen any frame */
+void id3v23_mpeg_scanner_init (Id3v23MpegScanner *scanner);
+
+/* Scans the next bytes of the stream */
+void id3v23_mpeg_scanner_push (Id3v23MpegScanner *scanner, const guint8 *data,
+	gsize size);
+
+/* Returns the duration of the frames found in nanoseconds, 0 if none */
+guint64 id3v23_mpeg_scanner_duration (const Id3v23MpegScanner *scanner);
+
+/* Returns the average bitrate of the frames found in bit/s, 0 if none */
+guint id3v23_mpeg_scanner_average_bitrate (const Id3v23MpegScanner *scanner);
+
+/* Returns the bitrate of the given index in kbit/s, 0 if it isn't valid */
+guint id3v23_mpeg_scanner_bitrate (const Id3v23MpegScanner *scanner,
+	guint index);
+
+G_END_DECLS
+
+#endif /* ID3V23_MPEG_H */
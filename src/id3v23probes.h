@@ -0,0 +1,77 @@
+/* Static tracepoints (USDT) of the id3v23mux plugin
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * The probes are compiled in only when the plugin is built with SDT=1, they
+ * are then nops until a tracer (perf, bpftrace, systemtap) attaches to them.
+ * Otherwise the macros expand to nothing.
+ *
+ * Probes of the provider "id3v23mux":
+ *   render__start                      the tag is about to be rendered
+ *   render__done(tag_bytes, ns)        the tag was rendered
+ *   frame(id, bytes, shared)           a frame was prepared, shared is 1
+ *                                      when its bytes are shared with the
+ *                                      template
+ *   tag__render(tag_bytes, frames)     the frames were serialized
+ *   chain(buffer_bytes, offset)        a buffer was received
+ *   chain__list(groups)                a buffer list was received
+ *   sink__event(type)                  an event was received
+ */
+
+#ifndef ID3V23_PROBES_H
+#define ID3V23_PROBES_H
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define ID3V23_PROBE(name)                 DTRACE_PROBE(id3v23mux, name)
+#define ID3V23_PROBE1(name, a)             DTRACE_PROBE1(id3v23mux, name, a)
+#define ID3V23_PROBE2(name, a, b)          DTRACE_PROBE2(id3v23mux, name, a, b)
+#define ID3V23_PROBE3(name, a, b, c)       DTRACE_PROBE3(id3v23mux, name, a, b, c)
+#else
+#define ID3V23_PROBE(name)
+#define ID3V23_PROBE1(name, a)
+#define ID3V23_PROBE2(name, a, b)
+#define ID3V23_PROBE3(name, a, b, c)
+#endif
+
+#endif /* ID3V23_PROBES_H */
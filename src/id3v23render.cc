@@ -0,0 +1,909 @@
+/* Renders ID3v2.3 tags without GStreamer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+
+//
+// The ID3v2.3 byte layout: the frames are measured then written in a buffer
+// provided by the caller. The element id3v23mux renders its tags through
+// these functions, the library libid3v23render.so offers them to the
+// programs that only need the bytes of a tag and not a pipeline.
+//
+// Nothing is allocated and there's no global state, the functions can be
+// called by many threads at once. A tag is rendered in two passes: the
+// frames are measured in order to write the size of the tag in its header,
+// then measured again as they are written. Measuring a frame is a scan of its
+// texts, which costs less than remembering the layouts of an unknown number
+// of frames.
+//
+// A tag can then be unsynchronised for the players that mistake the bytes
+// 0xFF 0xE0 of a tag (a cover for instance) for the start of an MPEG frame.
+// Tags seldom need it, so the data is first scanned for 0xFF bytes 16 bytes
+// at a time with SSE2, 32 with AVX2 when the CPU has it (memchr() otherwise)
+// and a tag without false sync is left as it is. Otherwise the 0x00 are
+// inserted in place from the end of the frames, the padding absorbs them.
+//
+// Usage:
+//   Id3v23Field fields [] = {
+//     {"TIT2", "Title"},
+//     {"APIC", NULL, NULL, NULL, "image/jpeg", 0x03, jpeg, jpeg_size},
+//   };
+//   size_t size;
+//   id3v23_render_size(fields, 2, NULL, &size);
+//   uint8_t *data = (uint8_t *) malloc(size);
+//   id3v23_render(fields, 2, NULL, data, size, &size);
+//
+
+#include "id3v23render.h"
+#include "id3v23text.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The AVX2 code is built in functions of its own and used when the CPU
+// supports it, the rest of the library doesn't need AVX2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RENDER_AVX2  1
+#include <immintrin.h>
+#endif
+
+
+// The layouts of the frames
+typedef enum {
+	RENDER_FIELD_INVALID,
+	RENDER_FIELD_TEXT,
+	RENDER_FIELD_COMMENT,
+	RENDER_FIELD_USER_TEXT,
+	RENDER_FIELD_UFID,
+	RENDER_FIELD_PICTURE
+} RenderFieldKind;
+
+
+static RenderFieldKind render_field_kind (
+	const char *id
+);
+
+static Id3v23RenderStatus render_measure (
+	const Id3v23Field         *fields,
+	size_t                    count,
+	const Id3v23RenderOptions *options,
+	size_t                    *size,
+	size_t                    *padding_size
+);
+
+static uint8_t* render_write_text (
+	const char    *text,
+	const uint8_t encoding,
+	uint8_t       *data
+);
+
+static uint8_t* render_write_terminated (
+	const char    *text,
+	const uint8_t encoding,
+	uint8_t       *data
+);
+
+
+static size_t render_frames_end (
+	const uint8_t *body,
+	size_t        size
+);
+
+static inline const uint8_t* render_find_ff (
+	const uint8_t *p,
+	const uint8_t *end
+);
+
+#ifdef RENDER_AVX2
+static const uint8_t* render_find_ff_avx2 (
+	const uint8_t *p,
+	const uint8_t *end
+) __attribute__((target("avx2")));
+#endif
+
+static inline int render_needs_escape (
+	uint8_t next
+);
+
+
+static const Id3v23RenderOptions render_default_options = {0, 0, ID3V23_RENDER_ENCODING_AUTO};
+
+
+
+
+Id3v23RenderStatus id3v23_render_size (
+	const Id3v23Field         *fields,
+	size_t                    count,
+	const Id3v23RenderOptions *options,
+	size_t                    *size
+) {
+
+	size_t body_size, padding_size;
+	Id3v23RenderStatus status = render_measure(fields, count, options, &body_size, &padding_size);
+	if (status != ID3V23_RENDER_OK) {return status;}
+
+	*size = ID3V23_HEADER_SIZE + body_size + padding_size;
+	return ID3V23_RENDER_OK;
+}
+
+
+Id3v23RenderStatus id3v23_render (
+	const Id3v23Field         *fields,
+	size_t                    count,
+	const Id3v23RenderOptions *options,
+	uint8_t                   *data,
+	size_t                    size,
+	size_t                    *written
+) {
+
+	if (options == NULL) {
+		options = &render_default_options;
+	}
+
+	size_t body_size, padding_size;
+	Id3v23RenderStatus status = render_measure(fields, count, options, &body_size, &padding_size);
+	if (status != ID3V23_RENDER_OK) {return status;}
+
+	// The caller learns the size needed when the buffer is too small
+	size_t needed = ID3V23_HEADER_SIZE + body_size + padding_size;
+	if (written != NULL) {
+		*written = needed;
+	}
+	if (size < needed) {return ID3V23_RENDER_SHORT_BUFFER;}
+
+	uint8_t *start = data;
+	data = id3v23_render_write_header(body_size + padding_size, data);
+
+	for (size_t i = 0; i < count; ++i) {
+		Id3v23FieldLayout layout;
+		id3v23_render_measure_field(&fields[i], options->encoding, &layout);
+		data = id3v23_render_write_field_head(&fields[i], &layout, data);
+		if (memcmp(fields[i].id, "APIC", 4) == 0 && fields[i].size > 0) {
+			memcpy(data, fields[i].data, fields[i].size);
+			data += fields[i].size;
+		}
+	}
+
+	memset(data, 0, padding_size);
+	data += padding_size;
+
+	assert((size_t) (data - start) == needed);
+	return ID3V23_RENDER_OK;
+}
+
+
+//
+// Unsynchronises a tag rendered by id3v23_render(): a 0x00 is inserted after
+// each 0xFF followed by 0x00 or by a byte of at least 0xE0 (a false MPEG
+// sync) and after a 0xFF that ends the frames. The flag of the tag header is
+// then set.
+//
+// The tag keeps its size when its padding is at least as big as the bytes
+// inserted, otherwise the padding is dropped and the tag grows.
+//
+// Parameters:
+//   tag:      the tag, header included.
+//   size:     the size of the tag.
+//   capacity: the size of the buffer holding the tag.
+//   mode:     when the tag is unsynchronised, with ID3V23_RENDER_UNSYNC_AUTO
+//             only a tag that has a false sync is.
+//   written:  set to the size of the tag, with ID3V23_RENDER_SHORT_BUFFER the
+//             size of the buffer needed.
+//
+// Returns:
+//   ID3V23_RENDER_OK, ID3V23_RENDER_SHORT_BUFFER (the tag isn't modified) or
+//   ID3V23_RENDER_INVALID_FIELD when the frames don't fit in the tag.
+//
+Id3v23RenderStatus id3v23_render_unsynchronise (
+	uint8_t            *tag,
+	size_t             size,
+	size_t             capacity,
+	Id3v23RenderUnsync mode,
+	size_t             *written
+) {
+
+	if (written != NULL) {
+		*written = size;
+	}
+	if (mode == ID3V23_RENDER_UNSYNC_OFF || size <= ID3V23_HEADER_SIZE) {return ID3V23_RENDER_OK;}
+
+	// The padding has no 0xFF, only the frames are scanned
+	uint8_t *body = tag + ID3V23_HEADER_SIZE;
+	size_t frames_size = render_frames_end(body, size - ID3V23_HEADER_SIZE);
+	if (frames_size == (size_t) -1) {return ID3V23_RENDER_INVALID_FIELD;}
+
+	int false_sync;
+	size_t inserted = id3v23_render_unsync_scan(body, frames_size, &false_sync);
+	if (mode == ID3V23_RENDER_UNSYNC_AUTO && ! false_sync) {return ID3V23_RENDER_OK;}
+
+	size_t needed = ID3V23_HEADER_SIZE + frames_size + inserted;
+	if (needed > size) {
+		if (needed - ID3V23_HEADER_SIZE > ID3V23_MAX_TAG_SIZE) {return ID3V23_RENDER_TOO_BIG;}
+		if (written != NULL) {
+			*written = needed;
+		}
+		if (needed > capacity) {return ID3V23_RENDER_SHORT_BUFFER;}
+		size = needed;
+	}
+
+	// The padding that is left follows the frames
+	id3v23_render_unsync(body, frames_size, inserted);
+	memset(tag + needed, 0, size - needed);
+
+	tag[5] |= ID3V23_FLAG_UNSYNCHRONISATION;
+	id3v23_render_write_syncsafe(size - ID3V23_HEADER_SIZE, tag + 6);
+
+	return ID3V23_RENDER_OK;
+}
+
+
+const char* id3v23_render_status_message (
+	Id3v23RenderStatus status
+) {
+
+	switch (status) {
+		case ID3V23_RENDER_OK:
+			return "Success";
+		case ID3V23_RENDER_INVALID_FIELD:
+			return "Unknown frame ID or missing member";
+		case ID3V23_RENDER_INVALID_TEXT:
+			return "Text that isn't valid UTF-8";
+		case ID3V23_RENDER_TOO_BIG:
+			return "Tag too big for ID3v2.3";
+		case ID3V23_RENDER_SHORT_BUFFER:
+			return "Buffer smaller than the tag";
+	}
+
+	return "Unknown status";
+}
+
+
+//
+// Chooses the encoding of the texts of a frame and measures the frame's
+// body. The text and the description share the encoding.
+//
+// Parameters:
+//   field:    the frame.
+//   encoding: the encoding requested, with ID3V23_RENDER_ENCODING_AUTO the
+//             texts are written in ISO-8859-1 when possible.
+//   layout:   set to how the frame is written.
+//
+// Returns:
+//   ID3V23_RENDER_OK or the reason why the frame can't be written.
+//
+Id3v23RenderStatus id3v23_render_measure_field (
+	const Id3v23Field    *field,
+	Id3v23RenderEncoding encoding,
+	Id3v23FieldLayout    *layout
+) {
+
+	RenderFieldKind kind = render_field_kind(field->id);
+	if (kind == RENDER_FIELD_INVALID) {return ID3V23_RENDER_INVALID_FIELD;}
+
+	if (
+		(kind == RENDER_FIELD_UFID || kind == RENDER_FIELD_PICTURE) &&
+		field->data == NULL && field->size > 0
+	) {
+		return ID3V23_RENDER_INVALID_FIELD;
+	}
+
+	layout->lossy = 0;
+
+	if (kind == RENDER_FIELD_UFID) {
+		// The owner is a terminated ISO-8859-1 string and the identifier is binary
+		if (field->size > ID3V23_MAX_UFID_SIZE) {return ID3V23_RENDER_INVALID_FIELD;}
+		layout->encoding = ID3V23_ENCODING_ISO_8859_1;
+		layout->size = (field->description != NULL ? strlen(field->description) : 0) + 1 + field->size;
+		return ID3V23_RENDER_OK;
+	}
+
+	// The encoding then the members that come before the texts
+	size_t size = 1;
+	if (kind == RENDER_FIELD_COMMENT) {
+		size += 3;
+	}
+	else if (kind == RENDER_FIELD_PICTURE) {
+		if (field->mime_type == NULL) {return ID3V23_RENDER_INVALID_FIELD;}
+		size += strlen(field->mime_type) + 1 + 1 + field->size;
+	}
+
+	// The description of a picture is followed by a terminator, COMM and TXXX
+	// have a description with a terminator before their text
+	int terminated = kind == RENDER_FIELD_PICTURE;
+	int described = kind == RENDER_FIELD_COMMENT || kind == RENDER_FIELD_USER_TEXT;
+	const char *text = terminated ? field->description : field->value;
+	const char *description = described ? field->description : NULL;
+
+	if (text == NULL && description == NULL) {
+		layout->encoding = ID3V23_ENCODING_ISO_8859_1;
+		layout->size = size + (terminated ? 1 : 0) + (described ? 1 : 0);
+		return ID3V23_RENDER_OK;
+	}
+
+	Id3v23TextInfo info = {0, 0, 1};
+	if (text != NULL && ! id3v23_text_scan(text, strlen(text), &info)) {
+		return ID3V23_RENDER_INVALID_TEXT;
+	}
+	Id3v23TextInfo other = {0, 0, 1};
+	if (description != NULL && ! id3v23_text_scan(description, strlen(description), &other)) {
+		return ID3V23_RENDER_INVALID_TEXT;
+	}
+	int latin1 = info.latin1 && other.latin1;
+
+	if (
+		encoding == ID3V23_RENDER_ENCODING_ISO_8859_1 ||
+		(encoding == ID3V23_RENDER_ENCODING_AUTO && latin1)
+	) {
+		layout->encoding = ID3V23_ENCODING_ISO_8859_1;
+		layout->lossy = ! latin1;
+		size += info.chars + (terminated ? 1 : 0);
+		size += described ? other.chars + 1 : 0;
+	}
+	else {
+		// Each text has a BOM
+		layout->encoding = ID3V23_ENCODING_UTF16;
+		size += 2 + info.utf16_length + (terminated ? 2 : 0);
+		size += described ? 2 + other.utf16_length + 2 : 0;
+	}
+
+	layout->size = size;
+	return ID3V23_RENDER_OK;
+}
+
+
+//
+// Writes a frame (header and body) at the given position with the exception
+// of the picture's data, which is always the last member of a frame.
+//
+// Parameters:
+//   field:  the frame to write.
+//   layout: the layout given by id3v23_render_measure_field().
+//   data:   where to write the frame, there must be enough room for the
+//           frame's header and body.
+//
+// Returns:
+//   The position right after what has been written.
+//
+uint8_t* id3v23_render_write_field_head (
+	const Id3v23Field       *field,
+	const Id3v23FieldLayout *layout,
+	uint8_t                 *data
+) {
+
+	// Frame header: ID, size and no flags
+	memcpy(data, field->id, 4);
+	data = id3v23_render_write_uint32(layout->size, data + 4);
+	*data++ = 0x00;
+	*data++ = 0x00;
+
+	uint8_t *start = data;
+	size_t length;
+
+	switch (render_field_kind(field->id)) {
+
+		case RENDER_FIELD_UFID:
+			// The owner as it is and its terminator then the identifier, no
+			// encoding
+			if (field->description != NULL) {
+				length = strlen(field->description);
+				memcpy(data, field->description, length);
+				data += length;
+			}
+			*data++ = 0x00;
+			if (field->size > 0) {
+				memcpy(data, field->data, field->size);
+				data += field->size;
+			}
+		break;
+
+		case RENDER_FIELD_COMMENT:
+			*data++ = layout->encoding;
+			memcpy(data, field->language != NULL ? field->language : ID3V23_LANGUAGE_UNKNOWN, 3);
+			data = render_write_terminated(field->description, layout->encoding, data + 3);
+			data = render_write_text(field->value, layout->encoding, data);
+		break;
+
+		case RENDER_FIELD_USER_TEXT:
+			*data++ = layout->encoding;
+			data = render_write_terminated(field->description, layout->encoding, data);
+			data = render_write_text(field->value, layout->encoding, data);
+		break;
+
+		case RENDER_FIELD_PICTURE:
+			*data++ = layout->encoding;
+			length = strlen(field->mime_type) + 1;
+			memcpy(data, field->mime_type, length);
+			data += length;
+
+			*data++ = field->picture_type;
+
+			// The description and its terminator
+			data = render_write_terminated(field->description, layout->encoding, data);
+
+			// The picture's data isn't written but it's accounted in the size
+			start -= field->size;
+		break;
+
+		default:
+			// Text frame
+			*data++ = layout->encoding;
+			data = render_write_text(field->value, layout->encoding, data);
+		break;
+	}
+
+	assert((size_t) (data - start) == layout->size);
+	return data;
+}
+
+
+//
+// Writes the header of an ID3v2.3 tag: "ID3", version 2.3.0, no flags and the
+// size of the tag as a sync safe integer.
+//
+// Parameters:
+//   size: the size of the tag without its header.
+//   data: where to write the header.
+//
+// Returns:
+//   The position right after the header.
+//
+uint8_t* id3v23_render_write_header (
+	size_t  size,
+	uint8_t *data
+) {
+
+	*data++ = 'I';
+	*data++ = 'D';
+	*data++ = '3';
+	*data++ = 0x03;
+	*data++ = 0x00;
+	*data++ = 0x00;
+
+	return id3v23_render_write_syncsafe(size, data);
+}
+
+
+//
+// Writes a 28 bits sync safe integer (the most significant bit of each byte
+// is always 0).
+//
+// Parameters:
+//   value: the number to write.
+//   data:  where to write the number.
+//
+// Returns:
+//   The position right after the number.
+//
+uint8_t* id3v23_render_write_syncsafe (
+	uint32_t value,
+	uint8_t  *data
+) {
+
+	*data++ = (value >> 21) & 0x7F;
+	*data++ = (value >> 14) & 0x7F;
+	*data++ = (value >>  7) & 0x7F;
+	*data++ = value & 0x7F;
+
+	return data;
+}
+
+
+//
+// Writes a 32 bits integer in big endian.
+//
+// Parameters:
+//   value: the number to write.
+//   data:  where to write the number.
+//
+// Returns:
+//   The position right after the number.
+//
+uint8_t* id3v23_render_write_uint32 (
+	uint32_t value,
+	uint8_t  *data
+) {
+
+	*data++ = (value >> 24) & 0xFF;
+	*data++ = (value >> 16) & 0xFF;
+	*data++ = (value >>  8) & 0xFF;
+	*data++ = value & 0xFF;
+
+	return data;
+}
+
+
+//
+// Returns the number of padding bytes to append to a tag.
+//
+// Parameters:
+//   tag_size: the size of the tag (header included) without padding.
+//   padding:  the minimal number of padding bytes.
+//   align_to: if greater than 1, the padded tag has to be a multiple of this
+//             size, this way the audio that follows starts on a block
+//             boundary (ex: 4096 for the usual filesystem block).
+//
+// Returns:
+//   The number of padding bytes.
+//
+size_t id3v23_render_padding_size (
+	size_t       tag_size,
+	unsigned int padding,
+	unsigned int align_to
+) {
+
+	size_t size = tag_size + padding;
+	if (align_to > 1) {
+		size = (size + align_to - 1) / align_to * align_to;
+	}
+
+	return size - tag_size;
+}
+
+
+//
+// Counts the bytes inserted by the unsynchronisation of data: one 0x00 after
+// each 0xFF followed by 0x00 or by a byte of at least 0xE0 and after a 0xFF
+// that ends the data. The data is skipped by blocks until a 0xFF is found,
+// data without 0xFF takes a single pass.
+//
+// Parameters:
+//   data:       the data.
+//   size:       the size of the data.
+//   false_sync: if not NULL, set to whether the data has a false sync (a 0xFF
+//               followed by a byte of at least 0xE0 or ending the data).
+//
+// Returns:
+//   The number of bytes to insert.
+//
+size_t id3v23_render_unsync_scan (
+	const uint8_t *data,
+	size_t        size,
+	int           *false_sync
+) {
+
+	const uint8_t *p = data;
+	const uint8_t *end = data + size;
+	size_t inserted = 0;
+	int found = 0;
+
+	while ((p = render_find_ff(p, end)) < end) {
+		// The byte that follows the 0xFF isn't consumed since it can be a 0xFF
+		++p;
+		uint8_t next = p < end ? *p : 0x00;
+		if (render_needs_escape(next)) {
+			++inserted;
+			found |= p == end || next != 0x00;
+		}
+	}
+
+	if (false_sync != NULL) {
+		*false_sync = found;
+	}
+	return inserted;
+}
+
+
+//
+// Unsynchronises data in place. The data is processed from its end, each
+// byte is moved once and the bytes before the first 0x00 inserted aren't
+// touched. The blocks without 0xFF are moved at once.
+//
+// Parameters:
+//   data:     the data, there must be room after it for the bytes inserted.
+//   size:     the size of the data.
+//   inserted: the number of bytes to insert as counted by
+//             id3v23_render_unsync_scan().
+//
+void id3v23_render_unsync (
+	uint8_t *data,
+	size_t  size,
+	size_t  inserted
+) {
+
+	uint8_t *p = data + size;      // The data left to process is before p
+	uint8_t *o = p + inserted;     // The output left to write is before o
+	uint8_t next = 0x00;           // The byte at p, a 0xFF at the end is escaped
+
+	while (o > p) {
+
+#if defined(__SSE2__)
+		// A block without 0xFF moves as it is, it's loaded before the store
+		// since the output overlaps the input
+		const __m128i ff16 = _mm_set1_epi8((char) 0xFF);
+		while (o > p && p - data >= 16) {
+			__m128i block = _mm_loadu_si128((const __m128i *) (p - 16));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, ff16)) != 0) {break;}
+			next = p[-16];
+			p -= 16;
+			o -= 16;
+			_mm_storeu_si128((__m128i *) o, block);
+		}
+#endif
+
+		uint8_t byte = *--p;
+		if (byte == 0xFF && render_needs_escape(next)) {
+			*--o = 0x00;
+		}
+		*--o = byte;
+		next = byte;
+	}
+
+	assert(o == p);
+}
+
+
+//
+// Returns the layout of a frame given its ID, RENDER_FIELD_INVALID when the
+// ID isn't made of 4 capital letters or digits or isn't supported.
+//
+static RenderFieldKind render_field_kind (
+	const char *id
+) {
+
+	if (id == NULL) {return RENDER_FIELD_INVALID;}
+	for (int i = 0; i < 4; ++i) {
+		if (! ((id[i] >= 'A' && id[i] <= 'Z') || (id[i] >= '0' && id[i] <= '9'))) {
+			return RENDER_FIELD_INVALID;
+		}
+	}
+	if (id[4] != '\0') {return RENDER_FIELD_INVALID;}
+
+	if (memcmp(id, "TXXX", 4) == 0) {return RENDER_FIELD_USER_TEXT;}
+	if (id[0] == 'T') {return RENDER_FIELD_TEXT;}
+	if (memcmp(id, "COMM", 4) == 0) {return RENDER_FIELD_COMMENT;}
+	if (memcmp(id, "UFID", 4) == 0) {return RENDER_FIELD_UFID;}
+	if (memcmp(id, "APIC", 4) == 0) {return RENDER_FIELD_PICTURE;}
+
+	return RENDER_FIELD_INVALID;
+}
+
+
+//
+// Returns the size of the frames of a tag, the padding starts right after.
+//
+// Parameters:
+//   body: the tag without its header.
+//   size: the size of the tag without its header.
+//
+// Returns:
+//   The size of the frames or -1 if a frame is past the end of the tag.
+//
+static size_t render_frames_end (
+	const uint8_t *body,
+	size_t        size
+) {
+
+	size_t offset = 0;
+	while (size - offset >= ID3V23_FRAME_HEADER_SIZE && body[offset] != 0x00) {
+		const uint8_t *header = body + offset;
+		size_t frame_size = ((size_t) header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+		if (frame_size > size - offset - ID3V23_FRAME_HEADER_SIZE) {return (size_t) -1;}
+		offset += ID3V23_FRAME_HEADER_SIZE + frame_size;
+	}
+
+	// Less than a frame header that isn't padding
+	for (size_t i = offset; i < size; ++i) {
+		if (body[i] != 0x00) {return (size_t) -1;}
+	}
+
+	return offset;
+}
+
+
+//
+// Returns the position of the next 0xFF or the end when there's none. The
+// data is compared 32 bytes at a time when the CPU has AVX2, 16 otherwise.
+//
+static inline const uint8_t* render_find_ff (
+	const uint8_t *p,
+	const uint8_t *end
+) {
+
+#ifdef RENDER_AVX2
+	if (end - p >= 32 && __builtin_cpu_supports("avx2")) {
+		p = render_find_ff_avx2(p, end);
+		if (p == end || *p == 0xFF) {return p;}
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i ff16 = _mm_set1_epi8((char) 0xFF);
+	for (; end - p >= 16; p += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *) p);
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(block, ff16));
+		if (mask != 0) {return p + __builtin_ctz(mask);}
+	}
+	for (; p < end; ++p) {
+		if (*p == 0xFF) {return p;}
+	}
+	return end;
+#else
+	const uint8_t *ff = (const uint8_t *) memchr(p, 0xFF, end - p);
+	return ff != NULL ? ff : end;
+#endif
+}
+
+
+#ifdef RENDER_AVX2
+//
+// Returns the position of the next 0xFF, or where less than 32 bytes are
+// left when there's none. Built for AVX2, only called when the CPU has it.
+//
+static const uint8_t* render_find_ff_avx2 (
+	const uint8_t *p,
+	const uint8_t *end
+) {
+
+	const __m256i ff = _mm256_set1_epi8((char) 0xFF);
+	for (; end - p >= 32; p += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *) p);
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, ff));
+		if (mask != 0) {return p + __builtin_ctz(mask);}
+	}
+
+	return p;
+}
+#endif
+
+
+//
+// Returns true if a 0x00 has to be inserted between a 0xFF and the byte that
+// follows it.
+//
+static inline int render_needs_escape (
+	uint8_t next
+) {
+
+	return next == 0x00 || next >= 0xE0;
+}
+
+
+//
+// Measures the frames of a tag and the padding that follows them.
+//
+// Parameters:
+//   fields:       the frames.
+//   count:        the number of frames.
+//   options:      how the tag is rendered, NULL for the defaults.
+//   size:         set to the size of the frames (headers included).
+//   padding_size: set to the number of padding bytes.
+//
+// Returns:
+//   ID3V23_RENDER_OK or the reason why the tag can't be written.
+//
+static Id3v23RenderStatus render_measure (
+	const Id3v23Field         *fields,
+	size_t                    count,
+	const Id3v23RenderOptions *options,
+	size_t                    *size,
+	size_t                    *padding_size
+) {
+
+	if (options == NULL) {
+		options = &render_default_options;
+	}
+
+	size_t total = 0;
+	for (size_t i = 0; i < count; ++i) {
+		Id3v23FieldLayout layout;
+		Id3v23RenderStatus status = id3v23_render_measure_field(&fields[i], options->encoding, &layout);
+		if (status != ID3V23_RENDER_OK) {return status;}
+
+		total += ID3V23_FRAME_HEADER_SIZE + layout.size;
+		if (total > ID3V23_MAX_TAG_SIZE) {return ID3V23_RENDER_TOO_BIG;}
+	}
+
+	*padding_size = id3v23_render_padding_size(ID3V23_HEADER_SIZE + total, options->padding, options->align_to);
+	if (total + *padding_size > ID3V23_MAX_TAG_SIZE) {return ID3V23_RENDER_TOO_BIG;}
+
+	*size = total;
+	return ID3V23_RENDER_OK;
+}
+
+
+//
+// Writes an UTF-8 string in one of the encodings of ID3v2.3, the UTF-16
+// strings start with a byte order mark and are big endian. The terminating
+// null character isn't written, a NULL string is written as an empty string.
+//
+// Parameters:
+//   text:     a valid UTF-8 string or NULL.
+//   encoding: ID3V23_ENCODING_ISO_8859_1 or ID3V23_ENCODING_UTF16.
+//   data:     where to write the string, there must be enough room for the
+//             string as measured by id3v23_text_scan().
+//
+// Returns:
+//   The position right after the string.
+//
+static uint8_t* render_write_text (
+	const char    *text,
+	const uint8_t encoding,
+	uint8_t       *data
+) {
+
+	size_t length = text != NULL ? strlen(text) : 0;
+	if (encoding == ID3V23_ENCODING_ISO_8859_1) {
+		return id3v23_text_write_latin1(text, length, data);
+	}
+
+	*data++ = 0xFE;
+	*data++ = 0xFF;
+	return id3v23_text_write_utf16(text, length, data);
+}
+
+
+//
+// Writes an UTF-8 string followed by its terminator in one of the encodings
+// of ID3v2.3. A missing string is written as an empty string.
+//
+// Parameters:
+//   text:     a valid UTF-8 string or NULL.
+//   encoding: ID3V23_ENCODING_ISO_8859_1 or ID3V23_ENCODING_UTF16.
+//   data:     where to write the string.
+//
+// Returns:
+//   The position right after the terminator.
+//
+static uint8_t* render_write_terminated (
+	const char    *text,
+	const uint8_t encoding,
+	uint8_t       *data
+) {
+
+	if (text != NULL) {
+		data = render_write_text(text, encoding, data);
+	}
+	else if (encoding == ID3V23_ENCODING_UTF16) {
+		*data++ = 0xFE;
+		*data++ = 0xFF;
+	}
+
+	*data++ = 0x00;
+	if (encoding == ID3V23_ENCODING_UTF16) {
+		*data++ = 0x00;
+	}
+
+	return data;
+}
@@ -0,0 +1,178 @@
+/* Renders ID3v2.3 tags without GStreamer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+
+#ifndef ID3V23_RENDER_H
+#define ID3V23_RENDER_H
+
+/* Plain C without GLib, the library is used outside of GStreamer */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of the tag header and of each frame header */
+#define ID3V23_HEADER_SIZE          10
+#define ID3V23_FRAME_HEADER_SIZE    10
+
+/* Largest size of a tag without its header (28 bits sync safe integer) */
+#define ID3V23_MAX_TAG_SIZE         0x0FFFFFFF
+
+/* Text encodings written in the frames */
+#define ID3V23_ENCODING_ISO_8859_1  0x00
+#define ID3V23_ENCODING_UTF16       0x01
+
+/* Language of the COMM frames without language */
+#define ID3V23_LANGUAGE_UNKNOWN     "XXX"
+
+/* Largest identifier of an UFID frame */
+#define ID3V23_MAX_UFID_SIZE        64
+
+/* Flag of the unsynchronised tags in the tag header */
+#define ID3V23_FLAG_UNSYNCHRONISATION  0x80
+
+typedef enum {
+	ID3V23_RENDER_OK = 0,
+	ID3V23_RENDER_INVALID_FIELD,  /* unknown frame ID or missing member */
+	ID3V23_RENDER_INVALID_TEXT,   /* a text isn't valid UTF-8 */
+	ID3V23_RENDER_TOO_BIG,        /* the tag doesn't fit in ID3v2.3 */
+	ID3V23_RENDER_SHORT_BUFFER    /* the output buffer is smaller than the tag */
+} Id3v23RenderStatus;
+
+/* Encodings of the texts, in the order of the element's property "encoding" */
+typedef enum {
+	ID3V23_RENDER_ENCODING_AUTO,        /* ISO-8859-1 when possible, UTF-16 otherwise */
+	ID3V23_RENDER_ENCODING_ISO_8859_1,  /* ISO-8859-1, other characters become '?' */
+	ID3V23_RENDER_ENCODING_UTF16        /* UTF-16 */
+} Id3v23RenderEncoding;
+
+/* When a tag is unsynchronised, in the order of the element's property "unsynchronise" */
+typedef enum {
+	ID3V23_RENDER_UNSYNC_OFF,     /* never */
+	ID3V23_RENDER_UNSYNC_AUTO,    /* only when the tag has a false MPEG sync */
+	ID3V23_RENDER_UNSYNC_ALWAYS   /* always */
+} Id3v23RenderUnsync;
+
+typedef struct _Id3v23Field         Id3v23Field;
+typedef struct _Id3v23FieldLayout   Id3v23FieldLayout;
+typedef struct _Id3v23RenderOptions Id3v23RenderOptions;
+
+/*
+ * A frame to render, the layout of the frame is given by its ID:
+ *   T???: value
+ *   COMM: language, description and value
+ *   TXXX: description and value
+ *   UFID: description (the owner) and data (the identifier)
+ *   APIC: mime_type, picture_type, description and data (the picture)
+ * The texts are UTF-8, a NULL text is written as an empty text. The members
+ * that the frame doesn't use are ignored. Nothing is copied, the field only
+ * has to live until the tag is rendered.
+ */
+struct _Id3v23Field {
+	const char  *id;            /* the frame ID (ex: "TIT2") */
+	const char  *value;         /* the text */
+	const char  *description;   /* the description or the owner */
+	const char  *language;      /* 3 letters, NULL for ID3V23_LANGUAGE_UNKNOWN */
+	const char  *mime_type;     /* "image/jpeg" or "image/png" */
+	uint8_t     picture_type;   /* 0x03 for the front cover, 0x00 for other */
+	const void  *data;          /* the binary member */
+	size_t      size;           /* size of the binary member */
+};
+
+/* How a frame is written once measured */
+struct _Id3v23FieldLayout {
+	uint8_t     encoding;       /* ID3V23_ENCODING_ISO_8859_1 or ID3V23_ENCODING_UTF16 */
+	size_t      size;           /* size of the frame's body */
+	int         lossy;          /* characters are replaced by '?' in ISO-8859-1 */
+};
+
+/* How the tag is rendered, NULL gives the defaults (all 0) */
+struct _Id3v23RenderOptions {
+	unsigned int          padding;   /* minimal padding after the frames */
+	unsigned int          align_to;  /* if greater than 1, pad the tag to a multiple of this size */
+	Id3v23RenderEncoding  encoding;  /* encoding of the texts */
+};
+
+/* Returns the exact size of the tag (header and padding included) */
+Id3v23RenderStatus id3v23_render_size (const Id3v23Field *fields, size_t count, const Id3v23RenderOptions *options, size_t *size);
+
+/* Renders the tag into a buffer of the given size, sets the bytes written */
+Id3v23RenderStatus id3v23_render (const Id3v23Field *fields, size_t count, const Id3v23RenderOptions *options, uint8_t *data, size_t size, size_t *written);
+
+/* Unsynchronises a rendered tag in place, the padding absorbs the bytes inserted */
+Id3v23RenderStatus id3v23_render_unsynchronise (uint8_t *tag, size_t size, size_t capacity, Id3v23RenderUnsync mode, size_t *written);
+
+/* Returns a description of a status */
+const char * id3v23_render_status_message (Id3v23RenderStatus status);
+
+/* Chooses the encoding of a frame and measures its body */
+Id3v23RenderStatus id3v23_render_measure_field (const Id3v23Field *field, Id3v23RenderEncoding encoding, Id3v23FieldLayout *layout);
+
+/* Writes a measured frame, header and body, except the data of an APIC frame */
+uint8_t * id3v23_render_write_field_head (const Id3v23Field *field, const Id3v23FieldLayout *layout, uint8_t *data);
+
+/* Writes the tag header for a tag of the given size (without its header) */
+uint8_t * id3v23_render_write_header (size_t size, uint8_t *data);
+
+/* Writes a 28 bits sync safe integer */
+uint8_t * id3v23_render_write_syncsafe (uint32_t value, uint8_t *data);
+
+/* Writes a 32 bits integer in big endian */
+uint8_t * id3v23_render_write_uint32 (uint32_t value, uint8_t *data);
+
+/* Returns the padding to append to a tag of the given size (header included) */
+size_t id3v23_render_padding_size (size_t tag_size, unsigned int padding, unsigned int align_to);
+
+/* Counts the bytes that the unsynchronisation of data inserts, tells whether it has a false sync */
+size_t id3v23_render_unsync_scan (const uint8_t *data, size_t size, int *false_sync);
+
+/* Unsynchronises data in place, there must be room after it for the bytes inserted */
+void id3v23_render_unsync (uint8_t *data, size_t size, size_t inserted);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ID3V23_RENDER_H */
@@ -0,0 +1,480 @@
+/* Scaling benchmark of the element id3v23mux
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+//
+// Measures how the element scales when many pipelines run in the same
+// process, as when hundreds of tracks are tagged at once.
+//
+// For 1, 2, 4... up to --max-threads threads, each thread renders the same
+// tags over and over through gst_id3v23_mux_render_tags() and then runs
+// pipelines "fakesrc ! id3v23mux ! fakesink" one after the other. The
+// throughput of all the threads is compared with the throughput of a single
+// thread: the scaling is how many times faster, the efficiency is the scaling
+// divided by the number of threads (1.0 is linear).
+//
+// Each tag rendered is compared with a tag rendered beforehand by a single
+// thread, a render that depends on shared state would give another tag. The
+// program fails when a tag differs.
+//
+// The tags have a cover, so each render copies a picture.
+//
+// Usage:
+//   id3v23scale [--max-threads=64] [--renders=N] [--pipelines=N] [--buffers=N] [--output=FILE]
+//
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gstid3v23mux.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gst/tag/tag.h>
+
+
+// Default largest number of threads
+#define SCALE_MAX_THREADS  64
+
+// Default number of tags rendered by each thread
+#define SCALE_RENDERS      2000
+
+// Default number of pipelines run by each thread
+#define SCALE_PIPELINES    20
+
+// Default number of buffers pushed through each pipeline, of the size of a
+// frame of a 128 kbps MP3
+#define SCALE_BUFFERS      2000
+#define SCALE_BUFFER_SIZE  418
+
+// Size of the cover
+#define SCALE_COVER_SIZE   (100 * 1024)
+
+
+// What the threads of a run do
+typedef enum {
+	SCALE_RENDER,
+	SCALE_PIPELINE
+} ScaleMode;
+
+// A run of the benchmark, shared by its threads
+typedef struct _ScaleRun ScaleRun;
+struct _ScaleRun {
+	ScaleMode        mode;
+	const GstTagList *tags;
+	GstBuffer        *reference;  // The tag rendered by a single thread
+	GMutex           *lock;       // Protects started and go
+	GCond            *cond;
+	guint            started;     // Threads waiting for the start
+	gboolean         go;          // TRUE once all the threads are started
+	volatile gint    mismatches;  // Tags that differ from the reference
+	volatile gint    failures;    // Pipelines that didn't reach EOS
+};
+
+// The measures of a run
+typedef struct _ScaleResult ScaleResult;
+struct _ScaleResult {
+	guint   threads;
+	guint64 ops;      // renders or pipelines done
+	gdouble seconds;  // time taken by all the threads
+};
+
+
+static gint opt_max_threads = SCALE_MAX_THREADS;
+static gint opt_renders = SCALE_RENDERS;
+static gint opt_pipelines = SCALE_PIPELINES;
+static gint opt_buffers = SCALE_BUFFERS;
+static gchar *opt_output = NULL;
+
+static GOptionEntry entries [] = {
+	{"max-threads", 't', 0, G_OPTION_ARG_INT, &opt_max_threads, "Largest number of threads", "N"},
+	{"renders", 'r', 0, G_OPTION_ARG_INT, &opt_renders, "Number of tags rendered by each thread", "N"},
+	{"pipelines", 'p', 0, G_OPTION_ARG_INT, &opt_pipelines, "Number of pipelines run by each thread", "N"},
+	{"buffers", 'b', 0, G_OPTION_ARG_INT, &opt_buffers, "Number of buffers pushed through each pipeline", "N"},
+	{"output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Write the results in this file instead of the standard output", "FILE"},
+	{NULL}
+};
+
+
+static GstTagList* scale_tags (void);
+
+static void scale_run (
+	ScaleRun    *run,
+	guint       threads,
+	ScaleResult *result
+);
+
+static gpointer scale_thread (
+	gpointer data
+);
+
+static void scale_render (
+	ScaleRun *run
+);
+
+static void scale_pipeline (
+	ScaleRun *run
+);
+
+static void scale_print_results (
+	FILE              *out,
+	const gchar       *name,
+	const ScaleResult *results,
+	guint             count
+);
+
+
+
+
+int main (int argc, char **argv) {
+
+	if (! g_thread_supported()) {
+		g_thread_init(NULL);
+	}
+
+	GError *error = NULL;
+	GOptionContext *context = g_option_context_new("- measure how the element id3v23mux scales with the threads");
+	g_option_context_add_main_entries(context, entries, NULL);
+	g_option_context_add_group(context, gst_init_get_option_group());
+	if (! g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (opt_max_threads <= 0 || opt_renders <= 0 || opt_pipelines <= 0 || opt_buffers <= 0) {
+		g_printerr("The number of threads, renders, pipelines and buffers must be positive\n");
+		return 1;
+	}
+
+	// The element is registered without loading the plugin
+	if (! gst_id3v23_mux_plugin_init(NULL)) {
+		g_printerr("Can't register the element %s\n", PLUGIN);
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if (opt_output != NULL) {
+		out = fopen(opt_output, "w");
+		if (out == NULL) {
+			g_printerr("Can't open %s: %s\n", opt_output, g_strerror(errno));
+			return 1;
+		}
+	}
+
+	ScaleRun run;
+	memset(&run, 0, sizeof(run));
+	run.tags = scale_tags();
+	run.reference = gst_id3v23_mux_render_tags(run.tags, 0, 0);
+	run.lock = g_mutex_new();
+	run.cond = g_cond_new();
+	if (run.reference == NULL) {
+		g_printerr("The tag can't be rendered\n");
+		return 1;
+	}
+
+	guint count = 0;
+	for (guint threads = 1; threads <= (guint) opt_max_threads; threads *= 2) {
+		++count;
+	}
+	ScaleResult *renders = g_new0(ScaleResult, count);
+	ScaleResult *pipelines = g_new0(ScaleResult, count);
+
+	guint i = 0;
+	for (guint threads = 1; threads <= (guint) opt_max_threads; threads *= 2, ++i) {
+		g_printerr("%u threads\n", threads);
+
+		run.mode = SCALE_RENDER;
+		scale_run(&run, threads, &renders[i]);
+
+		run.mode = SCALE_PIPELINE;
+		scale_run(&run, threads, &pipelines[i]);
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"version\": \"%s\",\n", VERSION);
+	fprintf(out, "  \"cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(out, "  \"mismatches\": %d,\n", g_atomic_int_get(&run.mismatches));
+	fprintf(out, "  \"failures\": %d,\n", g_atomic_int_get(&run.failures));
+	scale_print_results(out, "render", renders, count);
+	fprintf(out, ",\n");
+	scale_print_results(out, "pipeline", pipelines, count);
+	fprintf(out, "\n}\n");
+
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	gint mismatches = g_atomic_int_get(&run.mismatches);
+	if (mismatches > 0) {
+		g_printerr("%d tags differ from the tag rendered by a single thread\n", mismatches);
+	}
+
+	g_free(renders);
+	g_free(pipelines);
+	g_mutex_free(run.lock);
+	g_cond_free(run.cond);
+	gst_buffer_unref(run.reference);
+	gst_tag_list_free((GstTagList *) run.tags);
+
+	return mismatches > 0 || g_atomic_int_get(&run.failures) > 0 ? 1 : 0;
+}
+
+
+//
+// Returns the tags of a typical track with a JPEG cover. The bytes of the
+// picture are random so that they don't compress.
+//
+static GstTagList* scale_tags (void) {
+
+	GstBuffer *image = gst_buffer_new_and_alloc(SCALE_COVER_SIZE);
+	GRand *rand = g_rand_new_with_seed(SCALE_COVER_SIZE);
+	for (gsize i = 0; i < SCALE_COVER_SIZE; ++i) {
+		GST_BUFFER_DATA(image)[i] = (guint8) g_rand_int(rand);
+	}
+	g_rand_free(rand);
+
+	GstCaps *caps = gst_caps_new_simple("image/jpeg", NULL);
+	gst_buffer_set_caps(image, caps);
+	gst_caps_unref(caps);
+
+	GstTagList *tags = gst_tag_list_new();
+	GDate *date = g_date_new_dmy(21, G_DATE_MARCH, 1975);
+	gst_tag_list_add(
+		tags, GST_TAG_MERGE_REPLACE,
+		GST_TAG_TITLE, "Shine On You Crazy Diamond (Parts I-V)",
+		GST_TAG_ARTIST, "Pink Floyd",
+		GST_TAG_ALBUM, "Wish You Were Here",
+		GST_TAG_GENRE, "Progressive Rock",
+		GST_TAG_TRACK_NUMBER, 1,
+		GST_TAG_TRACK_COUNT, 5,
+		GST_TAG_DATE, date,
+		GST_TAG_IMAGE, image,
+		NULL
+	);
+	g_date_free(date);
+	gst_buffer_unref(image);
+
+	return tags;
+}
+
+
+//
+// Runs the threads of a run and measures the time from their start to the
+// end of the last one. The threads wait for each other before starting so
+// that the creation of the threads isn't measured.
+//
+// Parameters:
+//   run:     the run.
+//   threads: the number of threads.
+//   result:  set to the measures.
+//
+static void scale_run (
+	ScaleRun    *run,
+	guint       threads,
+	ScaleResult *result
+) {
+
+	run->started = 0;
+	run->go = FALSE;
+
+	GThread **workers = g_new(GThread *, threads);
+	for (guint i = 0; i < threads; ++i) {
+		workers[i] = g_thread_create(scale_thread, run, TRUE, NULL);
+	}
+
+	g_mutex_lock(run->lock);
+	while (run->started < threads) {
+		g_cond_wait(run->cond, run->lock);
+	}
+	GTimer *timer = g_timer_new();
+	run->go = TRUE;
+	g_cond_broadcast(run->cond);
+	g_mutex_unlock(run->lock);
+
+	for (guint i = 0; i < threads; ++i) {
+		g_thread_join(workers[i]);
+	}
+
+	result->threads = threads;
+	result->seconds = g_timer_elapsed(timer, NULL);
+	result->ops = (guint64) threads * (run->mode == SCALE_RENDER ? opt_renders : opt_pipelines);
+	g_timer_destroy(timer);
+	g_free(workers);
+}
+
+
+//
+// The body of a thread, waits for the start of the run.
+//
+static gpointer scale_thread (
+	gpointer data
+) {
+
+	ScaleRun *run = (ScaleRun *) data;
+
+	g_mutex_lock(run->lock);
+	++run->started;
+	g_cond_broadcast(run->cond);
+	while (! run->go) {
+		g_cond_wait(run->cond, run->lock);
+	}
+	g_mutex_unlock(run->lock);
+
+	if (run->mode == SCALE_RENDER) {
+		scale_render(run);
+	}
+	else {
+		scale_pipeline(run);
+	}
+
+	return NULL;
+}
+
+
+//
+// Renders the tags over and over and compares each tag with the reference.
+//
+static void scale_render (
+	ScaleRun *run
+) {
+
+	const guint8 *reference = GST_BUFFER_DATA(run->reference);
+	guint size = GST_BUFFER_SIZE(run->reference);
+
+	for (gint i = 0; i < opt_renders; ++i) {
+		GstBuffer *buffer = gst_id3v23_mux_render_tags(run->tags, 0, 0);
+		if (buffer == NULL || GST_BUFFER_SIZE(buffer) != size || memcmp(GST_BUFFER_DATA(buffer), reference, size) != 0) {
+			g_atomic_int_inc(&run->mismatches);
+		}
+		if (buffer != NULL) {
+			gst_buffer_unref(buffer);
+		}
+	}
+}
+
+
+//
+// Runs the pipelines "fakesrc ! id3v23mux ! fakesink" one after the other.
+//
+static void scale_pipeline (
+	ScaleRun *run
+) {
+
+	// sizetype=2 gives buffers of sizemax bytes, filltype=1 leaves them as
+	// they are allocated
+	gchar *description = g_strdup_printf(
+		"fakesrc num-buffers=%d sizetype=2 sizemax=%u filltype=1 ! %s name=mux ! fakesink sync=false",
+		opt_buffers, SCALE_BUFFER_SIZE, PLUGIN
+	);
+
+	for (gint i = 0; i < opt_pipelines; ++i) {
+		GError *error = NULL;
+		GstElement *pipeline = gst_parse_launch(description, &error);
+		if (pipeline == NULL) {
+			g_printerr("Can't create the pipeline: %s\n", error->message);
+			g_error_free(error);
+			g_atomic_int_inc(&run->failures);
+			continue;
+		}
+
+		GstElement *mux = gst_bin_get_by_name(GST_BIN(pipeline), "mux");
+		gst_tag_setter_merge_tags(GST_TAG_SETTER(mux), run->tags, GST_TAG_MERGE_REPLACE);
+		gst_object_unref(mux);
+
+		gst_element_set_state(pipeline, GST_STATE_PLAYING);
+		GstBus *bus = gst_element_get_bus(pipeline);
+		GstMessage *message = gst_bus_timed_pop_filtered(
+			bus,
+			GST_CLOCK_TIME_NONE,
+			(GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR)
+		);
+		if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_EOS) {
+			g_atomic_int_inc(&run->failures);
+		}
+		gst_message_unref(message);
+		gst_object_unref(bus);
+
+		gst_element_set_state(pipeline, GST_STATE_NULL);
+		gst_object_unref(pipeline);
+	}
+
+	g_free(description);
+}
+
+
+//
+// Writes the results of a mode as a JSON member: the throughput for each
+// number of threads and how it compares with a single thread.
+//
+static void scale_print_results (
+	FILE              *out,
+	const gchar       *name,
+	const ScaleResult *results,
+	guint             count
+) {
+
+	gdouble single = results[0].ops / results[0].seconds;
+
+	fprintf(out, "  \"%s\": [\n", name);
+	for (guint i = 0; i < count; ++i) {
+		gdouble throughput = results[i].ops / results[i].seconds;
+		gdouble scaling = throughput / single;
+		fprintf(
+			out,
+			"    {\"threads\": %u, \"ops\": %" G_GUINT64_FORMAT ", \"ops_per_sec\": %.1f, \"scaling\": %.2f, \"efficiency\": %.2f}%s\n",
+			results[i].threads,
+			results[i].ops,
+			throughput,
+			scaling,
+			scaling / results[i].threads,
+			i + 1 < count ? "," : ""
+		);
+	}
+	fprintf(out, "  ]");
+}
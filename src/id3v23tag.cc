@@ -0,0 +1,1006 @@
+/* In-place ID3v2.3 retagger built on the id3v23mux renderer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// Retags MP3 files without rewriting their audio.
+//
+// The existing ID3v2 tag is parsed, merged with the tags given on the command
+// line and rendered again with the same code as the element id3v23mux. The
+// frames of an ID3v2.3 tag that the element doesn't write (lyrics, other
+// comments, PRIV, POPM, the other TXXX and pictures...) are carried over as
+// they are; they are dropped from the tags of the other versions, which is
+// reported. When the new tag fits in the space taken by the old one (padding
+// included) it's written in place, over the old tag, and the audio isn't
+// touched at all. Otherwise the file is rewritten with the audio copied by
+// the kernel (copy_file_range) into a new file that then replaces the
+// original one.
+//
+// Many files can be retagged in one run from a manifest, each line giving a
+// file and its tags separated by tabs. The files are then processed by a pool
+// of threads (one per CPU by default) fed through a bounded queue, so that a
+// large manifest isn't loaded in memory at once, and the throughput is
+// reported at the end.
+//
+// Usage:
+//   id3v23tag --tag title="A Song" --tag track-number=3 --padding=4096 a.mp3
+//   id3v23tag --manifest=album.txt --threads=8 --quiet
+//
+// Manifest format (blank lines and lines starting with # are ignored):
+//   PATH<TAB>NAME=VALUE<TAB>NAME=VALUE...
+//
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "gstid3v23mux.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <gst/tag/tag.h>
+
+
+// Size of the ID3v2 header and footer
+#define ID3V2_HEADER_SIZE  10
+
+// Flags of an ID3v2.3 tag and of its frames (first and second byte)
+#define ID3V23_FLAG_UNSYNCHRONISATION  0x80
+#define ID3V23_FLAG_EXTENDED_HEADER    0x40
+#define ID3V23_FRAME_TAG_ALTER         0x80
+#define ID3V23_FRAME_COMPRESSED        0x80
+#define ID3V23_FRAME_ENCRYPTED         0x40
+
+// The picture type of the APIC frames read as the preview image
+#define ID3V23_PICTURE_PNG32ICON  0x01
+
+// Size of the chunks used when copy_file_range() isn't available
+#define COPY_CHUNK_SIZE    (1024 * 1024)
+
+// Number of jobs that can wait in the queue for each thread
+#define QUEUE_JOBS_PER_THREAD  4
+
+
+// A file to retag
+typedef struct _RetagJob RetagJob;
+struct _RetagJob {
+	gchar      *path;
+	GstTagList *tags;     // tags to set
+	GPtrArray  *removed;  // names of the tags to remove
+};
+
+// The state shared by the threads retagging the files
+typedef struct _RetagBatch RetagBatch;
+struct _RetagBatch {
+	GMutex  *lock;
+	GCond   *cond;     // signaled when a job is done
+	guint   pending;   // jobs queued or running
+	guint   files;     // files retagged
+	guint   failures;  // files that couldn't be retagged
+	guint64 bytes;     // bytes written
+};
+
+
+static gchar **opt_tags = NULL;
+static gint opt_padding = 0;
+static gint opt_align_to = 0;
+static gchar *opt_manifest = NULL;
+static gint opt_threads = 0;
+static gboolean opt_quiet = FALSE;
+static gchar **opt_files = NULL;
+
+static GOptionEntry entries [] = {
+	{"tag", 't', 0, G_OPTION_ARG_STRING_ARRAY, &opt_tags, "Tag to set, an empty value removes the tag", "NAME=VALUE"},
+	{"padding", 'p', 0, G_OPTION_ARG_INT, &opt_padding, "Padding to reserve when the file has to be rewritten", "BYTES"},
+	{"align-to", 'a', 0, G_OPTION_ARG_INT, &opt_align_to, "Align the audio to a multiple of this size when the file has to be rewritten", "BYTES"},
+	{"manifest", 'm', 0, G_OPTION_ARG_FILENAME, &opt_manifest, "Retag the files listed in this file, one PATH<TAB>NAME=VALUE... per line", "FILE"},
+	{"threads", 'j', 0, G_OPTION_ARG_INT, &opt_threads, "Number of files retagged in parallel (default: number of CPUs)", "N"},
+	{"quiet", 'q', 0, G_OPTION_ARG_NONE, &opt_quiet, "Only report errors and the final statistics", NULL},
+	{G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_files, NULL, "FILE..."},
+	{NULL}
+};
+
+
+static gboolean retag_parse_tags (
+	GstTagList *tags,
+	GPtrArray  *removed,
+	gchar      **specs
+);
+
+static gboolean retag_read_manifest (
+	const gchar      *path,
+	const GstTagList *tags,
+	GPtrArray        *removed,
+	GThreadPool      *pool,
+	RetagBatch       *batch
+);
+
+static void retag_batch_push (
+	GThreadPool *pool,
+	RetagBatch  *batch,
+	RetagJob    *job
+);
+
+static void retag_batch_worker (
+	gpointer data,
+	gpointer user_data
+);
+
+static RetagJob* retag_job_new (
+	const gchar      *path,
+	const GstTagList *tags,
+	GPtrArray        *removed
+);
+
+static void retag_job_free (
+	RetagJob *job
+);
+
+static gsize retag_tag_size (
+	const guint8 *data,
+	gsize        size
+);
+
+static gboolean retag_file (
+	const RetagJob *job,
+	guint64        *written
+);
+
+static void retag_keep_frames (
+	const gchar  *path,
+	const guint8 *tag,
+	gsize        size,
+	GByteArray   *kept
+);
+
+static gchar* retag_frame_string (
+	guint8       encoding,
+	const guint8 *data,
+	gsize        size
+);
+
+static void retag_append_frames (
+	GstBuffer        *tag,
+	const GByteArray *kept
+);
+
+static gboolean retag_rewrite_file (
+	const gchar *path,
+	int         fd,
+	gsize       file_size,
+	gsize       old_size,
+	GstBuffer   *tag,
+	guint64     *written
+);
+
+static gboolean retag_copy_range (
+	int   fd_in,
+	off_t offset,
+	int   fd_out,
+	gsize length
+);
+
+
+
+
+int main (int argc, char **argv) {
+
+	GError *error = NULL;
+	GOptionContext *context = g_option_context_new("- retag MP3 files in place with ID3v2.3 tags");
+	g_option_context_add_main_entries(context, entries, NULL);
+	g_option_context_add_group(context, gst_init_get_option_group());
+	if (! g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (opt_files == NULL && opt_manifest == NULL) {
+		g_printerr("No files to retag\n");
+		return 1;
+	}
+
+	GstTagList *tags = gst_tag_list_new();
+	GPtrArray *removed = g_ptr_array_new();
+	if (! retag_parse_tags(tags, removed, opt_tags)) {
+		gst_tag_list_free(tags);
+		g_ptr_array_foreach(removed, (GFunc) g_free, NULL);
+		g_ptr_array_free(removed, TRUE);
+		return 1;
+	}
+
+	if (opt_threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		opt_threads = cpus > 0 ? cpus : 1;
+	}
+
+	RetagBatch batch = {0, };
+	batch.lock = g_mutex_new();
+	batch.cond = g_cond_new();
+	GThreadPool *pool = g_thread_pool_new(retag_batch_worker, &batch, opt_threads, TRUE, &error);
+	if (pool == NULL) {
+		g_printerr("Can't start the threads: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	GTimer *timer = g_timer_new();
+	int status = 0;
+
+	for (gchar **path = opt_files; path != NULL && *path != NULL; ++path) {
+		retag_batch_push(pool, &batch, retag_job_new(*path, tags, removed));
+	}
+	if (opt_manifest != NULL && ! retag_read_manifest(opt_manifest, tags, removed, pool, &batch)) {
+		status = 1;
+	}
+
+	// Waits for the queued jobs
+	g_thread_pool_free(pool, FALSE, TRUE);
+	gdouble seconds = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	if (batch.failures > 0) {
+		status = 1;
+	}
+	if (seconds <= 0) {
+		seconds = 1e-6;
+	}
+	g_print(
+		"%u files retagged, %u failed in %.3f s (%.1f files/s, %.2f MB/s)\n",
+		batch.files,
+		batch.failures,
+		seconds,
+		batch.files / seconds,
+		batch.bytes / seconds / (1024 * 1024)
+	);
+
+	g_cond_free(batch.cond);
+	g_mutex_free(batch.lock);
+	gst_tag_list_free(tags);
+	g_ptr_array_foreach(removed, (GFunc) g_free, NULL);
+	g_ptr_array_free(removed, TRUE);
+	g_strfreev(opt_tags);
+	g_strfreev(opt_files);
+	g_free(opt_manifest);
+
+	return status;
+}
+
+
+//
+// Parses the tags given in the command line.
+//
+// Parameters:
+//   tags:    where to add the tags.
+//   removed: where to add the names of the tags to remove.
+//   specs:   the tags in the format NAME=VALUE, the value is deserialized
+//            according to the type of the tag (ex: date=2008-05-21). A tag
+//            without a value will be removed from the files.
+//
+// Returns:
+//   TRUE if all the tags are valid.
+//
+static gboolean retag_parse_tags (
+	GstTagList *tags,
+	GPtrArray  *removed,
+	gchar      **specs
+) {
+
+	if (specs == NULL) {return TRUE;}
+
+	for (gchar **spec = specs; *spec != NULL; ++spec) {
+		gchar **pair = g_strsplit(*spec, "=", 2);
+		if (pair[0] == NULL || pair[1] == NULL || ! gst_tag_exists(pair[0])) {
+			g_printerr("Invalid tag %s\n", *spec);
+			g_strfreev(pair);
+			return FALSE;
+		}
+
+		// The tags without a value are removed later by retag_file()
+		if (*pair[1] == '\0') {
+			gst_tag_list_remove_tag(tags, pair[0]);
+			g_ptr_array_add(removed, g_strdup(pair[0]));
+			g_strfreev(pair);
+			continue;
+		}
+
+		GValue value = {0, };
+		g_value_init(&value, gst_tag_get_type(pair[0]));
+		if (! gst_value_deserialize(&value, pair[1])) {
+			g_printerr("Invalid value for tag %s: %s\n", pair[0], pair[1]);
+			g_value_unset(&value);
+			g_strfreev(pair);
+			return FALSE;
+		}
+
+		gst_tag_list_add_value(tags, GST_TAG_MERGE_REPLACE, pair[0], &value);
+		g_value_unset(&value);
+		g_strfreev(pair);
+	}
+
+	return TRUE;
+}
+
+
+//
+// Reads a manifest and queues a job for each file listed.
+//
+// Parameters:
+//   path:    the manifest, each line is a file followed by its tags, all
+//            separated by tabs. Empty lines and lines starting with # are
+//            ignored.
+//   tags:    the tags given in the command line, the tags of the manifest
+//            replace them.
+//   removed: the names of the tags removed in the command line.
+//   pool:    the threads retagging the files.
+//   batch:   the state of the threads.
+//
+// Returns:
+//   TRUE if the whole manifest is valid.
+//
+static gboolean retag_read_manifest (
+	const gchar      *path,
+	const GstTagList *tags,
+	GPtrArray        *removed,
+	GThreadPool      *pool,
+	RetagBatch       *batch
+) {
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		g_printerr("Can't open %s: %s\n", path, g_strerror(errno));
+		return FALSE;
+	}
+
+	gboolean success = TRUE;
+	gchar *line = NULL;
+	size_t line_size = 0;
+	guint line_number = 0;
+	while (getline(&line, &line_size, file) != -1) {
+		++line_number;
+		g_strchomp(line);
+		if (*line == '\0' || *line == '#') {continue;}
+
+		gchar **fields = g_strsplit(line, "\t", -1);
+		RetagJob *job = retag_job_new(fields[0], tags, removed);
+		if (retag_parse_tags(job->tags, job->removed, fields + 1)) {
+			retag_batch_push(pool, batch, job);
+		}
+		else {
+			g_printerr("%s:%u: skipping %s\n", path, line_number, fields[0]);
+			retag_job_free(job);
+			success = FALSE;
+		}
+		g_strfreev(fields);
+	}
+
+	free(line);
+	fclose(file);
+
+	return success;
+}
+
+
+//
+// Queues a job, waiting while the queue is full.
+//
+// Parameters:
+//   pool:  the threads retagging the files.
+//   batch: the state of the threads.
+//   job:   the job to queue, the pool takes ownership of it.
+//
+static void retag_batch_push (
+	GThreadPool *pool,
+	RetagBatch  *batch,
+	RetagJob    *job
+) {
+
+	guint limit = g_thread_pool_get_max_threads(pool) * QUEUE_JOBS_PER_THREAD;
+
+	g_mutex_lock(batch->lock);
+	while (batch->pending >= limit) {
+		g_cond_wait(batch->cond, batch->lock);
+	}
+	++batch->pending;
+	g_mutex_unlock(batch->lock);
+
+	g_thread_pool_push(pool, job, NULL);
+}
+
+
+//
+// Retags a file in a thread of the pool.
+//
+// Parameters:
+//   data:      the job.
+//   user_data: the state of the threads.
+//
+static void retag_batch_worker (
+	gpointer data,
+	gpointer user_data
+) {
+
+	RetagJob *job = (RetagJob *) data;
+	RetagBatch *batch = (RetagBatch *) user_data;
+
+	guint64 written = 0;
+	gboolean success = retag_file(job, &written);
+	retag_job_free(job);
+
+	g_mutex_lock(batch->lock);
+	if (success) {
+		++batch->files;
+		batch->bytes += written;
+	}
+	else {
+		++batch->failures;
+	}
+	--batch->pending;
+	g_cond_signal(batch->cond);
+	g_mutex_unlock(batch->lock);
+}
+
+
+//
+// Creates a job.
+//
+// Parameters:
+//   path:    the file to retag.
+//   tags:    the tags to set, they are copied.
+//   removed: the names of the tags to remove, they are copied.
+//
+// Returns:
+//   The job, free it with retag_job_free().
+//
+static RetagJob* retag_job_new (
+	const gchar      *path,
+	const GstTagList *tags,
+	GPtrArray        *removed
+) {
+
+	RetagJob *job = g_new0(RetagJob, 1);
+	job->path = g_strdup(path);
+	job->tags = gst_tag_list_copy(tags);
+	job->removed = g_ptr_array_sized_new(removed->len);
+	for (guint i = 0; i < removed->len; ++i) {
+		g_ptr_array_add(job->removed, g_strdup((gchar *) g_ptr_array_index(removed, i)));
+	}
+
+	return job;
+}
+
+
+//
+// Frees a job.
+//
+// Parameters:
+//   job: the job to free.
+//
+static void retag_job_free (
+	RetagJob *job
+) {
+
+	g_free(job->path);
+	gst_tag_list_free(job->tags);
+	g_ptr_array_foreach(job->removed, (GFunc) g_free, NULL);
+	g_ptr_array_free(job->removed, TRUE);
+	g_free(job);
+}
+
+
+//
+// Returns the size of the ID3v2 tag (header, footer and padding included)
+// found at the beginning of the data.
+//
+// Parameters:
+//   data: the beginning of the file.
+//   size: the number of bytes available.
+//
+// Returns:
+//   The size of the tag or 0 if there's no tag.
+//
+static gsize retag_tag_size (
+	const guint8 *data,
+	gsize        size
+) {
+
+	if (size < ID3V2_HEADER_SIZE || memcmp(data, "ID3", 3) != 0) {return 0;}
+
+	// The size is a sync safe integer
+	if ((data[6] | data[7] | data[8] | data[9]) & 0x80) {return 0;}
+	gsize tag_size = ID3V2_HEADER_SIZE
+		+ (data[6] << 21)
+		+ (data[7] << 14)
+		+ (data[8] << 7)
+		+ data[9]
+	;
+
+	// ID3v2.4 can have a footer
+	if (data[3] == 4 && (data[5] & 0x10)) {
+		tag_size += ID3V2_HEADER_SIZE;
+	}
+
+	return tag_size;
+}
+
+
+//
+// Retags a single file, this is called from several threads at once.
+//
+// Parameters:
+//   job:     the file to retag and the tags to write, they replace the tags
+//            already in the file.
+//   written: where to store the number of bytes written.
+//
+// Returns:
+//   TRUE if the file was retagged.
+//
+static gboolean retag_file (
+	const RetagJob *job,
+	guint64        *written
+) {
+
+	const gchar *path = job->path;
+	const GstTagList *new_tags = job->tags;
+
+	int fd = open(path, O_RDWR);
+	if (fd == -1) {
+		g_printerr("Can't open %s: %s\n", path, g_strerror(errno));
+		return FALSE;
+	}
+
+	struct stat st;
+	guint8 header[ID3V2_HEADER_SIZE];
+	if (fstat(fd, &st) == -1) {
+		g_printerr("Can't stat %s: %s\n", path, g_strerror(errno));
+		close(fd);
+		return FALSE;
+	}
+	ssize_t read_size = pread(fd, header, sizeof(header), 0);
+	gsize old_size = retag_tag_size(header, read_size > 0 ? read_size : 0);
+	if (old_size > (gsize) st.st_size) {
+		g_printerr("Truncated ID3v2 tag in %s\n", path);
+		close(fd);
+		return FALSE;
+	}
+
+
+	// Only the region of the old tag is mapped, this is all that gets rewritten
+	// when the new tag fits
+	guint8 *old_tag = NULL;
+	GstTagList *tags;
+	GByteArray *kept = g_byte_array_new();
+	if (old_size > 0) {
+		old_tag = (guint8 *) mmap(NULL, old_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (old_tag == MAP_FAILED) {
+			g_printerr("Can't map %s: %s\n", path, g_strerror(errno));
+			close(fd);
+			return FALSE;
+		}
+
+		GstBuffer *buffer = gst_buffer_new();
+		GST_BUFFER_DATA(buffer) = old_tag;
+		GST_BUFFER_SIZE(buffer) = old_size;
+		GstTagList *old_tags = gst_tag_list_from_id3v2_tag(buffer);
+		gst_buffer_unref(buffer);
+
+		// The frames that can't be rendered from the tags are copied as they are
+		retag_keep_frames(path, old_tag, old_size, kept);
+
+		if (old_tags != NULL) {
+			tags = gst_tag_list_merge(old_tags, new_tags, GST_TAG_MERGE_REPLACE);
+			gst_tag_list_free(old_tags);
+		}
+		else {
+			tags = gst_tag_list_copy(new_tags);
+		}
+	}
+	else {
+		tags = gst_tag_list_copy(new_tags);
+	}
+
+	// Drop the tags that were given without a value
+	for (guint i = 0; i < job->removed->len; ++i) {
+		gst_tag_list_remove_tag(tags, (gchar *) g_ptr_array_index(job->removed, i));
+	}
+
+
+	// Padding the tag to a multiple of the old tag's size gives a tag of
+	// exactly the old size when the new tag fits in it. The frames kept go in
+	// the padding, right after the frames rendered.
+	gboolean success = TRUE;
+	GstBuffer *tag = NULL;
+	if (old_size > 0) {
+		tag = gst_id3v23_mux_render_tags(tags, kept->len, old_size);
+	}
+
+	if (tag != NULL && GST_BUFFER_SIZE(tag) == old_size) {
+		retag_append_frames(tag, kept);
+		memcpy(old_tag, GST_BUFFER_DATA(tag), old_size);
+		if (msync(old_tag, old_size, MS_SYNC) == -1) {
+			g_printerr("Can't write %s: %s\n", path, g_strerror(errno));
+			success = FALSE;
+		}
+		else {
+			*written = old_size;
+			if (! opt_quiet) {
+				g_print("%s: tag rewritten in place (%" G_GSIZE_FORMAT " bytes)\n", path, old_size);
+			}
+		}
+	}
+	else {
+		if (tag != NULL) {
+			gst_buffer_unref(tag);
+		}
+		tag = gst_id3v23_mux_render_tags(tags, MAX(opt_padding, 0) + kept->len, MAX(opt_align_to, 0));
+		if (tag == NULL) {
+			g_printerr("Can't render the tag of %s\n", path);
+			success = FALSE;
+		}
+		else {
+			retag_append_frames(tag, kept);
+			success = retag_rewrite_file(path, fd, st.st_size, old_size, tag, written);
+		}
+	}
+
+	if (tag != NULL) {
+		gst_buffer_unref(tag);
+	}
+	if (old_tag != NULL) {
+		munmap(old_tag, old_size);
+	}
+	g_byte_array_free(kept, TRUE);
+	gst_tag_list_free(tags);
+	close(fd);
+
+	return success;
+}
+
+
+//
+// Collects the frames of the old tag that the element wouldn't write again
+// once the tag is parsed: the frames not mapped to a tag, the TXXX and UFID
+// frames of other owners, the comments beyond the first one and the pictures
+// beyond the first image and the first preview. The frames that ask to be
+// discarded when the tag changes are dropped.
+//
+// Only the frames of an ID3v2.3 tag can be copied as they are, the frames of
+// the other versions are dropped and this is reported.
+//
+// Parameters:
+//   path: the file retagged, for the messages.
+//   tag:  the old tag.
+//   size: the size of the old tag.
+//   kept: where to append the frames kept.
+//
+static void retag_keep_frames (
+	const gchar  *path,
+	const guint8 *tag,
+	gsize        size,
+	GByteArray   *kept
+) {
+
+	if (tag[3] != 3 || (tag[5] & ID3V23_FLAG_UNSYNCHRONISATION)) {
+		g_printerr(
+			"%s: %s ID3v2.%u tag, its frames not written by id3v23mux are dropped\n",
+			path,
+			tag[3] == 3 ? "unsynchronised" : "an",
+			tag[3]
+		);
+		return;
+	}
+
+	gsize offset = ID3V2_HEADER_SIZE;
+	if (tag[5] & ID3V23_FLAG_EXTENDED_HEADER) {
+		if (offset + 4 > size) {return;}
+		offset += 4 + GST_READ_UINT32_BE(tag + offset);
+	}
+
+	gboolean comment = FALSE;
+	gboolean image = FALSE;
+	gboolean preview = FALSE;
+	guint dropped = 0;
+	while (offset + ID3V2_HEADER_SIZE <= size && tag[offset] != 0) {
+		const guint8 *frame = tag + offset;
+		gsize body_size = GST_READ_UINT32_BE(frame + 4);
+		if (body_size > size - offset - ID3V2_HEADER_SIZE) {
+			g_printerr("%s: truncated frame %.4s, the frames after it are dropped\n", path, frame);
+			break;
+		}
+		offset += ID3V2_HEADER_SIZE + body_size;
+
+		const guint8 *body = frame + ID3V2_HEADER_SIZE;
+		gchar id[5];
+		memcpy(id, frame, 4);
+		id[4] = '\0';
+
+		if (frame[8] & ID3V23_FRAME_TAG_ALTER) {
+			++dropped;
+			continue;
+		}
+
+		// The bodies compressed or encrypted can't be read, they are taken as
+		// the frames written by the element
+		gboolean readable = ! (frame[9] & (ID3V23_FRAME_COMPRESSED | ID3V23_FRAME_ENCRYPTED));
+
+		gboolean keep;
+		if (! readable || body_size == 0) {
+			keep = ! gst_id3v23_mux_writes_frame(id, NULL);
+		}
+		else if (strcmp(id, "TXXX") == 0 || strcmp(id, "UFID") == 0) {
+			// The description of TXXX, the owner (ISO-8859-1) of UFID
+			gchar *description = id[0] == 'T'
+				? retag_frame_string(body[0], body + 1, body_size - 1)
+				: retag_frame_string(0x00, body, body_size)
+			;
+			keep = description == NULL || ! gst_id3v23_mux_writes_frame(id, description);
+			g_free(description);
+		}
+		else if (strcmp(id, "COMM") == 0) {
+			// Only the first comment without description is read as the comment
+			gchar *description = body_size > 4
+				? retag_frame_string(body[0], body + 4, body_size - 4)
+				: NULL
+			;
+			keep = description == NULL || *description != '\0' || comment;
+			comment = comment || ! keep;
+			g_free(description);
+		}
+		else if (strcmp(id, "APIC") == 0) {
+			// The picture type follows the encoding and the MIME type
+			const guint8 *mime_end = (const guint8 *) memchr(body + 1, 0, body_size - 1);
+			if (mime_end == NULL || mime_end + 1 >= body + body_size) {
+				keep = TRUE;
+			}
+			else if (mime_end[1] == ID3V23_PICTURE_PNG32ICON) {
+				keep = preview;
+				preview = TRUE;
+			}
+			else {
+				keep = image;
+				image = TRUE;
+			}
+		}
+		else {
+			keep = ! gst_id3v23_mux_writes_frame(id, NULL);
+		}
+
+		if (keep) {
+			g_byte_array_append(kept, frame, ID3V2_HEADER_SIZE + body_size);
+		}
+	}
+
+	if (dropped > 0 && ! opt_quiet) {
+		g_print("%s: %u frames to discard when the tag changes dropped\n", path, dropped);
+	}
+}
+
+
+//
+// Converts a string of a frame into UTF-8, the string ends at its terminator
+// or at the end of the data.
+//
+// Parameters:
+//   encoding: the encoding of the string (0x00: ISO-8859-1, 0x01: UTF-16).
+//   data:     the string.
+//   size:     the bytes available.
+//
+// Returns:
+//   The string in UTF-8 or NULL if it can't be converted. The string has to
+//   be freed with g_free.
+//
+static gchar* retag_frame_string (
+	guint8       encoding,
+	const guint8 *data,
+	gsize        size
+) {
+
+	gsize length = 0;
+	if (encoding == 0x00) {
+		while (length < size && data[length] != 0) {
+			++length;
+		}
+		return g_convert((const gchar *) data, length, "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+	}
+	else if (encoding == 0x01) {
+		while (length + 1 < size && (data[length] | data[length + 1]) != 0) {
+			length += 2;
+		}
+		return g_convert((const gchar *) data, length, "UTF-8", "UTF-16", NULL, NULL, NULL);
+	}
+
+	return NULL;
+}
+
+
+//
+// Writes the frames kept from the old tag right after the frames of the new
+// tag, in its padding.
+//
+// Parameters:
+//   tag:  the new tag, rendered with at least the size of the frames kept as
+//         padding.
+//   kept: the frames kept.
+//
+static void retag_append_frames (
+	GstBuffer        *tag,
+	const GByteArray *kept
+) {
+
+	if (kept->len == 0) {return;}
+
+	guint8 *data = GST_BUFFER_DATA(tag);
+	gsize size = GST_BUFFER_SIZE(tag);
+	gsize offset = ID3V2_HEADER_SIZE;
+	while (offset + ID3V2_HEADER_SIZE <= size && data[offset] != 0) {
+		offset += ID3V2_HEADER_SIZE + GST_READ_UINT32_BE(data + offset + 4);
+	}
+
+	g_assert(offset + kept->len <= size);
+	memcpy(data + offset, kept->data, kept->len);
+}
+
+
+//
+// Writes a new file made of the new tag followed by the audio of the original
+// file and replaces the original file with it.
+//
+// Parameters:
+//   path:      the file to retag.
+//   fd:        the file descriptor of the original file.
+//   file_size: the size of the original file.
+//   old_size:  the size of the original tag.
+//   tag:       the new tag.
+//   written:   where to store the number of bytes written.
+//
+// Returns:
+//   TRUE if the file was rewritten.
+//
+static gboolean retag_rewrite_file (
+	const gchar *path,
+	int         fd,
+	gsize       file_size,
+	gsize       old_size,
+	GstBuffer   *tag,
+	guint64     *written
+) {
+
+	gchar *tmp_path = g_strdup_printf("%s.XXXXXX", path);
+	int tmp_fd = g_mkstemp(tmp_path);
+	if (tmp_fd == -1) {
+		g_printerr("Can't create %s: %s\n", tmp_path, g_strerror(errno));
+		g_free(tmp_path);
+		return FALSE;
+	}
+
+	struct stat st;
+	gboolean success = fstat(fd, &st) == 0
+		&& fchmod(tmp_fd, st.st_mode & 07777) == 0
+		&& write(tmp_fd, GST_BUFFER_DATA(tag), GST_BUFFER_SIZE(tag)) == (ssize_t) GST_BUFFER_SIZE(tag)
+		&& retag_copy_range(fd, old_size, tmp_fd, file_size - old_size)
+		&& fsync(tmp_fd) == 0
+	;
+	if (! success) {
+		g_printerr("Can't write %s: %s\n", tmp_path, g_strerror(errno));
+	}
+
+	close(tmp_fd);
+
+	if (success && rename(tmp_path, path) == -1) {
+		g_printerr("Can't replace %s: %s\n", path, g_strerror(errno));
+		success = FALSE;
+	}
+	if (! success) {
+		unlink(tmp_path);
+	}
+	else {
+		*written = GST_BUFFER_SIZE(tag) + file_size - old_size;
+		if (! opt_quiet) {
+			g_print("%s: file rewritten (tag of %u bytes)\n", path, GST_BUFFER_SIZE(tag));
+		}
+	}
+
+	g_free(tmp_path);
+	return success;
+}
+
+
+//
+// Copies a range of a file at the current position of another file. The copy
+// is made by the kernel with copy_file_range(), which can share the blocks on
+// filesystems supporting reflinks. Plain reads and writes are used when the
+// system call isn't available.
+//
+// Parameters:
+//   fd_in:  the file to copy from.
+//   offset: where to start copying.
+//   fd_out: the file to copy to.
+//   length: the number of bytes to copy.
+//
+// Returns:
+//   TRUE if the range was copied.
+//
+static gboolean retag_copy_range (
+	int   fd_in,
+	off_t offset,
+	int   fd_out,
+	gsize length
+) {
+
+	while (length > 0) {
+		ssize_t copied = copy_file_range(fd_in, &offset, fd_out, NULL, length, 0);
+		if (copied == -1 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL)) {
+			break;
+		}
+		if (copied <= 0) {
+			return FALSE;
+		}
+		length -= copied;
+	}
+
+	// Fallback to a regular copy
+	guint8 *chunk = length > 0 ? (guint8 *) g_malloc(COPY_CHUNK_SIZE) : NULL;
+	while (length > 0) {
+		ssize_t read_size = pread(fd_in, chunk, MIN(length, COPY_CHUNK_SIZE), offset);
+		if (read_size <= 0 || write(fd_out, chunk, read_size) != read_size) {
+			g_free(chunk);
+			return FALSE;
+		}
+		offset += read_size;
+		length -= read_size;
+	}
+	g_free(chunk);
+
+	return TRUE;
+}
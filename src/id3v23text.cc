@@ -0,0 +1,351 @@
+/* UTF-8 text transcoding for the ID3v2.3 writer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// Converts the UTF-8 strings of GStreamer into the encodings supported by
+// ID3v2.3: ISO-8859-1 and UTF-16.
+//
+// The strings are processed straight from UTF-8 into the buffer of the tag,
+// without going through iconv. Most tags are plain ASCII, the ASCII runs are
+// processed 16 bytes at a time with SSE2 (32 bytes with AVX2 when the CPU has
+// it) and the other characters are handled one by one.
+//
+
+#include "id3v23text.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The AVX2 code is built in a function of its own and used when the CPU
+// supports it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEXT_AVX2  1
+#include <immintrin.h>
+#endif
+
+
+static size_t id3v23_text_decode (
+	const uint8_t *p,
+	uint32_t      *c
+);
+
+#ifdef TEXT_AVX2
+static const uint8_t* id3v23_text_skip_ascii_avx2 (
+	const uint8_t *p,
+	const uint8_t *end
+) __attribute__((target("avx2")));
+#endif
+
+
+
+
+#ifdef TEXT_AVX2
+//
+// Skips the ASCII characters 32 bytes at a time. Built for AVX2, only called
+// when the CPU has it.
+//
+// Returns:
+//   the first block with a non ASCII byte, or where less than 32 bytes are
+//   left.
+//
+static const uint8_t* id3v23_text_skip_ascii_avx2 (
+	const uint8_t *p,
+	const uint8_t *end
+) {
+
+	for (; end - p >= 32; p += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *) p);
+		if (_mm256_movemask_epi8(block) != 0) {break;}
+	}
+
+	return p;
+}
+#endif
+
+
+//
+// Validates an UTF-8 string and measures what it takes once encoded. The
+// overlong sequences, the surrogates and the characters past U+10FFFF are
+// rejected.
+//
+// Parameters:
+//   text:   the string.
+//   length: the length of the string in bytes (without the null character).
+//   info:   where to store the measures.
+//
+// Returns:
+//   non-zero if the string is valid UTF-8.
+//
+int id3v23_text_scan (
+	const char     *text,
+	size_t         length,
+	Id3v23TextInfo *info
+) {
+
+	const uint8_t *p = (const uint8_t *) text;
+	const uint8_t *end = p + length;
+	size_t chars = 0;
+	size_t utf16_length = 0;
+	int latin1 = 1;
+#ifdef TEXT_AVX2
+	int avx2 = length >= 32 && __builtin_cpu_supports("avx2");
+#endif
+
+	while (p < end) {
+
+		// Skip the ASCII characters by blocks
+#ifdef TEXT_AVX2
+		if (avx2) {
+			const uint8_t *ascii = p;
+			p = id3v23_text_skip_ascii_avx2(p, end);
+			chars += p - ascii;
+		}
+#endif
+#if defined(__SSE2__)
+		while (end - p >= 16) {
+			__m128i block = _mm_loadu_si128((const __m128i *) p);
+			if (_mm_movemask_epi8(block) != 0) {break;}
+			p += 16;
+			chars += 16;
+		}
+#endif
+		if (p == end) {break;}
+
+		uint8_t byte = *p;
+		if (byte < 0x80) {
+			++p;
+			++chars;
+			continue;
+		}
+
+		// A multibyte sequence
+		size_t size;
+		uint32_t c;
+		uint32_t min;
+		if ((byte & 0xE0) == 0xC0) {
+			size = 2;
+			c = byte & 0x1F;
+			min = 0x80;
+		}
+		else if ((byte & 0xF0) == 0xE0) {
+			size = 3;
+			c = byte & 0x0F;
+			min = 0x800;
+		}
+		else if ((byte & 0xF8) == 0xF0) {
+			size = 4;
+			c = byte & 0x07;
+			min = 0x10000;
+		}
+		else {
+			return 0;
+		}
+
+		if ((size_t) (end - p) < size) {return 0;}
+		for (size_t i = 1; i < size; ++i) {
+			if ((p[i] & 0xC0) != 0x80) {return 0;}
+			c = (c << 6) | (p[i] & 0x3F);
+		}
+		if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+			return 0;
+		}
+
+		p += size;
+		++chars;
+		if (c > 0xFF) {
+			latin1 = 0;
+		}
+		// Characters outside of the BMP take a surrogate pair
+		if (c > 0xFFFF) {
+			utf16_length += 2;
+		}
+	}
+
+	info->chars = chars;
+	info->utf16_length = utf16_length + 2 * chars;
+	info->latin1 = latin1;
+
+	return 1;
+}
+
+
+//
+// Writes an UTF-8 string as ISO-8859-1. The characters that don't exist in
+// ISO-8859-1 are replaced by '?'. The terminating null character isn't
+// written.
+//
+// Parameters:
+//   text:   a valid UTF-8 string.
+//   length: the length of the string in bytes (without the null character).
+//   data:   where to write the string, there must be room for as many bytes
+//           as there are characters.
+//
+// Returns:
+//   The position right after the string.
+//
+uint8_t* id3v23_text_write_latin1 (
+	const char *text,
+	size_t     length,
+	uint8_t    *data
+) {
+
+	const uint8_t *p = (const uint8_t *) text;
+	const uint8_t *end = p + length;
+
+	while (p < end) {
+
+		// ASCII is copied as it is
+#if defined(__SSE2__)
+		while (end - p >= 16) {
+			__m128i block = _mm_loadu_si128((const __m128i *) p);
+			if (_mm_movemask_epi8(block) != 0) {break;}
+			_mm_storeu_si128((__m128i *) data, block);
+			p += 16;
+			data += 16;
+		}
+		if (p == end) {break;}
+#endif
+
+		uint32_t c;
+		p += id3v23_text_decode(p, &c);
+		*data++ = c <= 0xFF ? c : '?';
+	}
+
+	return data;
+}
+
+
+//
+// Writes an UTF-8 string as UTF-16 big endian, without byte order mark and
+// without the terminating null character.
+//
+// Parameters:
+//   text:   a valid UTF-8 string.
+//   length: the length of the string in bytes (without the null character).
+//   data:   where to write the string, there must be room for the length
+//           returned by id3v23_text_scan().
+//
+// Returns:
+//   The position right after the string.
+//
+uint8_t* id3v23_text_write_utf16 (
+	const char *text,
+	size_t     length,
+	uint8_t    *data
+) {
+
+	const uint8_t *p = (const uint8_t *) text;
+	const uint8_t *end = p + length;
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+#endif
+
+	while (p < end) {
+
+		// ASCII is widened by interleaving the bytes with zeros
+#if defined(__SSE2__)
+		while (end - p >= 16) {
+			__m128i block = _mm_loadu_si128((const __m128i *) p);
+			if (_mm_movemask_epi8(block) != 0) {break;}
+			_mm_storeu_si128((__m128i *) data, _mm_unpacklo_epi8(zero, block));
+			_mm_storeu_si128((__m128i *) (data + 16), _mm_unpackhi_epi8(zero, block));
+			p += 16;
+			data += 32;
+		}
+		if (p == end) {break;}
+#endif
+
+		uint32_t c;
+		p += id3v23_text_decode(p, &c);
+		if (c > 0xFFFF) {
+			c -= 0x10000;
+			uint16_t high = 0xD800 + (c >> 10);
+			uint16_t low = 0xDC00 + (c & 0x3FF);
+			*data++ = high >> 8;
+			*data++ = high & 0xFF;
+			*data++ = low >> 8;
+			*data++ = low & 0xFF;
+		}
+		else {
+			*data++ = c >> 8;
+			*data++ = c & 0xFF;
+		}
+	}
+
+	return data;
+}
+
+
+//
+// Decodes a character of a valid UTF-8 string.
+//
+// Parameters:
+//   p: the first byte of the character.
+//   c: where to store the character.
+//
+// Returns:
+//   The number of bytes used by the character.
+//
+static size_t id3v23_text_decode (
+	const uint8_t *p,
+	uint32_t      *c
+) {
+
+	if (p[0] < 0x80) {
+		*c = p[0];
+		return 1;
+	}
+	else if ((p[0] & 0xE0) == 0xC0) {
+		*c = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+		return 2;
+	}
+	else if ((p[0] & 0xF0) == 0xE0) {
+		*c = ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+		return 3;
+	}
+
+	*c = ((p[0] & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+	return 4;
+}
@@ -0,0 +1,76 @@
+/* UTF-8 text transcoding for the ID3v2.3 writer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef ID3V23_TEXT_H
+#define ID3V23_TEXT_H
+
+/* Plain C without GLib, as the render library */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _Id3v23TextInfo Id3v23TextInfo;
+
+/* What is known about an UTF-8 string once scanned */
+struct _Id3v23TextInfo {
+	size_t  chars;         /* number of characters */
+	size_t  utf16_length;  /* bytes needed in UTF-16 (without BOM) */
+	int     latin1;        /* all the characters fit in ISO-8859-1 */
+};
+
+/* Validates an UTF-8 string and measures it, returns 0 if it's invalid */
+int id3v23_text_scan (const char *text, size_t length, Id3v23TextInfo *info);
+
+/* Writes a valid UTF-8 string as ISO-8859-1, unsupported characters become '?' */
+uint8_t * id3v23_text_write_latin1 (const char *text, size_t length, uint8_t *data);
+
+/* Writes a valid UTF-8 string as UTF-16 big endian (without BOM) */
+uint8_t * id3v23_text_write_utf16 (const char *text, size_t length, uint8_t *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ID3V23_TEXT_H */
@@ -0,0 +1,181 @@
+/* Microbenchmark of the UTF-8 transcoding of the ID3v2.3 writer
+ * Copyright 2008 - Emmauel Rodriguez <emmanuel.rodriguez@gmail.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// Measures the time taken to encode typical tag values (ASCII, Latin-1 and
+// CJK) with the transcoder of id3v23mux and with g_convert(), which was used
+// before.
+//
+// Usage:
+//   id3v23textbench [ITERATIONS]
+//
+
+#include "id3v23text.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Default number of times each string is encoded
+#define BENCH_ITERATIONS  200000
+
+
+static gdouble bench_transcoder (
+	const gchar *text,
+	guint       iterations,
+	guint8      *data
+);
+
+static gdouble bench_g_convert (
+	const gchar *text,
+	guint       iterations
+);
+
+
+
+
+int main (int argc, char **argv) {
+
+	static const struct {
+		const gchar *name;
+		const gchar *text;
+	} inputs [] = {
+		{"ascii", "Shine On You Crazy Diamond (Parts I-V) - Remastered Version"},
+		{"latin-1", "Déjà vu à l'Opéra de Montréal, über Straße und Ñandú"},
+		{"cjk", "千と千尋の神隠し オリジナル・サウンドトラック 「あの夏へ」"},
+	};
+
+	guint iterations = argc > 1 ? (guint) atoi(argv[1]) : BENCH_ITERATIONS;
+	if (iterations == 0) {
+		iterations = BENCH_ITERATIONS;
+	}
+
+	guint8 *data = (guint8 *) g_malloc(4096);
+
+	printf("%-8s %6s %12s %12s %8s\n", "input", "bytes", "ns/string", "g_convert", "speedup");
+	for (guint i = 0; i < G_N_ELEMENTS(inputs); ++i) {
+		gdouble transcoder = bench_transcoder(inputs[i].text, iterations, data);
+		gdouble converter = bench_g_convert(inputs[i].text, iterations);
+		printf(
+			"%-8s %6u %12.1f %12.1f %7.1fx\n",
+			inputs[i].name,
+			(guint) strlen(inputs[i].text),
+			transcoder * 1e9 / iterations,
+			converter * 1e9 / iterations,
+			converter / transcoder
+		);
+	}
+
+	g_free(data);
+
+	return 0;
+}
+
+
+//
+// Encodes a string the way id3v23mux does: the string is scanned, then
+// written in ISO-8859-1 when possible and in UTF-16 otherwise.
+//
+// Returns:
+//   The time taken in seconds.
+//
+static gdouble bench_transcoder (
+	const gchar *text,
+	guint       iterations,
+	guint8      *data
+) {
+
+	gsize length = strlen(text);
+	gsize total = 0;
+	GTimer *timer = g_timer_new();
+
+	for (guint i = 0; i < iterations; ++i) {
+		Id3v23TextInfo info;
+		if (! id3v23_text_scan(text, length, &info)) {
+			g_error("Invalid UTF-8: %s", text);
+		}
+
+		guint8 *end = info.latin1
+			? id3v23_text_write_latin1(text, length, data)
+			: id3v23_text_write_utf16(text, length, data)
+		;
+		total += end - data;
+	}
+
+	gdouble elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	// Keeps the compiler from removing the loop
+	if (total == 0) {
+		printf("Nothing was written\n");
+	}
+
+	return elapsed;
+}
+
+
+//
+// Encodes a string in UTF-16 with g_convert().
+//
+// Returns:
+//   The time taken in seconds.
+//
+static gdouble bench_g_convert (
+	const gchar *text,
+	guint       iterations
+) {
+
+	GTimer *timer = g_timer_new();
+
+	for (guint i = 0; i < iterations; ++i) {
+		gsize written = 0;
+		gchar *converted = g_convert(text, -1, "UTF-16BE", "UTF-8", NULL, &written, NULL);
+		g_free(converted);
+	}
+
+	gdouble elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	return elapsed;
+}